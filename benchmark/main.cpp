@@ -0,0 +1,154 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+#include <jamspell/lang_model.hpp>
+#include <jamspell/spell_corrector.hpp>
+
+using namespace NJamSpell;
+
+void PrintUsage(const char** argv) {
+    std::cerr << "Usage: " << argv[0] << " model.bin text.txt [repeats] [--huge-pages] [--prefault] [--mlock]" << std::endl;
+}
+
+// A positive number of repeats, up to MAX_REPEATS
+bool ParseRepeats(const std::string& arg, size_t& repeats) {
+    const unsigned long MAX_REPEATS = 1000000;
+    if (arg.empty() || !std::isdigit((unsigned char)arg[0])) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long value = std::strtoul(arg.c_str(), &end, 10);
+    if (errno == ERANGE || *end != '\0' || value == 0 || value > MAX_REPEATS) {
+        return false;
+    }
+    repeats = value;
+    return true;
+}
+
+void Report(const std::string& name, uint64_t timeMs, size_t operations, const std::string& unit) {
+    double perOp = operations ? 1000.0 * double(timeMs) / double(operations) : 0.0;
+    std::cout << std::left << std::setw(24) << name
+              << std::right << std::setw(10) << timeMs << " ms"
+              << std::setw(12) << std::fixed << std::setprecision(2) << perOp << " us/" << unit
+              << std::endl;
+}
+
+const char* ScoringModeName(EScoringMode mode) {
+    return mode == EScoringMode::Exact ? "exact" : "log_tables";
+}
+
+void BenchScore(TSpellCorrector& corrector, const TSentences& sentences, size_t repeats) {
+    double checkSum = 0;
+    for (EScoringMode mode: {EScoringMode::Exact, EScoringMode::LogTables}) {
+        corrector.SetScoringMode(mode);
+        const TLangModel& model = corrector.GetLangModel();
+        uint64_t startTime = GetCurrentTimeMs();
+        for (size_t r = 0; r < repeats; ++r) {
+            for (auto&& s: sentences) {
+                checkSum += model.Score(s);
+            }
+        }
+        Report(std::string("score/") + ScoringModeName(mode), GetCurrentTimeMs() - startTime,
+               repeats * sentences.size(), "sentence");
+    }
+    corrector.SetScoringMode(EScoringMode::Exact);
+    std::cerr << "[info] score checksum " << checkSum << std::endl;
+}
+
+void BenchFix(TSpellCorrector& corrector, const std::wstring& text, size_t words, size_t repeats) {
+    for (EScoringMode mode: {EScoringMode::Exact, EScoringMode::LogTables}) {
+        corrector.SetScoringMode(mode);
+        uint64_t startTime = GetCurrentTimeMs();
+        size_t resultSize = 0;
+        for (size_t r = 0; r < repeats; ++r) {
+            resultSize += corrector.FixFragment(text).size();
+        }
+        Report(std::string("fix/") + ScoringModeName(mode), GetCurrentTimeMs() - startTime,
+               repeats * words, "word");
+    }
+    corrector.SetScoringMode(EScoringMode::Exact);
+}
+
+// Counts of random n-grams of random words, batched like the sentence
+// scorer does. Most of them are unseen, so every lookup is a cache and
+// TLB miss in the store, which is what memory options are about.
+void BenchLookup(const TLangModel& model, size_t repeats) {
+    const size_t keysCount = 1 << 20;
+    const size_t batchSize = 256;
+    TWordId words = model.GetStats().VocabWords;
+    if (!words) {
+        return;
+    }
+    std::mt19937 random(42);
+    std::uniform_int_distribution<TWordId> randomWord(0, words - 1);
+    std::vector<TGramKey> keys(keysCount);
+    for (auto&& key: keys) {
+        key = model.GetOrder() >= 3 ? TGramKey(randomWord(random), randomWord(random), randomWord(random))
+                                    : TGramKey(randomWord(random), randomWord(random));
+    }
+    std::vector<TCount> counts(batchSize);
+    uint64_t checkSum = 0;
+    uint64_t startTime = GetCurrentTimeMs();
+    for (size_t r = 0; r < repeats; ++r) {
+        for (size_t i = 0; i < keysCount; i += batchSize) {
+            model.GetCountsBatch(&keys[i], batchSize, &counts[0]);
+            checkSum += counts[0];
+        }
+    }
+    Report("lookup/random", GetCurrentTimeMs() - startTime, repeats * keysCount, "lookup");
+    std::cerr << "[info] lookup checksum " << checkSum << std::endl;
+}
+
+int main(int argc, const char** argv) {
+    if (argc < 3) {
+        PrintUsage(argv);
+        return 42;
+    }
+    std::string modelFile = argv[1];
+    std::string textFile = argv[2];
+    size_t repeats = 3;
+    TMemoryOptions memoryOptions;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--huge-pages") {
+            memoryOptions.HugePages = true;
+        } else if (arg == "--prefault") {
+            memoryOptions.Prefault = true;
+        } else if (arg == "--mlock") {
+            memoryOptions.Lock = true;
+        } else if (!ParseRepeats(arg, repeats)) {
+            std::cerr << "[error] unknown argument " << arg << std::endl;
+            PrintUsage(argv);
+            return 42;
+        }
+    }
+
+    TSpellCorrector corrector;
+    corrector.SetMemoryOptions(memoryOptions);
+    std::cerr << "[info] loading model" << std::endl;
+    uint64_t startTime = GetCurrentTimeMs();
+    if (!corrector.LoadLangModel(modelFile)) {
+        std::cerr << "[error] failed to load model" << std::endl;
+        return 42;
+    }
+    Report("load", GetCurrentTimeMs() - startTime, 1, "model");
+
+    std::wstring text = UTF8ToWide(LoadFile(textFile));
+    ToLower(text);
+    TSentences sentences = corrector.GetLangModel().Tokenize(text);
+    size_t words = 0;
+    for (auto&& s: sentences) {
+        words += s.size();
+    }
+    std::cerr << "[info] " << sentences.size() << " sentences, " << words << " words" << std::endl;
+
+    BenchLookup(corrector.GetLangModel(), repeats);
+    BenchScore(corrector, sentences, repeats);
+    BenchFix(corrector, text, words, 1);
+    return 0;
+}
@@ -12,6 +12,7 @@
 #include <iostream>
 #include <streambuf>
 #include <tuple>
+#include <type_traits>
 
 namespace NHandyPack {
 
@@ -105,6 +106,48 @@ public:
     }
 };
 
+// Types serialized as their memory image, so that contiguous sequences of
+// them are written and read as a single block
+template<class T>
+struct TIsBulkSerializable: std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value> {};
+
+// vector<bool> is not contiguous
+template<>
+struct TIsBulkSerializable<bool>: std::false_type {};
+
+// pairs are written field by field, the same bytes when there is no padding
+template<class A, class B>
+struct TIsBulkSerializable<std::pair<A, B>>: std::integral_constant<bool,
+    TIsBulkSerializable<A>::value && TIsBulkSerializable<B>::value &&
+    sizeof(std::pair<A, B>) == sizeof(A) + sizeof(B)> {};
+
+template<class TVec, class TObj, bool Bulk = TIsBulkSerializable<TObj>::value>
+class TContiguousSerializer: public TVectorSerializer<TVec, TObj> {};
+
+// Same format as TVectorSerializer, with one write and one read of the
+// whole contents
+template<class TVec, class TObj>
+class TContiguousSerializer<TVec, TObj, true> {
+public:
+    static inline void Dump(std::ostream& out, const TVec& object) {
+        uint32_t size = object.size();
+        out.write((const char*)(&size), sizeof(size));
+        if (size) {
+            out.write((const char*)(&object[0]), std::streamsize(sizeof(TObj)) * size);
+        }
+    }
+
+    static inline void Load(std::istream& in, TVec& object) {
+        uint32_t size = 0;
+        in.read((char*)(&size), sizeof(size));
+        object.clear();
+        object.resize(size);
+        if (size) {
+            in.read((char*)(&object[0]), std::streamsize(sizeof(TObj)) * size);
+        }
+    }
+};
+
 template<class TVec, class TKey, class TValue>
 class TMapSerializer {
 public:
@@ -175,10 +218,10 @@ public:
     }
 };
 
-template <class T> class TSerializer<std::vector<T> >: public TVectorSerializer<std::vector<T>, T > {};
+template <class T> class TSerializer<std::vector<T> >: public TContiguousSerializer<std::vector<T>, T > {};
 template <class T> class TSerializer<std::list<T> >: public TVectorSerializer<std::list<T>, T > {};
-template <> class TSerializer<std::string>: public TVectorSerializer<std::string, char> {};
-template <> class TSerializer<std::wstring>: public TVectorSerializer<std::wstring, wchar_t> {};
+template <> class TSerializer<std::string>: public TContiguousSerializer<std::string, char> {};
+template <> class TSerializer<std::wstring>: public TContiguousSerializer<std::wstring, wchar_t> {};
 template <class K, class V> class TSerializer<std::map<K, V> >: public TMapSerializer<std::map<K, V>, K, V > {};
 template <class K, class V, class H> class TSerializer<std::unordered_map<K, V, H> >: public TUnorderedMapSerializer<std::unordered_map<K, V, H>, K, V > {};
 template <class T> class TSerializer<std::set<T> >: public TSetSerializer<std::set<T>, T > {};
@@ -1,4 +1,6 @@
 #include <cassert>
+#include <cmath>
+#include <cstring>
 
 #include "bloom_filter.hpp"
 
@@ -49,6 +51,42 @@ bool TBloomFilter::Contains(const std::string& element) const {
     return BloomFilter->contains(element);
 }
 
+uint64_t TBloomFilter::Elements() const {
+    return BloomFilter->element_count();
+}
+
+uint64_t TBloomFilter::ByteSize() const {
+    return BloomFilter->size() / bits_per_char;
+}
+
+double TBloomFilter::FillRatio() const {
+    uint64_t bits = BloomFilter->size();
+    if (!bits) {
+        return 0.0;
+    }
+    const unsigned char* table = BloomFilter->table();
+    uint64_t bytes = bits / bits_per_char;
+    uint64_t setBits = 0;
+    uint64_t i = 0;
+    for (; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, table + i, sizeof(word));
+        setBits += __builtin_popcountll(word);
+    }
+    for (; i < bytes; ++i) {
+        setBits += __builtin_popcount(table[i]);
+    }
+    return double(setBits) / double(bits);
+}
+
+double TBloomFilter::FalsePositiveRate() const {
+    return std::pow(FillRatio(), double(BloomFilter->hash_count()));
+}
+
+bool TBloomFilter::AdviseMemory(const TMemoryOptions& options) const {
+    return NJamSpell::AdviseMemory(BloomFilter->table(), ByteSize(), options);
+}
+
 void TBloomFilter::Dump(std::ostream& out) const {
     BloomFilter->Dump(out);
 }
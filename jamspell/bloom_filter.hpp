@@ -2,6 +2,8 @@
 #include <memory>
 #include <string>
 
+#include "utils.hpp"
+
 namespace NJamSpell {
 
 class TBloomFilter {
@@ -11,6 +13,14 @@ public:
     ~TBloomFilter();
     void Insert(const std::string& element);
     bool Contains(const std::string& element) const;
+    uint64_t Elements() const;
+    uint64_t ByteSize() const;
+    // Share of set bits
+    double FillRatio() const;
+    // Expected share of absent elements reported as present
+    double FalsePositiveRate() const;
+    // See NJamSpell::AdviseMemory, for the bit table
+    bool AdviseMemory(const TMemoryOptions& options) const;
     void Dump(std::ostream& out) const;
     void Load(std::istream& in);
 private:
@@ -0,0 +1,153 @@
+#include <cassert>
+#include <cmath>
+
+#include "buckets.hpp"
+
+namespace NJamSpell {
+
+static const uint32_t MAX_REAL_NUM = 268435456;
+
+TPackedCount PackInt32(uint32_t num) {
+    double r = double(num) / double(MAX_REAL_NUM);
+    assert(r >= 0.0 && r <= 1.0);
+    r = pow(r, 0.2);
+    r *= PACKED_COUNT_CODES;
+    return uint16_t(r);
+}
+
+uint32_t UnpackInt32(TPackedCount num) {
+    double r = double(num) / double(PACKED_COUNT_CODES);
+    r = pow(r, 5.0);
+    r *= MAX_REAL_NUM;
+    return uint32_t(ceil(r));
+}
+
+static const TBucketLayoutInfo BUCKET_LAYOUTS[] = {
+    {16, 16, "16+16"},
+    {8, 8, "8+8"},
+    {20, 12, "20+12"},
+    {24, 8, "24+8"},
+};
+
+using TCodec16x16 = TBucketCodec<16, 16>;
+using TCodec8x8 = TBucketCodec<8, 8>;
+using TCodec20x12 = TBucketCodec<20, 12>;
+using TCodec24x8 = TBucketCodec<24, 8>;
+
+const TBucketLayoutInfo& GetBucketLayoutInfo(EBucketLayout layout) {
+    assert(layout < sizeof(BUCKET_LAYOUTS) / sizeof(BUCKET_LAYOUTS[0]));
+    return BUCKET_LAYOUTS[layout];
+}
+
+bool ParseBucketLayout(const std::string& name, EBucketLayout& layout) {
+    for (size_t i = 0; i < sizeof(BUCKET_LAYOUTS) / sizeof(BUCKET_LAYOUTS[0]); ++i) {
+        if (name == BUCKET_LAYOUTS[i].Name) {
+            layout = EBucketLayout(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TBuckets::Init(EBucketLayout layout, size_t size) {
+    const TBucketLayoutInfo& info = GetBucketLayoutInfo(layout);
+    Layout = layout;
+    EntryBits = info.FingerprintBits + info.CountBits;
+    Count = size;
+    Filled = 0;
+    Data.assign((Count * EntryBits + 63) / 64, 0);
+}
+
+void TBuckets::InitLegacy(const std::vector<std::pair<uint16_t, uint16_t>>& buckets) {
+    Init(BL_16_16, buckets.size());
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        if (buckets[i].second) {
+            Set(i, buckets[i].first, buckets[i].second);
+        }
+    }
+}
+
+void TBuckets::Clear() {
+    Layout = BL_16_16;
+    EntryBits = 32;
+    Count = 0;
+    Filled = 0;
+    std::vector<uint64_t>().swap(Data);
+}
+
+size_t TBuckets::Size() const {
+    return Count;
+}
+
+uint64_t TBuckets::FilledSize() const {
+    return Filled;
+}
+
+EBucketLayout TBuckets::GetLayout() const {
+    return EBucketLayout(Layout);
+}
+
+uint64_t TBuckets::ByteSize() const {
+    return Data.size() * sizeof(uint64_t);
+}
+
+bool TBuckets::AdviseMemory(const TMemoryOptions& options) const {
+    return NJamSpell::AdviseMemory(Data.data(), ByteSize(), options);
+}
+
+double TBuckets::FalsePositiveRate() const {
+    if (!Count) {
+        return 0.0;
+    }
+    double fill = double(Filled) / double(Count);
+    return fill * pow(2.0, -double(GetBucketLayoutInfo(GetLayout()).FingerprintBits));
+}
+
+void TBuckets::Set(size_t index, uint32_t fingerprint, TPackedCount code) {
+    assert(index < Count);
+    switch (Layout) {
+    case BL_16_16: TCodec16x16::Set(&Data[0], index, fingerprint, code); break;
+    case BL_8_8: TCodec8x8::Set(&Data[0], index, fingerprint, code); break;
+    case BL_20_12: TCodec20x12::Set(&Data[0], index, fingerprint, code); break;
+    case BL_24_8: TCodec24x8::Set(&Data[0], index, fingerprint, code); break;
+    default: assert(false && "wrong bucket layout");
+    }
+    Filled += 1;
+}
+
+TPackedCount TBuckets::Find(size_t index, uint32_t fingerprint) const {
+    assert(index < Count);
+    switch (Layout) {
+    case BL_16_16: return TCodec16x16::Find(&Data[0], index, fingerprint);
+    case BL_8_8: return TCodec8x8::Find(&Data[0], index, fingerprint);
+    case BL_20_12: return TCodec20x12::Find(&Data[0], index, fingerprint);
+    case BL_24_8: return TCodec24x8::Find(&Data[0], index, fingerprint);
+    }
+    assert(false && "wrong bucket layout");
+    return TPackedCount();
+}
+
+template<typename TCodec>
+void TBuckets::FindBatchImpl(const uint32_t* indexes, const uint32_t* fingerprints,
+                             size_t count, TPackedCount* codes) const
+{
+    const uint64_t* data = &Data[0];
+    for (size_t i = 0; i < count; ++i) {
+        assert(indexes[i] < Count);
+        codes[i] = TCodec::Find(data, indexes[i], fingerprints[i]);
+    }
+}
+
+void TBuckets::FindBatch(const uint32_t* indexes, const uint32_t* fingerprints,
+                         size_t count, TPackedCount* codes) const
+{
+    switch (Layout) {
+    case BL_16_16: FindBatchImpl<TCodec16x16>(indexes, fingerprints, count, codes); return;
+    case BL_8_8: FindBatchImpl<TCodec8x8>(indexes, fingerprints, count, codes); return;
+    case BL_20_12: FindBatchImpl<TCodec20x12>(indexes, fingerprints, count, codes); return;
+    case BL_24_8: FindBatchImpl<TCodec24x8>(indexes, fingerprints, count, codes); return;
+    }
+    assert(false && "wrong bucket layout");
+}
+
+} // NJamSpell
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+
+#include <contrib/handypack/handypack.hpp>
+
+#include "utils.hpp"
+
+namespace NJamSpell {
+
+using TPackedCount = uint16_t;
+
+// Counts are packed into 16 bits by taking their fifth root
+constexpr uint32_t PACKED_COUNT_CODES = 65536;
+// Counts up to this one are packed, larger ones overflow
+constexpr uint32_t MAX_PACKED_COUNT = 268435455;
+TPackedCount PackInt32(uint32_t num);
+uint32_t UnpackInt32(TPackedCount num);
+
+// Bit widths of a perfect hash bucket: fingerprint + quantized count
+enum EBucketLayout: uint8_t {
+    BL_16_16 = 0,   // default, the layout of legacy models
+    BL_8_8 = 1,     // tiny models for embedded deployments
+    BL_20_12 = 2,
+    BL_24_8 = 3,
+};
+
+struct TBucketLayoutInfo {
+    uint32_t FingerprintBits;
+    uint32_t CountBits;
+    const char* Name;
+};
+
+const TBucketLayoutInfo& GetBucketLayoutInfo(EBucketLayout layout);
+bool ParseBucketLayout(const std::string& name, EBucketLayout& layout);
+
+// Entry i occupies bits [i * EntryBits, (i + 1) * EntryBits) of the data,
+// count code in the low bits and fingerprint above it. Counts are stored
+// as the top CountBits of the 16 bit packed count, so shifting them back
+// gives a regular TPackedCount.
+template<uint32_t FingerprintBits, uint32_t CountBits>
+struct TBucketCodec {
+    static constexpr uint32_t EntryBits = FingerprintBits + CountBits;
+    static constexpr uint32_t CountShift = 16 - CountBits;
+    static constexpr uint64_t EntryMask = (uint64_t(1) << EntryBits) - 1;
+    static constexpr uint32_t FingerprintMask = uint32_t((uint64_t(1) << FingerprintBits) - 1);
+    static_assert(EntryBits <= 32 && CountBits <= 16, "wrong bucket layout");
+
+    static inline uint64_t Read(const uint64_t* data, size_t index) {
+        uint64_t bit = uint64_t(index) * EntryBits;
+        uint64_t word = bit >> 6;
+        uint32_t shift = bit & 63;
+        uint64_t value = data[word] >> shift;
+        if (64 % EntryBits != 0 && shift + EntryBits > 64) {
+            value |= data[word + 1] << (64 - shift);
+        }
+        return value & EntryMask;
+    }
+
+    static inline void Write(uint64_t* data, size_t index, uint64_t value) {
+        uint64_t bit = uint64_t(index) * EntryBits;
+        uint64_t word = bit >> 6;
+        uint32_t shift = bit & 63;
+        data[word] = (data[word] & ~(EntryMask << shift)) | (value << shift);
+        if (64 % EntryBits != 0 && shift + EntryBits > 64) {
+            uint32_t written = 64 - shift;
+            data[word + 1] = (data[word + 1] & ~(EntryMask >> written)) | (value >> written);
+        }
+    }
+
+    static inline TPackedCount Find(const uint64_t* data, size_t index, uint32_t fingerprint) {
+        uint64_t value = Read(data, index);
+        if (uint32_t(value >> CountBits) != (fingerprint & FingerprintMask)) {
+            return TPackedCount();
+        }
+        return TPackedCount((value & ((1 << CountBits) - 1)) << CountShift);
+    }
+
+    static inline void Set(uint64_t* data, size_t index, uint32_t fingerprint, TPackedCount code) {
+        uint64_t value = (uint64_t(fingerprint & FingerprintMask) << CountBits) | (code >> CountShift);
+        Write(data, index, value);
+    }
+};
+
+// Perfect hash buckets with a layout chosen at train time
+class TBuckets {
+public:
+    void Init(EBucketLayout layout, size_t size);
+    void InitLegacy(const std::vector<std::pair<uint16_t, uint16_t>>& buckets);
+    void Clear();
+    size_t Size() const;
+    // Buckets holding an n-gram
+    uint64_t FilledSize() const;
+    EBucketLayout GetLayout() const;
+    uint64_t ByteSize() const;
+    // Expected share of lookups of absent keys that hit a false fingerprint match
+    double FalsePositiveRate() const;
+    bool AdviseMemory(const TMemoryOptions& options) const;
+
+    void Set(size_t index, uint32_t fingerprint, TPackedCount code);
+    // Returns the packed count of the bucket if the fingerprint matches, zero otherwise
+    TPackedCount Find(size_t index, uint32_t fingerprint) const;
+    // Same for many buckets, dispatching on the layout once
+    void FindBatch(const uint32_t* indexes, const uint32_t* fingerprints, size_t count, TPackedCount* codes) const;
+
+    inline void Prefetch(size_t index) const {
+        NJamSpell::Prefetch(&Data[(uint64_t(index) * EntryBits) >> 6]);
+    }
+
+    HANDYPACK(Layout, EntryBits, Count, Filled, Data)
+private:
+    template<typename TCodec>
+    void FindBatchImpl(const uint32_t* indexes, const uint32_t* fingerprints, size_t count, TPackedCount* codes) const;
+private:
+    uint8_t Layout = BL_16_16;
+    uint32_t EntryBits = 32;
+    uint64_t Count = 0;
+    uint64_t Filled = 0;
+    std::vector<uint64_t> Data;
+};
+
+} // NJamSpell
@@ -0,0 +1,128 @@
+#include <fstream>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <contrib/handypack/handypack.hpp>
+
+#include "checkpoint.hpp"
+
+namespace NJamSpell {
+
+// magic, version, run key and payload size
+constexpr uint64_t CHECKPOINT_HEADER_SIZE = 8 + 2 + 8 + 8;
+
+static bool SyncFile(const std::string& fileName) {
+#ifndef _WIN32
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+#else
+    (void)fileName;
+    return true;
+#endif
+}
+
+TCheckpoints::TCheckpoints(const std::string& prefix, uint64_t runKey, bool resume)
+    : Prefix(prefix)
+    , RunKey(runKey)
+    , Resume(resume)
+{
+}
+
+bool TCheckpoints::Enabled() const {
+    return !Prefix.empty();
+}
+
+std::string TCheckpoints::GetFileName(const std::string& phase) const {
+    return Prefix + "." + phase;
+}
+
+bool TCheckpoints::Save(const std::string& phase, const std::function<void(std::ostream&)>& dump) const {
+    if (!Enabled()) {
+        return false;
+    }
+    std::string fileName = GetFileName(phase);
+    std::string tmpFileName = fileName + ".tmp";
+    {
+        std::ofstream out(tmpFileName, std::ios::binary);
+        if (!out.is_open()) {
+            std::cerr << "[warning] failed to write checkpoint " << tmpFileName << std::endl;
+            return false;
+        }
+        uint64_t payloadSize = 0;
+        NHandyPack::Dump(out, CHECKPOINT_MAGIC_BYTE, CHECKPOINT_VERSION, RunKey, payloadSize);
+        dump(out);
+        payloadSize = uint64_t(out.tellp()) - CHECKPOINT_HEADER_SIZE;
+        NHandyPack::Dump(out, CHECKPOINT_MAGIC_BYTE);
+        out.seekp(CHECKPOINT_HEADER_SIZE - sizeof(payloadSize));
+        NHandyPack::Dump(out, payloadSize);
+        out.close();
+        if (out.fail()) {
+            std::cerr << "[warning] failed to write checkpoint " << tmpFileName << std::endl;
+            std::remove(tmpFileName.c_str());
+            return false;
+        }
+    }
+    if (!SyncFile(tmpFileName) || std::rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+        std::cerr << "[warning] failed to save checkpoint " << fileName << std::endl;
+        std::remove(tmpFileName.c_str());
+        return false;
+    }
+    std::cerr << "[info] saved checkpoint " << fileName << std::endl;
+    return true;
+}
+
+bool TCheckpoints::Load(const std::string& phase, const std::function<void(std::istream&)>& load) const {
+    if (!Enabled() || !Resume) {
+        return false;
+    }
+    std::string fileName = GetFileName(phase);
+    std::ifstream in(fileName, std::ios::binary | std::ios::ate);
+    if (!in.is_open()) {
+        return false;
+    }
+    uint64_t fileSize = in.tellg();
+    in.seekg(0);
+    uint64_t magicByte = 0;
+    uint16_t version = 0;
+    uint64_t runKey = 0;
+    uint64_t payloadSize = 0;
+    NHandyPack::Load(in, magicByte, version, runKey, payloadSize);
+    if (!in.good() || magicByte != CHECKPOINT_MAGIC_BYTE || version != CHECKPOINT_VERSION) {
+        std::cerr << "[warning] broken checkpoint " << fileName << ", ignored" << std::endl;
+        return false;
+    }
+    if (runKey != RunKey) {
+        std::cerr << "[info] checkpoint " << fileName << " is of another training run, ignored" << std::endl;
+        return false;
+    }
+    if (fileSize != CHECKPOINT_HEADER_SIZE + payloadSize + sizeof(magicByte)) {
+        std::cerr << "[warning] incomplete checkpoint " << fileName << ", ignored" << std::endl;
+        return false;
+    }
+    load(in);
+    magicByte = 0;
+    NHandyPack::Load(in, magicByte);
+    if (!in.good() || magicByte != CHECKPOINT_MAGIC_BYTE) {
+        std::cerr << "[warning] broken checkpoint " << fileName << ", ignored" << std::endl;
+        return false;
+    }
+    std::cerr << "[info] resumed from checkpoint " << fileName << std::endl;
+    return true;
+}
+
+void TCheckpoints::Remove(const std::string& phase) const {
+    if (Enabled()) {
+        std::remove(GetFileName(phase).c_str());
+    }
+}
+
+} // NJamSpell
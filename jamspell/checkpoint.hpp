@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <iostream>
+#include <cstdint>
+
+namespace NJamSpell {
+
+constexpr uint64_t CHECKPOINT_MAGIC_BYTE = 6003119384917364567ULL;
+constexpr uint16_t CHECKPOINT_VERSION = 1;
+
+// Training state saved after the expensive phases, so that a killed
+// training resumes from the last completed one. Every phase is a file
+// "<prefix>.<phase>", written under a temporary name, synced to disk and
+// renamed once complete. Files carry the key of the training run they
+// belong to, and those of other runs are ignored.
+class TCheckpoints {
+public:
+    TCheckpoints() = default;
+    TCheckpoints(const std::string& prefix, uint64_t runKey, bool resume);
+
+    bool Enabled() const;
+    bool Save(const std::string& phase, const std::function<void(std::ostream&)>& dump) const;
+    // Loads the phase when resuming and a complete checkpoint of this run exists
+    bool Load(const std::string& phase, const std::function<void(std::istream&)>& load) const;
+    void Remove(const std::string& phase) const;
+private:
+    std::string GetFileName(const std::string& phase) const;
+private:
+    std::string Prefix;
+    uint64_t RunKey = 0;
+    bool Resume = false;
+};
+
+} // NJamSpell
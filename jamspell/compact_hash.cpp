@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cassert>
+
+#include "compact_hash.hpp"
+#include "utils.hpp"
+
+namespace NJamSpell {
+
+static const double LEVEL_SIZE_FACTOR = 2.0; // bits per remaining key on every level
+static const size_t MAX_LEVELS = 24;
+static const uint64_t RANK_BLOCK_BITS = 512;
+static const uint64_t LEVEL_SALT = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t Mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint32_t PopCount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    uint32_t count = 0;
+    for (; x; x &= x - 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+static inline bool TestBit(const std::vector<uint64_t>& bits, uint64_t position) {
+    return (bits[position >> 6] >> (position & 63)) & 1;
+}
+
+static inline void SetBit(std::vector<uint64_t>& bits, uint64_t position) {
+    bits[position >> 6] |= uint64_t(1) << (position & 63);
+}
+
+static inline void ResetBit(std::vector<uint64_t>& bits, uint64_t position) {
+    bits[position >> 6] &= ~(uint64_t(1) << (position & 63));
+}
+
+uint64_t TCompactHash::LevelPosition(uint64_t hash, size_t level) const {
+    uint64_t size = LevelOffsets[level + 1] - LevelOffsets[level];
+    return LevelOffsets[level] + Mix64(hash ^ (LEVEL_SALT * (level + 1))) % size;
+}
+
+void TCompactHash::Build(std::vector<uint64_t>& hashes) {
+    Clear();
+    LevelOffsets.push_back(0);
+    for (size_t level = 0; level < MAX_LEVELS && !hashes.empty(); ++level) {
+        uint64_t size = uint64_t(hashes.size() * LEVEL_SIZE_FACTOR);
+        size = std::max<uint64_t>(64, (size + 63) / 64 * 64);
+        uint64_t from = LevelOffsets.back();
+        LevelOffsets.push_back(from + size);
+
+        std::vector<uint64_t> placed(size / 64, 0);
+        std::vector<uint64_t> collided(size / 64, 0);
+        for (uint64_t h: hashes) {
+            uint64_t position = LevelPosition(h, level) - from;
+            if (TestBit(collided, position)) {
+                continue;
+            }
+            if (TestBit(placed, position)) {
+                ResetBit(placed, position);
+                SetBit(collided, position);
+            } else {
+                SetBit(placed, position);
+            }
+        }
+
+        size_t left = 0;
+        for (uint64_t h: hashes) {
+            if (!TestBit(placed, LevelPosition(h, level) - from)) {
+                hashes[left++] = h;
+            }
+        }
+        hashes.resize(left);
+        Bits.insert(Bits.end(), placed.begin(), placed.end());
+    }
+
+    Ranks.reserve(Bits.size() * 64 / RANK_BLOCK_BITS + 1);
+    uint32_t rank = 0;
+    for (size_t i = 0; i < Bits.size(); ++i) {
+        if (i % (RANK_BLOCK_BITS / 64) == 0) {
+            Ranks.push_back(rank);
+        }
+        rank += PopCount64(Bits[i]);
+    }
+
+    Keys = rank;
+    for (uint64_t h: hashes) {
+        if (Fallback.insert(std::make_pair(h, Keys)).second) {
+            ++Keys;
+        }
+    }
+    std::vector<uint64_t>().swap(hashes);
+}
+
+void TCompactHash::Clear() {
+    Keys = 0;
+    LevelOffsets.clear();
+    Bits.clear();
+    Ranks.clear();
+    Fallback.clear();
+}
+
+uint32_t TCompactHash::Rank(uint64_t position) const {
+    uint64_t word = position >> 6;
+    uint64_t block = position / RANK_BLOCK_BITS;
+    uint32_t rank = Ranks[block];
+    for (uint64_t i = block * (RANK_BLOCK_BITS / 64); i < word; ++i) {
+        rank += PopCount64(Bits[i]);
+    }
+    return rank + PopCount64(Bits[word] & ((uint64_t(1) << (position & 63)) - 1));
+}
+
+uint32_t TCompactHash::Find(uint64_t hash) const {
+    for (size_t level = 0; level + 1 < LevelOffsets.size(); ++level) {
+        uint64_t position = LevelPosition(hash, level);
+        if (TestBit(Bits, position)) {
+            return Rank(position);
+        }
+    }
+    auto it = Fallback.find(hash);
+    if (it != Fallback.end()) {
+        return it->second;
+    }
+    return 0;
+}
+
+void TCompactHash::Prefetch(uint64_t hash) const {
+    if (LevelOffsets.size() > 1) {
+        NJamSpell::Prefetch(&Bits[LevelPosition(hash, 0) >> 6]);
+    }
+}
+
+uint32_t TCompactHash::Size() const {
+    return Keys;
+}
+
+uint64_t TCompactHash::ByteSize() const {
+    return Bits.size() * sizeof(uint64_t) + Ranks.size() * sizeof(uint32_t) +
+           LevelOffsets.size() * sizeof(uint64_t) + Fallback.size() * (sizeof(uint64_t) + sizeof(uint32_t));
+}
+
+} // NJamSpell
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include <contrib/handypack/handypack.hpp>
+
+namespace NJamSpell {
+
+// Minimal perfect hash over 64-bit key hashes in the BBHash style: every
+// level is a bit array where keys that land on a position alone set its
+// bit, colliding keys are passed to the next level. A key's value is the
+// rank of its bit across all levels. Keys left after the last level are
+// stored explicitly.
+class TCompactHash {
+public:
+    // Consumes the hashes, which have to be distinct
+    void Build(std::vector<uint64_t>& hashes);
+    void Clear();
+    // Returns a value in [0, Size()) for known hashes, any value in that range otherwise
+    uint32_t Find(uint64_t hash) const;
+    void Prefetch(uint64_t hash) const;
+    uint32_t Size() const;
+    uint64_t ByteSize() const;
+
+    HANDYPACK(Keys, LevelOffsets, Bits, Ranks, Fallback)
+private:
+    uint64_t LevelPosition(uint64_t hash, size_t level) const;
+    uint32_t Rank(uint64_t position) const;
+private:
+    uint32_t Keys = 0;
+    std::vector<uint64_t> LevelOffsets; // first bit of each level, then the total number of bits
+    std::vector<uint64_t> Bits;
+    std::vector<uint32_t> Ranks; // set bits before each 512 bit block
+    std::unordered_map<uint64_t, uint32_t> Fallback;
+};
+
+} // NJamSpell
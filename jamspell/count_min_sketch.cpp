@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <cassert>
+
+#include "count_min_sketch.hpp"
+
+#include <contrib/cityhash/city.h>
+
+namespace NJamSpell {
+
+constexpr uint32_t MAX_DEPTH = 8;
+
+constexpr uint32_t TCountMinSketch::MAX_COUNT;
+
+TCountMinSketch::TCountMinSketch(uint64_t bytes, uint32_t depth)
+    : Depth(depth)
+    , Width(std::max<uint64_t>(bytes / depth, 1))
+    , Counters(Width * depth, 0)
+{
+    assert(depth > 0 && depth <= MAX_DEPTH);
+}
+
+void TCountMinSketch::GetCells(const char* key, size_t size, uint64_t* cells) const {
+    // rows are indexed by h1 + i * h2 of a single 64 bit hash
+    uint64_t hash = CityHash64(key, size);
+    uint64_t h1 = hash & 0xFFFFFFFF;
+    uint64_t h2 = (hash >> 32) | 1;
+    for (uint32_t i = 0; i < Depth; ++i) {
+        cells[i] = i * Width + (h1 + i * h2) % Width;
+    }
+}
+
+void TCountMinSketch::Add(const char* key, size_t size) {
+    uint64_t cells[MAX_DEPTH];
+    GetCells(key, size, cells);
+    uint8_t minCount = Counters[cells[0]];
+    for (uint32_t i = 1; i < Depth; ++i) {
+        minCount = std::min(minCount, Counters[cells[i]]);
+    }
+    if (minCount == MAX_COUNT) {
+        return;
+    }
+    // conservative update: only the counters holding the estimate grow
+    for (uint32_t i = 0; i < Depth; ++i) {
+        if (Counters[cells[i]] == minCount) {
+            Counters[cells[i]] += 1;
+        }
+    }
+}
+
+uint32_t TCountMinSketch::Estimate(const char* key, size_t size) const {
+    uint64_t cells[MAX_DEPTH];
+    GetCells(key, size, cells);
+    uint8_t minCount = Counters[cells[0]];
+    for (uint32_t i = 1; i < Depth; ++i) {
+        minCount = std::min(minCount, Counters[cells[i]]);
+    }
+    return minCount;
+}
+
+uint64_t TCountMinSketch::ByteSize() const {
+    return Counters.size();
+}
+
+} // NJamSpell
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace NJamSpell {
+
+// Approximate counts of many keys in a fixed amount of memory. Counters are
+// updated conservatively and saturate at MAX_COUNT, so an estimate is never
+// below min(true count, MAX_COUNT).
+class TCountMinSketch {
+public:
+    static constexpr uint32_t MAX_COUNT = 255;
+
+    TCountMinSketch(uint64_t bytes, uint32_t depth = 4);
+    void Add(const char* key, size_t size);
+    uint32_t Estimate(const char* key, size_t size) const;
+    uint64_t ByteSize() const;
+private:
+    void GetCells(const char* key, size_t size, uint64_t* cells) const;
+private:
+    uint32_t Depth;
+    uint64_t Width;
+    std::vector<uint8_t> Counters; // Depth rows of Width counters
+};
+
+} // NJamSpell
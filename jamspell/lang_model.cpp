@@ -6,7 +6,11 @@
 #include <ostream>
 #include <cstring>
 #include <algorithm>
+#include <memory>
 #include "lang_model.hpp"
+#include "ngram_counts.hpp"
+#include "checkpoint.hpp"
+#include "user_dictionary.hpp"
 
 #include <contrib/cityhash/city.h>
 
@@ -16,97 +20,165 @@
 
 namespace NJamSpell {
 
-class MemStream: public std::basic_streambuf<char> {
-public:
-    MemStream(char* buff, long maxSize)
-        : Buff(buff)
-        , MaxSize(maxSize)
-        , Pos(0)
-    {
+template<typename T>
+int RemoveLowFreqNgramKeys(T& grams, const int& minWordFreq) {
+    int numRemoved = 0;
+    for( auto it = grams.begin(); it != grams.end(); ) {
+        if (it->second < minWordFreq ) {
+	    it = grams.erase(it);
+	    numRemoved++;
+	} else {
+	    ++it;
+	}
     }
+    return numRemoved;
+}
 
-	std::streamsize xsputn(const char* s, std::streamsize n) override {
-        if (n <= 0) {
-            return n;
+template<size_t N>
+void TableToCounts(const TGramTable& table, const std::vector<TWordId>& newIds, TGramCounts<N>& grams) {
+    grams.reserve(table.Counts.size());
+    TGramWords<N> key;
+    for (size_t i = 0; i < table.Counts.size(); ++i) {
+        for (size_t j = 0; j < N; ++j) {
+            key[j] = newIds[table.Words[i * N + j]];
         }
-        long toCopy = std::min<long>(n, MaxSize - Pos);
-        memcpy(Buff + Pos, s, toCopy);
-        Pos += toCopy;
-        return n;
-    }
-    void Reset() {
-        Pos = 0;
+        grams[key] = table.Counts[i];
     }
-    long Size() const {
-        return Pos;
+}
+
+template<size_t N>
+void AppendNgrams(TGramCounts<N>& grams, TGramCountList& list) {
+    for (auto&& it: grams) {
+        list.push_back(std::make_pair(TGramKey(&it.first[0], N), it.second));
     }
-private:
-    char* Buff;
-    long MaxSize;
-    long Pos;
-};
+    TGramCounts<N>().swap(grams);
+}
 
 template<typename T>
-std::string DumpKey(const T& key) {
-    std::stringbuf buf;
-    std::ostream out(&buf);
-    NHandyPack::Dump(out, key);
-    return buf.str();
+uint64_t SerializedSize(const T& object) {
+    TByteCounter counter;
+    std::ostream out(&counter);
+    NHandyPack::Dump(out, object);
+    return counter.Size;
 }
 
-template<typename T>
-void PrepareNgramKeys(const T& grams, std::vector<std::string>& keys) {
+// Sections of model files, see TModelWriter
+constexpr TWordId TLangModel::UnknownWordId;
+
+constexpr const char* MODEL_SECTION_HEADER = "header";
+constexpr const char* MODEL_SECTION_VOCAB = "vocab"; // hash map of earlier files, read only
+constexpr const char* MODEL_SECTION_VOCAB_INDEX = "vocab_index";
+constexpr const char* MODEL_SECTION_VOCAB_PACKED = "vocab_packed"; // front-coded, compressed files
+constexpr const char* MODEL_SECTION_UNIGRAMS = "unigrams";
+constexpr const char* MODEL_SECTION_BIGRAM_BLOCK = "bigram_block";
+constexpr const char* MODEL_SECTION_NGRAMS = "ngrams";
+constexpr const char* MODEL_SECTION_NGRAMS_PACKED = "ngrams_packed"; // TNgramStore::DumpPacked, compressed files
+constexpr const char* MODEL_SECTION_TOKENIZER = "tokenizer";
+constexpr const char* MODEL_SECTION_NGRAM_ORDERS = "ngram_orders"; // optional
+constexpr const char* MODEL_SECTION_TRAIN_OPTIONS = "train_options"; // optional, thresholds of training
+
+// Checkpoints of training phases, in the order they are saved
+constexpr const char* CHECKPOINT_COUNTS = "counts";
+constexpr const char* CHECKPOINT_STORE = "store";
+
+static std::vector<uint64_t> CountByOrder(const TGramCountList& grams, size_t order) {
+    std::vector<uint64_t> counts(order + 1, 0);
     for (auto&& it: grams) {
-        keys.push_back(DumpKey(it.first));
+        counts[it.first.Size] += 1;
     }
+    return counts;
 }
 
-template<typename T>
-int RemoveLowFreqNgramKeys(T& grams, const int& minWordFreq) {
-    int numRemoved = 0;
-    for( auto it = grams.begin(); it != grams.end(); ) {
-        if (it->second < minWordFreq ) {
-	    it = grams.erase(it);
-	    numRemoved++;
-	} else {
-	    ++it;
-	}
-    }
-    return numRemoved;
+static void RemoveCheckpoints(const TCheckpoints& checkpoints) {
+    checkpoints.Remove(CHECKPOINT_STORE);
+    checkpoints.Remove(PERFECT_HASH_CHECKPOINT);
+    checkpoints.Remove(CHECKPOINT_COUNTS);
 }
 
-static const uint32_t MAX_REAL_NUM = 268435456;
-static const uint32_t MAX_AVAILABLE_NUM = 65536;
+// Options that change the trained model, every one but the thread count
+static void DumpRunOptions(std::ostream& out, const TTrainOptions& options) {
+    NHandyPack::Dump(out, options.MinWordFreq, options.Order, options.BigramBlockWords,
+                     options.BigramBlockMaxBytes, options.CountSketchBytes, uint32_t(options.NgramStore),
+                     options.MaxModelBytes, options.HeldOutPercent, uint32_t(options.BucketLayout),
+                     uint32_t(options.PerfectHash.Backend), options.PerfectHash.PartitionKeys);
+}
 
-uint16_t PackInt32(uint32_t num) {
-    double r = double(num) / double(MAX_REAL_NUM);
-    assert(r >= 0.0 && r <= 1.0);
-    r = pow(r, 0.2);
-    r *= MAX_AVAILABLE_NUM;
-    return uint16_t(r);
+static uint64_t RunKey(const std::string& run) {
+    return CityHash64(run.data(), run.size());
 }
 
-uint32_t UnpackInt32(uint16_t num) {
-    double r = double(num) / double(MAX_AVAILABLE_NUM);
-    r = pow(r, 5.0);
-    r *= MAX_REAL_NUM;
-    return uint32_t(ceil(r));
+// Content hash of a file, so that resuming notices inputs edited in place
+// even if their size did not change
+static uint64_t HashFile(const std::string& fileName) {
+    std::ifstream in(fileName, std::ios::binary);
+    std::vector<char> buf(1 << 20);
+    uint64_t hash = 0;
+    while (in) {
+        in.read(&buf[0], buf.size());
+        if (in.gcount() <= 0) {
+            break;
+        }
+        hash = CityHash64WithSeed(&buf[0], in.gcount(), hash);
+    }
+    return hash;
 }
 
-template<typename T>
-void InitializeBuckets(const T& grams, TPerfectHash& ph, std::vector<std::pair<uint16_t, uint16_t>>& buckets) {
+template<class T>
+static uint64_t HashVector(const std::vector<T>& data) {
+    return CityHash64((const char*)data.data(), data.size() * sizeof(T));
+}
+
+static void DumpGramList(std::ostream& out, const TGramCountList& grams) {
+    NHandyPack::Dump(out, uint64_t(grams.size()));
     for (auto&& it: grams) {
-        std::string key = DumpKey(it.first);
-        uint32_t bucket = ph.Hash(key);
-        if (bucket >= buckets.size()) {
-            std::cerr << bucket << " " << buckets.size() << "\n";
+        NHandyPack::Dump(out, it.first.Size);
+        out.write((const char*)it.first.Words, it.first.Size * sizeof(TWordId));
+        NHandyPack::Dump(out, it.second);
+    }
+}
+
+static void LoadGramList(std::istream& in, TGramCountList& grams) {
+    uint64_t size = 0;
+    NHandyPack::Load(in, size);
+    grams.clear();
+    grams.reserve(size);
+    for (uint64_t i = 0; i < size && in.good(); ++i) {
+        TWordId words[MAX_GRAM_ORDER];
+        uint32_t wordsNum = 0;
+        TCount count = 0;
+        NHandyPack::Load(in, wordsNum);
+        if (wordsNum > MAX_GRAM_ORDER) {
+            in.setstate(std::ios::failbit);
+            break;
         }
-        assert(bucket < buckets.size());
-        std::pair<uint16_t, uint16_t> data;
-        data.first = CityHash16(key);
-        data.second = PackInt32(it.second);
-        buckets[bucket] = data;
+        in.read((char*)words, wordsNum * sizeof(TWordId));
+        NHandyPack::Load(in, count);
+        grams.push_back(std::make_pair(TGramKey(words, wordsNum), count));
+    }
+}
+
+static void LogPhase(const std::string& phase, uint64_t startTime) {
+    uint64_t rss = 0;
+    uint64_t peak = 0;
+    GetProcessMemory(rss, peak);
+    std::cerr << "[info] phase " << phase << ": " << GetCurrentTimeMs() - startTime << " ms"
+              << ", rss " << (rss >> 20) << " MB, peak " << (peak >> 20) << " MB" << std::endl;
+}
+
+static std::vector<uint32_t> PrepareUnpackTable() {
+    std::vector<uint32_t> table(PACKED_COUNT_CODES);
+    for (uint32_t i = 0; i < PACKED_COUNT_CODES; ++i) {
+        table[i] = UnpackInt32(TPackedCount(i));
     }
+    return table;
+}
+
+// Buckets hold only PACKED_COUNT_CODES distinct count codes, so all of
+// them are unpacked once instead of calling pow() on every lookup
+static const std::vector<uint32_t> UNPACK_TABLE = PrepareUnpackTable();
+
+static inline TCount Unpack(TPackedCount code) {
+    return UNPACK_TABLE[code];
 }
 
 void TLangModel::RemoveLowFreqWord(const std::unordered_map<TGram1Key, TCount>& grams1, const int& minWordFreq) {
@@ -134,6 +206,7 @@ void TLangModel::RemoveLowFreqWord(const std::unordered_map<TGram1Key, TCount>&
 }
 
 bool TLangModel::FinetuneVocab(const std::string vocabFileName, const std::string& alphabetFile) {
+    ThawVocab();
     std::cerr << "[info] loading text" << std::endl;
     if (!Tokenizer.LoadAlphabet(alphabetFile)) {
         std::cerr << "[error] failed to load alphabet" << std::endl;
@@ -174,15 +247,376 @@ bool TLangModel::FinetuneVocab(const std::string vocabFileName, const std::strin
 	WordToId.erase(w);
     }
     VocabSize = WordToId.size();
+    UpdateLogTables();
 
     std::cerr << "[info] model vocab size after finetune  = " << VocabSize << std::endl;
     return true;
 }
 
+bool TLangModel::AddDelta(const TNgramCounts& counts) {
+    if (counts.Tables.size() + 1 != counts.Order || counts.Words.size() != counts.WordCounts.size()) {
+        std::cerr << "[error] broken n-gram counts" << std::endl;
+        return false;
+    }
+    ThawVocab();
+    std::vector<TWordId> ids(counts.Words.size(), UnknownWordId);
+    TWordId newWords = 0;
+    for (size_t i = 0; i < counts.Words.size(); ++i) {
+        const std::wstring& word = counts.Words[i];
+        if (word.empty()) {
+            continue;
+        }
+        auto it = WordToId.find(word);
+        if (it != WordToId.end()) {
+            ids[i] = it->second;
+        } else {
+            // counts of a word below the threshold are kept aside, training
+            // on all the counts would drop it as well
+            TCount& pending = PendingDeltaWords[word];
+            pending = TCount(std::min<uint64_t>(uint64_t(pending) + counts.WordCounts[i], std::numeric_limits<TCount>::max()));
+            if (pending < TCount(std::max(MinWordFreq, 0))) {
+                continue;
+            }
+            TCount earlier = pending - counts.WordCounts[i];
+            PendingDeltaWords.erase(word);
+            ids[i] = LastWordID++;
+            if (earlier > 0) {
+                Delta.Add(&ids[i], 1, earlier);
+            }
+            WordToId[word] = ids[i];
+            IdToWord.resize(std::max<size_t>(IdToWord.size(), LastWordID));
+            IdToWord[ids[i]] = word;
+            newWords += 1;
+        }
+        Delta.Add(&ids[i], 1, counts.WordCounts[i]);
+    }
+
+    size_t order = std::min<size_t>(counts.Order, Order);
+    TWordId words[MAX_GRAM_ORDER];
+    for (size_t n = 2; n <= order; ++n) {
+        const TGramTable& table = counts.Tables[n - 2];
+        for (size_t i = 0; i < table.Counts.size(); ++i) {
+            bool known = true;
+            for (size_t j = 0; j < n; ++j) {
+                words[j] = ids[table.Words[i * n + j]];
+                known &= words[j] != UnknownWordId;
+            }
+            if (known) {
+                Delta.Add(words, n, table.Counts[i]);
+            }
+        }
+    }
+    TotalWords += counts.TotalWords;
+    VocabSize += newWords;
+    UpdateLogTables();
+
+    std::cerr << "[info] delta: " << newWords << " new words, "
+              << Delta.Size() << " n-grams in total" << std::endl;
+    return true;
+}
+
+size_t TLangModel::GetDeltaSize() const {
+    return Delta.Size();
+}
+
+void TLangModel::Swap(TLangModel& other) {
+    std::swap(Order, other.Order);
+    std::swap(K, other.K);
+    WordToId.swap(other.WordToId);
+    IdToWord.swap(other.IdToWord);
+    std::swap(Vocab, other.Vocab);
+    std::swap(LastWordID, other.LastWordID);
+    std::swap(TotalWords, other.TotalWords);
+    std::swap(VocabSize, other.VocabSize);
+    std::swap(Tokenizer, other.Tokenizer);
+    Grams1.swap(other.Grams1);
+    std::swap(Gram2BlockWords, other.Gram2BlockWords);
+    Gram2Block.swap(other.Gram2Block);
+    std::swap(Ngrams, other.Ngrams);
+    std::swap(Delta, other.Delta);
+    PendingDeltaWords.swap(other.PendingDeltaWords);
+    std::swap(MinWordFreq, other.MinWordFreq);
+    std::swap(MaxModelBytes, other.MaxModelBytes);
+    StoreNgramsByOrder.swap(other.StoreNgramsByOrder);
+    std::swap(CheckSum, other.CheckSum);
+    std::swap(ScoringMode, other.ScoringMode);
+    LogGram1Table.swap(other.LogGram1Table);
+    LogNumeratorTable.swap(other.LogNumeratorTable);
+    LogDenominatorTable.swap(other.LogDenominatorTable);
+}
+
+// Sorts n-grams of the given size by words into a count table, with words
+// numbered by newIds; n-grams with a removed word are dropped
+static void FillTable(const TGramCountList& grams, size_t size, const std::vector<TWordId>& newIds,
+                      TWordId removedId, TGramTable& table)
+{
+    TGramCountList rows;
+    for (auto&& it: grams) {
+        if (it.first.Size != size) {
+            continue;
+        }
+        TGramKey key = it.first;
+        bool removed = false;
+        for (size_t i = 0; i < size; ++i) {
+            key.Words[i] = key.Words[i] < newIds.size() ? newIds[key.Words[i]] : removedId;
+            removed |= key.Words[i] == removedId;
+        }
+        if (!removed) {
+            rows.push_back(std::make_pair(key, it.second));
+        }
+    }
+    std::sort(rows.begin(), rows.end(), [](const std::pair<TGramKey, TCount>& a,
+                                           const std::pair<TGramKey, TCount>& b) {
+        return a.first < b.first;
+    });
+    table.Words.reserve(rows.size() * size);
+    table.Counts.reserve(rows.size());
+    for (auto&& it: rows) {
+        table.Words.insert(table.Words.end(), it.first.Words, it.first.Words + size);
+        table.Counts.push_back(it.second);
+    }
+}
+
+bool TLangModel::Compact(const TTrainOptions& options, const TNgramCounts* counts) {
+    if (!Delta.Empty()) {
+        std::cerr << "[error] model has delta counts, rebuild it with them first" << std::endl;
+        return false;
+    }
+    if (!counts && (Ngrams.Empty() || Ngrams->GetType() != NS_TRIE)) {
+        std::cerr << "[error] perfect hash models are compacted with the n-gram counts they were built from" << std::endl;
+        return false;
+    }
+
+    ThawVocab();
+    // words left in the vocabulary, numbered like in count files
+    TNgramCounts reduced;
+    reduced.Tokenizer = Tokenizer;
+    for (auto&& it: WordToId) {
+        reduced.Words.push_back(it.first);
+    }
+    std::sort(reduced.Words.begin(), reduced.Words.end());
+    reduced.WordCounts.assign(reduced.Words.size(), TCount());
+    auto wordIndex = [this, &reduced](const std::wstring& word) -> TWordId {
+        auto it = std::lower_bound(reduced.Words.begin(), reduced.Words.end(), word);
+        if (it == reduced.Words.end() || *it != word) {
+            return UnknownWordId;
+        }
+        return TWordId(it - reduced.Words.begin());
+    };
+
+    std::vector<TWordId> newIds;
+    TGramCountList grams;
+    if (counts) {
+        reduced.Order = counts->Order;
+        reduced.TotalWords = counts->TotalWords;
+        newIds.resize(counts->Words.size());
+        for (size_t i = 0; i < counts->Words.size(); ++i) {
+            newIds[i] = wordIndex(counts->Words[i]);
+            if (newIds[i] != UnknownWordId) {
+                reduced.WordCounts[newIds[i]] = counts->WordCounts[i];
+            }
+        }
+        for (size_t n = MIN_GRAM_ORDER; n <= counts->Order; ++n) {
+            const TGramTable& table = counts->Tables[n - MIN_GRAM_ORDER];
+            for (size_t i = 0; i < table.Counts.size(); ++i) {
+                grams.push_back(std::make_pair(TGramKey(&table.Words[i * n], n), table.Counts[i]));
+            }
+        }
+    } else {
+        reduced.Order = Order;
+        reduced.TotalWords = TotalWords;
+        newIds.resize(LastWordID, UnknownWordId);
+        for (auto&& it: WordToId) {
+            if (it.second < LastWordID) {
+                newIds[it.second] = wordIndex(it.first);
+                reduced.WordCounts[newIds[it.second]] = Unpack(GetGram1HashCode(it.second));
+            }
+        }
+        for (TWordId w1 = 0; w1 < Gram2BlockWords; ++w1) {
+            for (TWordId w2 = 0; w2 < Gram2BlockWords; ++w2) {
+                TPackedCount code = Gram2Block[uint64_t(w1) * Gram2BlockWords + w2];
+                if (code) {
+                    grams.push_back(std::make_pair(TGramKey(w1, w2), Unpack(code)));
+                }
+            }
+        }
+        static_cast<const TTrieStore&>(*Ngrams).GetNgrams(grams);
+    }
+    reduced.Tables.resize(reduced.Order - 1);
+    for (size_t n = MIN_GRAM_ORDER; n <= reduced.Order; ++n) {
+        FillTable(grams, n, newIds, UnknownWordId, reduced.Tables[n - MIN_GRAM_ORDER]);
+    }
+    TGramCountList().swap(grams);
+
+    std::cerr << "[info] compacting vocabulary from " << LastWordID << " to " << reduced.Words.size() << " words" << std::endl;
+    TLangModel model;
+    if (!model.Train(reduced, options)) {
+        return false;
+    }
+    model.SetScoringMode(ScoringMode);
+    Swap(model);
+    return true;
+}
+
+void TLangModel::GetStoreOptions(TTrainOptions& options) const {
+    options.Order = Order;
+    options.BigramBlockWords = Gram2BlockWords;
+    options.MinWordFreq = MinWordFreq;
+    options.MaxModelBytes = MaxModelBytes;
+    if (Ngrams.Empty()) {
+        return;
+    }
+    options.NgramStore = Ngrams->GetType();
+    if (options.NgramStore == NS_PERFECT_HASH) {
+        const TPerfectHashStore& store = static_cast<const TPerfectHashStore&>(*Ngrams);
+        options.BucketLayout = store.GetBucketLayout();
+        options.PerfectHash.Backend = store.GetBackend();
+    }
+}
+
+void TLangModel::InitializeGram2Block(TGramCounts<2>& grams2,
+                                      const TTrainOptions& options)
+{
+    uint64_t maxWords = uint64_t(sqrt(double(options.BigramBlockMaxBytes / sizeof(TPackedCount))));
+    Gram2BlockWords = std::min<uint64_t>({options.BigramBlockWords, maxWords, LastWordID});
+    Gram2Block.assign(uint64_t(Gram2BlockWords) * Gram2BlockWords, TPackedCount());
+    if (Gram2BlockWords == 0) {
+        return;
+    }
+
+    uint64_t totalCount = 0;
+    uint64_t blockCount = 0;
+    size_t blockKeys = 0;
+    for (auto it = grams2.begin(); it != grams2.end(); ) {
+        totalCount += it->second;
+        if (it->first[0] < Gram2BlockWords && it->first[1] < Gram2BlockWords) {
+            Gram2Block[uint64_t(it->first[0]) * Gram2BlockWords + it->first[1]] = PackInt32(it->second);
+            blockCount += it->second;
+            blockKeys += 1;
+            it = grams2.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    std::cerr << "[info] bigram block: " << Gram2BlockWords << " words, "
+              << Gram2Block.size() * sizeof(TPackedCount) << " bytes, "
+              << blockKeys << " bigrams, fill " << 100.0 * double(blockKeys) / double(Gram2Block.size()) << "%" << std::endl;
+    std::cerr << "[info] bigram block hit ratio on training corpus: "
+              << (totalCount ? 100.0 * double(blockCount) / double(totalCount) : 0.0) << "%" << std::endl;
+}
+
+void TLangModel::RenumberByFrequency(std::unordered_map<TGram1Key, TCount>& grams1, TIdSentences& sentences) {
+    std::vector<TCount> counts(LastWordID, TCount());
+    for (auto&& it: grams1) {
+        counts[it.first] = it.second;
+    }
+    std::vector<TWordId> order(LastWordID);
+    for (TWordId wid = 0; wid < LastWordID; ++wid) {
+        order[wid] = wid;
+    }
+    std::stable_sort(order.begin(), order.end(), [&counts](TWordId a, TWordId b) {
+        return counts[a] > counts[b];
+    });
+
+    TWordIds newIds(LastWordID);
+    for (TWordId wid = 0; wid < LastWordID; ++wid) {
+        newIds[order[wid]] = wid;
+    }
+
+    for (auto it = WordToId.begin(); it != WordToId.end(); ++it) {
+        it.value() = newIds[it->second];
+    }
+    std::vector<std::wstring> idToWord(LastWordID);
+    for (TWordId wid = 0; wid < LastWordID && wid < IdToWord.size(); ++wid) {
+        idToWord[newIds[wid]].swap(IdToWord[wid]);
+    }
+    IdToWord.swap(idToWord);
+
+    std::unordered_map<TGram1Key, TCount> newGrams1;
+    newGrams1.reserve(grams1.size());
+    for (auto&& it: grams1) {
+        newGrams1[newIds[it.first]] = it.second;
+    }
+    grams1.swap(newGrams1);
+
+    for (auto&& words: sentences) {
+        for (auto&& w: words) {
+            w = newIds[w];
+        }
+    }
+}
+
 bool TLangModel::Train(const std::string& fileName, const std::string& alphabetFile, const int& minWordFreq) {
+    TTrainOptions options;
+    options.MinWordFreq = minWordFreq;
+    return Train(fileName, alphabetFile, options);
+}
+
+bool TLangModel::Train(const std::string& fileName, const std::string& alphabetFile, const TTrainOptions& options) {
+    if (options.Order < MIN_GRAM_ORDER || options.Order > MAX_GRAM_ORDER) {
+        std::cerr << "[error] n-gram order should be from " << MIN_GRAM_ORDER
+                  << " to " << MAX_GRAM_ORDER << std::endl;
+        return false;
+    }
+
+    uint64_t runKey = 0;
+    if (!options.CheckpointPrefix.empty()) {
+        std::stringbuf runBuf;
+        std::ostream runOut(&runBuf);
+        NHandyPack::Dump(runOut, fileName, alphabetFile, HashFile(fileName), HashFile(alphabetFile));
+        DumpRunOptions(runOut, options);
+        runKey = RunKey(runBuf.str());
+    }
+    TCheckpoints checkpoints(options.CheckpointPrefix, runKey, options.Resume);
+
+    std::vector<std::vector<std::wstring>> heldOut;
+    TGramCountList grams;
+    uint64_t phaseStartTime = GetCurrentTimeMs();
+    Clear();
+    bool resumed = checkpoints.Load(CHECKPOINT_COUNTS, [&](std::istream& in) {
+        LoadTrainState(in);
+        NHandyPack::Load(in, heldOut);
+        LoadGramList(in, grams);
+    });
+    if (!resumed) {
+        // a broken checkpoint may have been loaded in part
+        Clear();
+        heldOut.clear();
+        grams.clear();
+        Order = options.Order;
+        TTrainCounts counts;
+        if (!CountText(fileName, alphabetFile, options, heldOut, counts)) {
+            return false;
+        }
+        PrepareCounts(counts, options, grams);
+        checkpoints.Save(CHECKPOINT_COUNTS, [&](std::ostream& out) {
+            DumpTrainState(out);
+            NHandyPack::Dump(out, heldOut);
+            DumpGramList(out, grams);
+        });
+    }
+    LogPhase("counts", phaseStartTime);
+
+    if (!BuildFromCounts(grams, options, checkpoints)) {
+        return false;
+    }
+    RemoveCheckpoints(checkpoints);
+    MinWordFreq = options.MinWordFreq;
+    MaxModelBytes = options.MaxModelBytes;
+
+    if (!heldOut.empty()) {
+        std::cerr << "[info] held-out score perplexity: " << GetScorePerplexity(heldOut) << std::endl;
+    }
+    return true;
+}
+
+bool TLangModel::CountText(const std::string& fileName, const std::string& alphabetFile, const TTrainOptions& options,
+                           std::vector<std::vector<std::wstring>>& heldOut, TTrainCounts& counts)
+{
+    const int& minWordFreq = options.MinWordFreq;
 
     std::cerr << "[info] loading text" << std::endl;
-    uint64_t trainStarTime = GetCurrentTimeMs();
     if (!Tokenizer.LoadAlphabet(alphabetFile)) {
         std::cerr << "[error] failed to load alphabet" << std::endl;
         return false;
@@ -195,6 +629,23 @@ bool TLangModel::Train(const std::string& fileName, const std::string& alphabetF
         return false;
     }
 
+    // held out sentences are copied, their words point into trainText
+    if (options.HeldOutPercent > 0) {
+        TSentences trainSentences;
+        for (size_t i = 0; i < sentences.size(); ++i) {
+            if (i % 100 < options.HeldOutPercent) {
+                heldOut.emplace_back();
+                for (auto&& w: sentences[i]) {
+                    heldOut.back().push_back(std::wstring(w.Ptr, w.Len));
+                }
+            } else {
+                trainSentences.push_back(sentences[i]);
+            }
+        }
+        sentences.swap(trainSentences);
+        std::cerr << "[info] held out " << heldOut.size() << " sentences" << std::endl;
+    }
+
     TIdSentences sentenceIds = ConvertToIds(sentences);
 
     assert(sentences.size() == sentenceIds.size());
@@ -207,28 +658,54 @@ bool TLangModel::Train(const std::string& fileName, const std::string& alphabetF
         sentences.swap(tmp);
     }
 
-    std::unordered_map<TGram1Key, TCount> grams1;
-    std::unordered_map<TGram2Key, TCount, TGram2KeyHash> grams2;
-    std::unordered_map<TGram3Key, TCount, TGram3KeyHash> grams3;
-
-    std::cerr << "[info] generating N-grams " << sentenceIds.size() << std::endl;
-    uint64_t lastTime = GetCurrentTimeMs();
-    size_t total = sentenceIds.size();
-    for (size_t i = 0; i < total; ++i) {
-        const TWordIds& words = sentenceIds[i];
+    std::unordered_map<TGram1Key, TCount>& grams1 = counts.Grams1;
 
+    for (auto&& words: sentenceIds) {
         for (auto w: words) {
             grams1[w] += 1;
             TotalWords += 1;
         }
+    }
+
+    std::cerr << "[info] renumbering words by frequency" << std::endl;
+    RenumberByFrequency(grams1, sentenceIds);
+
+    // Rare n-grams are dropped by minWordFreq anyway, so with a sketch of
+    // approximate counts they never make it into the exact tables
+    std::unique_ptr<TCountMinSketch> sketch;
+    uint32_t minCount = std::min<uint32_t>(std::max(minWordFreq, 0), TCountMinSketch::MAX_COUNT);
+    if (options.CountSketchBytes && minWordFreq > 1) {
+        std::cerr << "[info] sketching N-gram counts, " << options.CountSketchBytes << " bytes" << std::endl;
+        sketch.reset(new TCountMinSketch(options.CountSketchBytes));
+        for (auto&& words: sentenceIds) {
+            SketchNgrams<2>(words, *sketch);
+            if (Order >= 3) {
+                SketchNgrams<3>(words, *sketch);
+            }
+            if (Order >= 4) {
+                SketchNgrams<4>(words, *sketch);
+            }
+            if (Order >= 5) {
+                SketchNgrams<5>(words, *sketch);
+            }
+        }
+    }
 
-        for (ssize_t j = 0; j < (ssize_t)words.size() - 1; ++j) {
-            TGram2Key key(words[j], words[j+1]);
-            grams2[key] += 1;
+    std::cerr << "[info] generating N-grams " << sentenceIds.size() << ", order " << size_t(Order) << std::endl;
+    uint64_t lastTime = GetCurrentTimeMs();
+    size_t total = sentenceIds.size();
+    const TCountMinSketch* filter = sketch.get();
+    for (size_t i = 0; i < total; ++i) {
+        const TWordIds& words = sentenceIds[i];
+        CountNgrams(words, counts.Grams2, filter, minCount);
+        if (Order >= 3) {
+            CountNgrams(words, counts.Grams3, filter, minCount);
+        }
+        if (Order >= 4) {
+            CountNgrams(words, counts.Grams4, filter, minCount);
         }
-        for (ssize_t j = 0; j < (ssize_t)words.size() - 2; ++j) {
-            TGram3Key key(words[j], words[j+1], words[j+2]);
-            grams3[key] += 1;
+        if (Order >= 5) {
+            CountNgrams(words, counts.Grams5, filter, minCount);
         }
         uint64_t currTime = GetCurrentTimeMs();
         if (currTime - lastTime > 4000) {
@@ -236,6 +713,16 @@ bool TLangModel::Train(const std::string& fileName, const std::string& alphabetF
             lastTime = currTime;
         }
     }
+    return true;
+}
+
+void TLangModel::PrepareCounts(TTrainCounts& counts, const TTrainOptions& options, TGramCountList& grams) {
+    const int& minWordFreq = options.MinWordFreq;
+    std::unordered_map<TGram1Key, TCount>& grams1 = counts.Grams1;
+    TGramCounts<2>& grams2 = counts.Grams2;
+    TGramCounts<3>& grams3 = counts.Grams3;
+    TGramCounts<4>& grams4 = counts.Grams4;
+    TGramCounts<5>& grams5 = counts.Grams5;
 
     // remove lower frequency words and ngrams
     if (minWordFreq > 1) {
@@ -248,48 +735,321 @@ bool TLangModel::Train(const std::string& fileName, const std::string& alphabetF
 	std::cerr << "[info] " << count << " keys are removed from grams2 due to frequency less than " << minWordFreq << std::endl;
         count = RemoveLowFreqNgramKeys(grams3, minWordFreq);
 	std::cerr << "[info] " << count << " keys are removed from grams3 due to frequency less than " << minWordFreq << std::endl;
+        count = RemoveLowFreqNgramKeys(grams4, minWordFreq) + RemoveLowFreqNgramKeys(grams5, minWordFreq);
+	std::cerr << "[info] " << count << " keys are removed from higher order grams due to frequency less than " << minWordFreq << std::endl;
     }
 
     VocabSize = grams1.size();
 
-    std::cerr << "[info] generating keys" << std::endl;
-
-    {
-        std::vector<std::string> keys;
-        keys.reserve(grams1.size() + grams2.size() + grams3.size());
-
-        std::cerr << "[info] ngrams1: " << grams1.size() << "\n";
-        std::cerr << "[info] ngrams2: " << grams2.size() << "\n";
-        std::cerr << "[info] ngrams3: " << grams3.size() << "\n";
-        std::cerr << "[info] total: " << grams3.size() + grams2.size() + grams1.size() << "\n";
+    // ids are ordered by frequency, so removed words were the tail ones
+    LastWordID = grams1.size();
+    IdToWord.resize(LastWordID);
 
-        PrepareNgramKeys(grams1, keys);
-        PrepareNgramKeys(grams2, keys);
-        PrepareNgramKeys(grams3, keys);
+    Grams1.assign(LastWordID, TPackedCount());
+    for (auto&& it: grams1) {
+        Grams1[it.first] = PackInt32(it.second);
+    }
 
-        std::cerr << "[info] generating perf hash" << std::endl;
+    InitializeGram2Block(grams2, options);
 
-        PerfectHash.Init(keys);
+    size_t gramsSizes[] = {grams1.size(), grams2.size(), grams3.size(), grams4.size(), grams5.size()};
+    size_t totalGrams = 0;
+    for (size_t n = 1; n <= Order; ++n) {
+        std::cerr << "[info] ngrams" << n << ": " << gramsSizes[n - 1] << "\n";
+        totalGrams += gramsSizes[n - 1];
     }
+    std::cerr << "[info] total: " << totalGrams << "\n";
 
-    std::cerr << "[info] finished, buckets: " << PerfectHash.BucketsNumber() << "\n";
+    grams.reserve(totalGrams - grams1.size());
+    AppendNgrams(grams2, grams);
+    AppendNgrams(grams3, grams);
+    AppendNgrams(grams4, grams);
+    AppendNgrams(grams5, grams);
+}
 
-    Buckets.resize(PerfectHash.BucketsNumber());
-    InitializeBuckets(grams1, PerfectHash, Buckets);
-    InitializeBuckets(grams2, PerfectHash, Buckets);
-    InitializeBuckets(grams3, PerfectHash, Buckets);
+bool TLangModel::BuildFromCounts(TGramCountList& grams, const TTrainOptions& options, const TCheckpoints& checkpoints) {
+    uint64_t buildStartTime = GetCurrentTimeMs();
+    bool resumed = checkpoints.Load(CHECKPOINT_STORE, [this](std::istream& in) {
+        NHandyPack::Load(in, Ngrams);
+    });
+    if (resumed) {
+        StoreNgramsByOrder = CountByOrder(grams, Order);
+    } else {
+        if (!BuildNgramStore(grams, options, &checkpoints)) {
+            return false;
+        }
+        checkpoints.Save(CHECKPOINT_STORE, [this](std::ostream& out) {
+            NHandyPack::Dump(out, Ngrams);
+        });
+    }
+    LogPhase("store", buildStartTime);
 
-    std::cerr << "[info] buckets filled" << std::endl;
+    if (options.MaxModelBytes) {
+        uint64_t pruneStartTime = GetCurrentTimeMs();
+        if (!PruneToBudget(grams, options)) {
+            return false;
+        }
+        LogPhase("prune", pruneStartTime);
+    }
 
     std::stringbuf checkSumBuf;
     std::ostream checkSumOut(&checkSumBuf);
-    NHandyPack::Dump(checkSumOut, trainStarTime, grams1.size(), grams2.size(),
-                    grams3.size(), Buckets.size(), trainText.size(), sentences.size());
+    NHandyPack::Dump(checkSumOut, buildStartTime, size_t(Order), size_t(VocabSize), grams.size(),
+                    Ngrams->ByteSize(), uint64_t(TotalWords));
     std::string checkSumStr = checkSumBuf.str();
     CheckSum = CityHash64(&checkSumStr[0], checkSumStr.size());
+    UpdateLogTables();
+
     return true;
 }
 
+bool TLangModel::Train(const TNgramCounts& ngramCounts, const TTrainOptions& options) {
+    if (ngramCounts.Tables.size() + 1 != ngramCounts.Order) {
+        std::cerr << "[error] broken n-gram counts" << std::endl;
+        return false;
+    }
+    Clear();
+    Order = ngramCounts.Order;
+    Tokenizer = ngramCounts.Tokenizer;
+    TotalWords = ngramCounts.TotalWords;
+
+    uint64_t runKey = 0;
+    if (!options.CheckpointPrefix.empty()) {
+        std::stringbuf runBuf;
+        std::ostream runOut(&runBuf);
+        NHandyPack::Dump(runOut, ngramCounts.Order, ngramCounts.TotalWords, ngramCounts.Words, ngramCounts.WordCounts);
+        for (auto&& table: ngramCounts.Tables) {
+            NHandyPack::Dump(runOut, HashVector(table.Words), HashVector(table.Counts));
+        }
+        DumpRunOptions(runOut, options);
+        runKey = RunKey(runBuf.str());
+    }
+    TCheckpoints checkpoints(options.CheckpointPrefix, runKey, options.Resume);
+
+    uint64_t phaseStartTime = GetCurrentTimeMs();
+
+    // words of count files are in lexicographic order, models number them
+    // by frequency
+    const std::vector<TCount>& wordCounts = ngramCounts.WordCounts;
+    std::vector<TWordId> order(wordCounts.size());
+    for (TWordId wid = 0; wid < order.size(); ++wid) {
+        order[wid] = wid;
+    }
+    std::stable_sort(order.begin(), order.end(), [&wordCounts](TWordId a, TWordId b) {
+        return wordCounts[a] > wordCounts[b];
+    });
+    std::vector<TWordId> newIds(order.size());
+    TTrainCounts counts;
+    IdToWord.resize(order.size());
+    for (TWordId wid = 0; wid < order.size(); ++wid) {
+        newIds[order[wid]] = wid;
+        WordToId[ngramCounts.Words[order[wid]]] = wid;
+        IdToWord[wid] = ngramCounts.Words[order[wid]];
+        counts.Grams1[wid] = wordCounts[order[wid]];
+    }
+    LastWordID = order.size();
+
+    std::cerr << "[info] building model from counts, words: " << LastWordID
+              << ", order " << size_t(Order) << std::endl;
+    TableToCounts(ngramCounts.Tables[0], newIds, counts.Grams2);
+    if (Order >= 3) {
+        TableToCounts(ngramCounts.Tables[1], newIds, counts.Grams3);
+    }
+    if (Order >= 4) {
+        TableToCounts(ngramCounts.Tables[2], newIds, counts.Grams4);
+    }
+    if (Order >= 5) {
+        TableToCounts(ngramCounts.Tables[3], newIds, counts.Grams5);
+    }
+    TGramCountList grams;
+    PrepareCounts(counts, options, grams);
+    LogPhase("counts", phaseStartTime);
+
+    if (!BuildFromCounts(grams, options, checkpoints)) {
+        return false;
+    }
+    RemoveCheckpoints(checkpoints);
+    MinWordFreq = options.MinWordFreq;
+    MaxModelBytes = options.MaxModelBytes;
+    return true;
+}
+
+void TLangModel::DumpTrainState(std::ostream& out) const {
+    NHandyPack::Dump(out, Order, WordToId, LastWordID, TotalWords, VocabSize,
+                     Grams1, Gram2BlockWords, Gram2Block, Tokenizer);
+}
+
+void TLangModel::LoadTrainState(std::istream& in) {
+    NHandyPack::Load(in, Order, WordToId, LastWordID, TotalWords, VocabSize,
+                     Grams1, Gram2BlockWords, Gram2Block, Tokenizer);
+    IdToWord.clear();
+    IdToWord.resize(LastWordID);
+    for (auto&& it: WordToId) {
+        if (it.second < LastWordID) {
+            IdToWord[it.second] = it.first;
+        }
+    }
+}
+
+bool TLangModel::BuildNgramStore(const TGramCountList& grams, const TTrainOptions& options,
+                                 const TCheckpoints* checkpoints)
+{
+    StoreNgramsByOrder = CountByOrder(grams, Order);
+    if (options.NgramStore == NS_TRIE) {
+        TTrieStore* store = new TTrieStore();
+        Ngrams.Reset(store);
+        if (!store->Build(grams, LastWordID)) {
+            std::cerr << "[error] failed to build trie" << std::endl;
+            return false;
+        }
+    } else {
+        TPerfectHashStore* store = new TPerfectHashStore();
+        Ngrams.Reset(store);
+        if (!store->Build(grams, options.BucketLayout, options.PerfectHash, checkpoints)) {
+            std::cerr << "[error] failed to build perfect hash" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TLangModel::PruneToBudget(TGramCountList& grams, const TTrainOptions& options) {
+    uint64_t modelBytes = GetSerializedSize();
+    std::cerr << "[info] model size " << modelBytes << " bytes, budget " << options.MaxModelBytes << std::endl;
+    if (modelBytes <= options.MaxModelBytes) {
+        return true;
+    }
+    uint64_t storeBytes = SerializedSize(Ngrams);
+    uint64_t fixedBytes = modelBytes - storeBytes;
+    if (fixedBytes >= options.MaxModelBytes) {
+        std::cerr << "[error] vocabulary and unigrams alone take " << fixedBytes
+                  << " bytes, over the model size budget" << std::endl;
+        return false;
+    }
+
+    std::sort(grams.begin(), grams.end(), [](const std::pair<TGramKey, TCount>& a,
+                                             const std::pair<TGramKey, TCount>& b) {
+        return a.first.Size < b.first.Size || (a.first.Size == b.first.Size && a.first < b.first);
+    });
+    std::vector<size_t> ranking = RankByRelativeEntropy(grams);
+
+    // store size is roughly proportional to the number of n-grams, so keep
+    // scaling their number down until the model fits
+    constexpr size_t MAX_ATTEMPTS = 10;
+    size_t keep = grams.size();
+    TGramCountList kept;
+    for (size_t attempt = 0; attempt < MAX_ATTEMPTS && modelBytes > options.MaxModelBytes; ++attempt) {
+        double ratio = double(options.MaxModelBytes - fixedBytes) / double(modelBytes - fixedBytes);
+        keep = std::min(keep - 1, size_t(double(keep) * ratio * 0.99));
+        std::vector<size_t> indexes(ranking.begin(), ranking.begin() + keep);
+        std::sort(indexes.begin(), indexes.end());
+        kept.clear();
+        for (size_t i: indexes) {
+            kept.push_back(grams[i]);
+        }
+        std::cerr << "[info] pruning to " << kept.size() << " of " << grams.size() << " n-grams" << std::endl;
+        if (!BuildNgramStore(kept, options)) {
+            return false;
+        }
+        modelBytes = GetSerializedSize();
+        std::cerr << "[info] model size " << modelBytes << " bytes" << std::endl;
+    }
+    if (modelBytes > options.MaxModelBytes) {
+        std::cerr << "[error] failed to fit the model into " << options.MaxModelBytes << " bytes" << std::endl;
+        return false;
+    }
+    grams.swap(kept);
+    return true;
+}
+
+// Orders n-grams from the most to the least valuable by their relative
+// entropy against the lower order estimate (Stolcke pruning):
+// P(w1..wn) * log(P(wn|w1..wn-1) / P(wn|w2..wn-1)). An n-gram is worth at
+// least as much as any of its extensions, since they are useless without
+// their prefix count. grams should be sorted by size and words.
+std::vector<size_t> TLangModel::RankByRelativeEntropy(const TGramCountList& grams) const {
+    auto less = [](const std::pair<TGramKey, TCount>& a, const TGramKey& b) {
+        return a.first.Size < b.Size || (a.first.Size == b.Size && a.first < b);
+    };
+    auto find = [&](const TWordId* words, size_t size) {
+        TGramKey key(words, size);
+        auto it = std::lower_bound(grams.begin(), grams.end(), key, less);
+        return it != grams.end() && it->first == key ? size_t(it - grams.begin()) : grams.size();
+    };
+    auto count = [&](const TWordId* words, size_t size) -> double {
+        if (size == 1) {
+            return Unpack(GetGram1HashCode(words[0]));
+        }
+        if (size == 2 && words[0] < Gram2BlockWords && words[1] < Gram2BlockWords) {
+            return Unpack(Gram2Block[uint64_t(words[0]) * Gram2BlockWords + words[1]]);
+        }
+        size_t i = find(words, size);
+        return i == grams.size() ? 0.0 : double(grams[i].second);
+    };
+
+    std::vector<double> scores(grams.size());
+    for (size_t i = 0; i < grams.size(); ++i) {
+        const TGramKey& key = grams[i].first;
+        double prob = (grams[i].second + K) / (count(key.Words, key.Size - 1) + TotalWords);
+        double lowerProb = key.Size == 2
+            ? GetGram1Prob(TCount(count(key.Words + 1, 1)))
+            : (count(key.Words + 1, key.Size - 1) + K) / (count(key.Words + 1, key.Size - 2) + TotalWords);
+        scores[i] = double(grams[i].second) / TotalWords * log(prob / lowerProb);
+    }
+    // grams are sorted by size, so extensions are visited before prefixes
+    for (size_t i = grams.size(); i-- > 0;) {
+        const TGramKey& key = grams[i].first;
+        if (key.Size > MIN_GRAM_ORDER) {
+            size_t prefix = find(key.Words, key.Size - 1);
+            if (prefix != grams.size()) {
+                scores[prefix] = std::max(scores[prefix], scores[i]);
+            }
+        }
+    }
+
+    std::vector<size_t> ranking(grams.size());
+    for (size_t i = 0; i < ranking.size(); ++i) {
+        ranking[i] = i;
+    }
+    // shorter n-grams first among equal scores, so prefixes are kept
+    // whenever their extensions are
+    std::sort(ranking.begin(), ranking.end(), [&](size_t a, size_t b) {
+        if (scores[a] != scores[b]) {
+            return scores[a] > scores[b];
+        }
+        return a < b;
+    });
+    return ranking;
+}
+
+uint64_t TLangModel::GetSerializedSize() const {
+    TModelWriter writer;
+    AddSections(writer);
+    return writer.GetByteSize(LANG_MODEL_MAGIC_BYTE, LANG_MODEL_VERSION);
+}
+
+// exp() of the mean negative log term of Score(). Score() adds Order terms
+// per word, the unigram one and one for every longer n-gram starting at the
+// word, and its smoothed terms are not a normalized distribution. So this
+// is not the per-token perplexity of a language model, only a measure to
+// compare models of the same order on the same text: lower is better.
+double TLangModel::GetScorePerplexity(const std::vector<std::vector<std::wstring>>& sentences) const {
+    double logProb = 0;
+    size_t predictions = 0;
+    for (auto&& sentence: sentences) {
+        if (sentence.empty()) {
+            continue;
+        }
+        TWords sentenceWords;
+        for (auto&& w: sentence) {
+            sentenceWords.push_back(TWord(w));
+        }
+        logProb += Score(sentenceWords);
+        predictions += sentence.size() * Order;
+    }
+    return predictions ? exp(-logProb / predictions) : 0.0;
+}
+
 double TLangModel::Score(const TWords& words) const {
     TWordIds sentence;
     for (auto&& w: words) {
@@ -299,14 +1059,43 @@ double TLangModel::Score(const TWords& words) const {
         return std::numeric_limits<double>::min();
     }
 
-    sentence.push_back(UnknownWordId);
-    sentence.push_back(UnknownWordId);
+    switch (Order) {
+    case 2: return ScoreImpl<2>(sentence);
+    case 3: return ScoreImpl<3>(sentence);
+    case 4: return ScoreImpl<4>(sentence);
+    case 5: return ScoreImpl<5>(sentence);
+    }
+    assert(false && "wrong n-gram order");
+    return std::numeric_limits<double>::min();
+}
+
+template<size_t N>
+double TLangModel::ScoreImpl(const TWordIds& words) const {
+    TWordIds sentence(words);
+    for (size_t n = 1; n < N; ++n) {
+        sentence.push_back(UnknownWordId);
+    }
+
+    // keys[(N - 1) * i + n - 2] is the n-gram starting at i
+    size_t len = words.size();
+    std::vector<TGramKey> keys((N - 1) * len);
+    for (size_t i = 0; i < len; ++i) {
+        for (size_t n = 2; n <= N; ++n) {
+            keys[(N - 1) * i + n - 2] = TGramKey(&sentence[i], n);
+        }
+    }
+    std::vector<TPackedCount> codes(keys.size());
+    GetCodesBatch(&keys[0], keys.size(), &codes[0]);
 
     double result = 0;
-    for (size_t i = 0; i < sentence.size() - 2; ++i) {
-        result += log(GetGram1Prob(sentence[i]));
-        result += log(GetGram2Prob(sentence[i], sentence[i + 1]));
-        result += log(GetGram3Prob(sentence[i], sentence[i + 1], sentence[i + 2]));
+    for (size_t i = 0; i < len; ++i) {
+        TPackedCount prefix = GetGram1HashCode(sentence[i]);
+        result += GetGram1LogProb(prefix);
+        for (size_t n = 2; n <= N; ++n) {
+            TPackedCount code = codes[(N - 1) * i + n - 2];
+            result += GetGramLogProb(prefix, code);
+            prefix = code;
+        }
     }
     return result;
 }
@@ -322,16 +1111,58 @@ double TLangModel::Score(const std::wstring& str) const {
     return Score(words);
 }
 
-bool TLangModel::Dump(const std::string& modelFileName) const {
-    std::ofstream out(modelFileName, std::ios::binary);
-    if (!out.is_open()) {
+bool TLangModel::Dump(const std::string& modelFileName, bool compressed) const {
+    if (!Delta.Empty()) {
+        std::cerr << "[error] model has delta counts, rebuild it with them before saving" << std::endl;
         return false;
     }
-    NHandyPack::Dump(out, LANG_MODEL_MAGIC_BYTE);
-    NHandyPack::Dump(out, LANG_MODEL_VERSION);
-    Dump(out);
-    NHandyPack::Dump(out, LANG_MODEL_MAGIC_BYTE);
-    return true;
+    TModelWriter writer;
+    AddSections(writer, compressed);
+    return writer.Save(modelFileName, LANG_MODEL_MAGIC_BYTE, LANG_MODEL_VERSION);
+}
+
+void TLangModel::AddSections(TModelWriter& writer, bool compressed) const {
+    writer.AddSection(MODEL_SECTION_HEADER, [this](std::ostream& out) {
+        NHandyPack::Dump(out, Order, LastWordID, TotalWords, VocabSize, CheckSum);
+    });
+    writer.AddSection(compressed ? MODEL_SECTION_VOCAB_PACKED : MODEL_SECTION_VOCAB_INDEX, [this, compressed](std::ostream& out) {
+        TVocabIndex built;
+        if (Vocab.Empty()) {
+            built.Build(WordToId, LastWordID);
+        }
+        const TVocabIndex& vocab = Vocab.Empty() ? built : Vocab;
+        if (compressed) {
+            TFrontCodedVocab packed;
+            packed.Build(vocab, LastWordID);
+            NHandyPack::Dump(out, packed);
+        } else {
+            NHandyPack::Dump(out, vocab);
+        }
+    });
+    writer.AddSection(MODEL_SECTION_UNIGRAMS, [this](std::ostream& out) {
+        NHandyPack::Dump(out, Grams1);
+    });
+    writer.AddSection(MODEL_SECTION_BIGRAM_BLOCK, [this](std::ostream& out) {
+        NHandyPack::Dump(out, Gram2BlockWords, Gram2Block);
+    });
+    writer.AddSection(compressed ? MODEL_SECTION_NGRAMS_PACKED : MODEL_SECTION_NGRAMS, [this, compressed](std::ostream& out) {
+        if (compressed) {
+            Ngrams.DumpPacked(out);
+        } else {
+            NHandyPack::Dump(out, Ngrams);
+        }
+    });
+    writer.AddSection(MODEL_SECTION_TOKENIZER, [this](std::ostream& out) {
+        NHandyPack::Dump(out, Tokenizer);
+    });
+    if (!StoreNgramsByOrder.empty()) {
+        writer.AddSection(MODEL_SECTION_NGRAM_ORDERS, [this](std::ostream& out) {
+            NHandyPack::Dump(out, StoreNgramsByOrder);
+        });
+    }
+    writer.AddSection(MODEL_SECTION_TRAIN_OPTIONS, [this](std::ostream& out) {
+        NHandyPack::Dump(out, int32_t(MinWordFreq), MaxModelBytes);
+    });
 }
 
 bool TLangModel::DumpVocab(const std::string& modelVocabFileName, const std::string& modelVocabFreqFileName) const {
@@ -346,6 +1177,13 @@ bool TLangModel::DumpVocab(const std::string& modelVocabFileName, const std::str
 	TCount cnt = GetWordCount(GetWordIdNoCreate(it.first));
 	out_freq << cnt << ",";
     }
+    for (TWordId wid = 0; !Vocab.Empty() && wid < LastWordID; ++wid) {
+        TWord word = Vocab.GetWord(wid);
+        if (word.Ptr) {
+            out << std::wstring(word.Ptr, word.Len) << L",";
+            out_freq << GetWordCount(wid) << ",";
+        }
+    }
 
     return true;
 }
@@ -362,33 +1200,155 @@ bool TLangModel::Load(const std::string& modelFileName) {
         return false;
     }
     NHandyPack::Load(in, version);
-    if (version != LANG_MODEL_VERSION) {
+    if (version == LANG_MODEL_VERSION) {
+        in.close();
+        TModelContainer container;
+        return container.Open(modelFileName, LANG_MODEL_MAGIC_BYTE, LANG_MODEL_VERSION) && Load(container);
+    }
+    if (version == LANG_MODEL_LEGACY_VERSION) {
+        LoadLegacy(in);
+    } else if (version == LANG_MODEL_STREAM_VERSION) {
+        Load(in);
+    } else {
         return false;
     }
-    Load(in);
     magicByte = 0;
     NHandyPack::Load(in, magicByte);
     if (magicByte != LANG_MODEL_MAGIC_BYTE) {
         Clear();
         return false;
     }
+    FinishLoad();
+    return true;
+}
+
+bool TLangModel::Load(const TModelContainer& container) {
+    Clear();
+    bool loaded = container.LoadSection(MODEL_SECTION_HEADER, [this](std::istream& in) {
+        NHandyPack::Load(in, Order, LastWordID, TotalWords, VocabSize, CheckSum);
+    }) && LoadVocab(container) && container.LoadSection(MODEL_SECTION_UNIGRAMS, [this](std::istream& in) {
+        NHandyPack::Load(in, Grams1);
+    }) && container.LoadSection(MODEL_SECTION_BIGRAM_BLOCK, [this](std::istream& in) {
+        NHandyPack::Load(in, Gram2BlockWords, Gram2Block);
+    }) && (container.HasSection(MODEL_SECTION_NGRAMS_PACKED)
+        ? container.LoadSection(MODEL_SECTION_NGRAMS_PACKED, [this](std::istream& in) {
+              Ngrams.LoadPacked(in);
+          })
+        : container.LoadSection(MODEL_SECTION_NGRAMS, [this](std::istream& in) {
+              NHandyPack::Load(in, Ngrams);
+          })
+    ) && container.LoadSection(MODEL_SECTION_TOKENIZER, [this](std::istream& in) {
+        NHandyPack::Load(in, Tokenizer);
+    }) && (!container.HasSection(MODEL_SECTION_NGRAM_ORDERS)
+        || container.LoadSection(MODEL_SECTION_NGRAM_ORDERS, [this](std::istream& in) {
+               NHandyPack::Load(in, StoreNgramsByOrder);
+           })
+    ) && (!container.HasSection(MODEL_SECTION_TRAIN_OPTIONS)
+        || container.LoadSection(MODEL_SECTION_TRAIN_OPTIONS, [this](std::istream& in) {
+               int32_t minWordFreq = 0;
+               NHandyPack::Load(in, minWordFreq, MaxModelBytes);
+               MinWordFreq = minWordFreq;
+           })
+    );
+    if (!loaded) {
+        Clear();
+        return false;
+    }
+    FinishLoad();
+    return true;
+}
+
+bool TLangModel::LoadVocab(const TModelContainer& container) {
+    if (container.HasSection(MODEL_SECTION_VOCAB_INDEX)) {
+        return container.LoadSection(MODEL_SECTION_VOCAB_INDEX, [this](std::istream& in) {
+            NHandyPack::Load(in, Vocab);
+        });
+    }
+    if (container.HasSection(MODEL_SECTION_VOCAB_PACKED)) {
+        return container.LoadSection(MODEL_SECTION_VOCAB_PACKED, [this](std::istream& in) {
+            TFrontCodedVocab packed;
+            NHandyPack::Load(in, packed);
+            if (!in.fail()) {
+                std::wstring arena;
+                std::vector<uint32_t> offsets;
+                packed.Decode(arena, offsets);
+                Vocab.Build(std::move(arena), std::move(offsets));
+            }
+        });
+    }
+    return container.LoadSection(MODEL_SECTION_VOCAB, [this](std::istream& in) {
+        NHandyPack::Load(in, WordToId);
+    });
+}
+
+void TLangModel::FinishLoad() {
     IdToWord.clear();
-    IdToWord.resize(LastWordID + 1, L"");
+    if (Vocab.Empty()) {
+        IdToWord.resize(LastWordID + 1, L"");
+        for (auto&& it: WordToId) {
+            IdToWord[it.second] = it.first;
+        }
+    }
+    Delta.Clear();
+    UpdateLogTables();
+}
+
+void TLangModel::ThawVocab() {
+    if (Vocab.Empty()) {
+        return;
+    }
+    WordToId.clear();
+    WordToId.reserve(Vocab.Size());
+    IdToWord.assign(LastWordID, L"");
+    for (TWordId wid = 0; wid < LastWordID; ++wid) {
+        TWord word = Vocab.GetWord(wid);
+        if (word.Ptr) {
+            IdToWord[wid].assign(word.Ptr, word.Len);
+            WordToId[IdToWord[wid]] = wid;
+        }
+    }
+    Vocab.Clear();
+}
+
+void TLangModel::LoadLegacy(std::istream& in) {
+    TPerfectHashStore* store = new TPerfectHashStore();
+    Ngrams.Reset(store);
+    Order = 3;
+    NHandyPack::Load(in, WordToId, LastWordID, TotalWords, VocabSize);
+    store->LoadLegacy(in);
+    NHandyPack::Load(in, Tokenizer, CheckSum);
+    Gram2BlockWords = 0;
+    Gram2Block.clear();
+    Grams1.assign(LastWordID, TPackedCount());
     for (auto&& it: WordToId) {
-        IdToWord[it.second] = it.first;
+        TWordId key = it.second;
+        Grams1[it.second] = store->Find(&key, 1);
     }
-    return true;
 }
 
 void TLangModel::Clear() {
     K = LANG_MODEL_DEFAULT_K;
+    Order = DEFAULT_GRAM_ORDER;
     WordToId.clear();
+    IdToWord.clear();
+    Vocab.Clear();
     LastWordID = 0;
     TotalWords = 0;
+    Grams1.clear();
+    Gram2BlockWords = 0;
+    Gram2Block.clear();
+    Ngrams.Clear();
+    Delta.Clear();
+    PendingDeltaWords.clear();
+    MinWordFreq = 0;
+    MaxModelBytes = 0;
+    StoreNgramsByOrder.clear();
     Tokenizer.Clear();
+    UpdateLogTables();
 }
 
 const TRobinHash& TLangModel::GetWordToId() {
+    ThawVocab();
     return WordToId;
 }
 
@@ -409,6 +1369,7 @@ TIdSentences TLangModel::ConvertToIds(const TSentences& sentences) {
 TWordId TLangModel::GetWordId(const TWord& word) {
     assert(word.Ptr && word.Len);
     assert(word.Len < 10000);
+    ThawVocab();
     std::wstring w(word.Ptr, word.Len);
     auto it = WordToId.find(w);
     if (it != WordToId.end()) {
@@ -422,6 +1383,9 @@ TWordId TLangModel::GetWordId(const TWord& word) {
 }
 
 TWordId TLangModel::GetWordIdNoCreate(const TWord& word) const {
+    if (!Vocab.Empty()) {
+        return Vocab.Find(word.Ptr, word.Len);
+    }
     std::wstring w(word.Ptr, word.Len);
     auto it = WordToId.find(w);
     if (it != WordToId.end()) {
@@ -431,6 +1395,9 @@ TWordId TLangModel::GetWordIdNoCreate(const TWord& word) const {
 }
 
 TWord TLangModel::GetWordById(TWordId wid) const {
+    if (!Vocab.Empty()) {
+        return Vocab.GetWord(wid);
+    }
     if (wid >= IdToWord.size()) {
         return TWord();
     }
@@ -438,14 +1405,125 @@ TWord TLangModel::GetWordById(TWordId wid) const {
 }
 
 TCount TLangModel::GetWordCount(TWordId wid) const {
-    return GetGram1HashCount(wid);
+    return Unpack(GetGram1HashCode(wid));
+}
+
+void TLangModel::SetScoringMode(EScoringMode mode) {
+    ScoringMode = mode;
+    UpdateLogTables();
+}
+
+EScoringMode TLangModel::GetScoringMode() const {
+    return ScoringMode;
+}
+
+int TLangModel::GetMinWordFreq() const {
+    return MinWordFreq;
+}
+
+void TLangModel::UpdateLogTables() {
+    if (ScoringMode != EScoringMode::LogTables) {
+        std::vector<float>().swap(LogGram1Table);
+        std::vector<float>().swap(LogNumeratorTable);
+        std::vector<float>().swap(LogDenominatorTable);
+        return;
+    }
+    LogGram1Table.resize(PACKED_COUNT_CODES);
+    LogNumeratorTable.resize(PACKED_COUNT_CODES);
+    LogDenominatorTable.resize(PACKED_COUNT_CODES);
+    for (uint32_t code = 0; code < PACKED_COUNT_CODES; ++code) {
+        double counts = Unpack(TPackedCount(code));
+        LogGram1Table[code] = log(GetGram1Prob(counts));
+        LogNumeratorTable[code] = log(counts + K);
+        LogDenominatorTable[code] = log(counts + TotalWords);
+    }
 }
 
 uint64_t TLangModel::GetCheckSum() const {
     return CheckSum;
 }
 
+size_t TLangModel::GetOrder() const {
+    return Order;
+}
+
+TModelStats TLangModel::GetStats() const {
+    TModelStats stats;
+    stats.Order = Order;
+    stats.TotalWords = TotalWords;
+    stats.VocabWords = Vocab.Empty() ? WordToId.size() : Vocab.Size();
+
+    stats.NgramsByOrder.assign(Order + 1, 0);
+    stats.StoreNgramsCounted = !StoreNgramsByOrder.empty();
+    for (size_t n = 2; n <= Order && n < StoreNgramsByOrder.size(); ++n) {
+        stats.NgramsByOrder[n] = StoreNgramsByOrder[n];
+    }
+    for (TPackedCount code: Grams1) {
+        stats.NgramsByOrder[1] += code ? 1 : 0;
+    }
+    for (TPackedCount code: Gram2Block) {
+        stats.DenseBigrams += code ? 1 : 0;
+    }
+    stats.NgramsByOrder[2] += stats.DenseBigrams;
+
+    if (Ngrams.Empty()) {
+        return stats;
+    }
+    stats.NgramStore = Ngrams->GetType();
+    if (stats.NgramStore == NS_PERFECT_HASH) {
+        const TPerfectHashStore& store = static_cast<const TPerfectHashStore&>(*Ngrams);
+        const TBuckets& buckets = store.GetBuckets();
+        stats.PerfectHashBackend = store.GetBackend();
+        stats.BucketLayout = buckets.GetLayout();
+        stats.FingerprintType = store.GetFingerprintType();
+        stats.Buckets = buckets.Size();
+        stats.FilledBuckets = buckets.FilledSize();
+        stats.FingerprintFalsePositiveRate = buckets.FalsePositiveRate();
+    }
+    return stats;
+}
+
+TMemoryUsage TLangModel::MemoryUsage() const {
+    TMemoryUsage usage;
+    uint64_t keyBytes = 0;
+    for (auto&& it: WordToId) {
+        keyBytes += HeapBytes(it.first);
+    }
+    using TRobinBucket = tsl::detail_robin_hash::bucket_entry<TRobinHash::value_type, false>;
+    usage.Add("word_to_id_table", WordToId.bucket_count() * sizeof(TRobinBucket));
+    usage.Add("word_to_id_strings", keyBytes);
+    uint64_t idToWordBytes = IdToWord.capacity() * sizeof(std::wstring);
+    for (auto&& word: IdToWord) {
+        idToWordBytes += HeapBytes(word);
+    }
+    usage.Add("id_to_word", idToWordBytes);
+    usage.Add("vocab_index", Vocab.ByteSize());
+    usage.Add("unigrams", Grams1.capacity() * sizeof(TPackedCount));
+    usage.Add("bigram_block", Gram2Block.capacity() * sizeof(TPackedCount));
+    if (!Ngrams.Empty()) {
+        Ngrams->GetMemoryUsage(usage);
+    }
+    usage.Add("delta", Delta.ByteSize());
+    usage.Add("log_tables", (LogGram1Table.capacity() + LogNumeratorTable.capacity() +
+                             LogDenominatorTable.capacity()) * sizeof(float));
+    return usage;
+}
+
+bool TLangModel::AdviseMemory(const TMemoryOptions& options) const {
+    bool advised = NJamSpell::AdviseMemory(Gram2Block.data(), Gram2Block.size() * sizeof(TPackedCount), options);
+    advised = NJamSpell::AdviseMemory(Grams1.data(), Grams1.size() * sizeof(TPackedCount), options) && advised;
+    advised = NJamSpell::AdviseMemory(LogGram1Table.data(), LogGram1Table.size() * sizeof(float), options) && advised;
+    advised = Vocab.AdviseMemory(options) && advised;
+    if (!Ngrams.Empty()) {
+        advised = Ngrams->AdviseMemory(options) && advised;
+    }
+    return advised;
+}
+
 TWord TLangModel::GetWord(const std::wstring& word) const {
+    if (!Vocab.Empty()) {
+        return Vocab.GetWord(Vocab.Find(word.data(), word.size()));
+    }
     auto it = WordToId.find(word);
     if (it != WordToId.end()) {
         return TWord(&it->first[0], it->first.size());
@@ -461,82 +1539,318 @@ TSentences TLangModel::Tokenize(const std::wstring& text) const {
     return Tokenizer.Process(text);
 }
 
-double TLangModel::GetGram1Prob(TWordId word) const {
-    double countsGram1 = GetGram1HashCount(word);
-    countsGram1 += K;
-    return countsGram1 / (TotalWords + VocabSize);
+double TLangModel::GetGram1LogProb(TPackedCount codeGram1) const {
+    if (ScoringMode == EScoringMode::LogTables) {
+        return LogGram1Table[codeGram1];
+    }
+    return log(GetGram1Prob(Unpack(codeGram1)));
 }
 
-double TLangModel::GetGram2Prob(TWordId word1, TWordId word2) const {
-    double countsGram1 = GetGram1HashCount(word1);
-    double countsGram2 = GetGram2HashCount(word1, word2);
-    if (countsGram2 > countsGram1) { // (hash collision)
-        countsGram2 = 0;
+double TLangModel::GetGramLogProb(TPackedCount codePrefix, TPackedCount codeGram) const {
+    if (ScoringMode == EScoringMode::LogTables) {
+        if (Unpack(codeGram) > Unpack(codePrefix)) { // (hash collision)
+            codeGram = 0;
+        }
+        return LogNumeratorTable[codeGram] - LogDenominatorTable[codePrefix];
     }
-    countsGram1 += TotalWords;
-    countsGram2 += K;
-    return countsGram2 / countsGram1;
+    return log(GetGramProb(Unpack(codePrefix), Unpack(codeGram)));
 }
 
-double TLangModel::GetGram3Prob(TWordId word1, TWordId word2, TWordId word3) const {
-    double countsGram2 = GetGram2HashCount(word1, word2);
-    double countsGram3 = GetGram3HashCount(word1, word2, word3);
-    if (countsGram3 > countsGram2) { // hash collision
-        countsGram3 = 0;
+double TLangModel::GetGram1Prob(TCount countsGram1) const {
+    double counts = countsGram1;
+    counts += K;
+    return counts / (TotalWords + VocabSize);
+}
+
+double TLangModel::GetGramProb(TCount countsPrefix, TCount countsGram) const {
+    double counts1 = countsPrefix;
+    double counts2 = countsGram;
+    if (counts2 > counts1) { // (hash collision)
+        counts2 = 0;
     }
-    countsGram2 += TotalWords;
-    countsGram3 += K;
-    return countsGram3 / countsGram2;
+    counts1 += TotalWords;
+    counts2 += K;
+    return counts2 / counts1;
 }
 
-template<typename T>
-TCount GetGramHashCount(T key,
-                        const TPerfectHash& ph,
-                        const std::vector<std::pair<uint16_t, uint16_t>>& buckets)
+TPackedCount TLangModel::GetGram1HashCode(TWordId word) const {
+    TPackedCount code = word < Grams1.size() ? Grams1[word] : TPackedCount();
+    if (!Delta.Empty()) {
+        code = AddDeltaCount(code, &word, 1);
+    }
+    return code;
+}
+
+TPackedCount TLangModel::GetGramHashCode(const TWordId* words, size_t size) const {
+    assert(size >= 1 && size <= MAX_GRAM_ORDER);
+    // unknown words and those of user dictionaries
+    for (size_t i = 0; i < size; ++i) {
+        if (words[i] >= LastWordID) {
+            return TPackedCount();
+        }
+    }
+    if (size == 1) {
+        return GetGram1HashCode(words[0]);
+    }
+    if (size > Order) {
+        return TPackedCount();
+    }
+    TPackedCount code;
+    if (size == 2 && words[0] < Gram2BlockWords && words[1] < Gram2BlockWords) {
+        code = Gram2Block[uint64_t(words[0]) * Gram2BlockWords + words[1]];
+    } else {
+        code = Ngrams->Find(words, size);
+    }
+    if (!Delta.Empty()) {
+        code = AddDeltaCount(code, words, size);
+    }
+    return code;
+}
+
+TPackedCount TLangModel::AddDeltaCount(TPackedCount code, const TWordId* words, size_t size) const {
+    TCount delta = Delta.Find(words, size);
+    if (!delta) {
+        return code;
+    }
+    return PackInt32(std::min<uint64_t>(uint64_t(Unpack(code)) + delta, MAX_PACKED_COUNT));
+}
+
+void TLangModel::GetCountsBatch(const TGramKey* keys, size_t count, TCount* counts) const {
+    std::vector<TPackedCount> codes(count);
+    GetCodesBatch(keys, count, &codes[0]);
+    for (size_t i = 0; i < count; ++i) {
+        counts[i] = Unpack(codes[i]);
+    }
+}
+
+void TLangModel::GetCodesBatch(const TGramKey* keys, size_t count, TPackedCount* codes) const {
+    std::vector<size_t> pending[MAX_GRAM_ORDER + 1];
+    for (size_t i = 0; i < count; ++i) {
+        const TGramKey& key = keys[i];
+        assert(key.Size >= 1 && key.Size <= MAX_GRAM_ORDER);
+        codes[i] = TPackedCount();
+        bool unknown = false;
+        for (size_t j = 0; j < key.Size; ++j) {
+            unknown |= key.Words[j] >= LastWordID;
+        }
+        if (unknown) {
+            continue;
+        }
+        if (key.Size == 1) {
+            codes[i] = GetGram1HashCode(key.Words[0]);
+        } else if (key.Size == 2 && key.Words[0] < Gram2BlockWords && key.Words[1] < Gram2BlockWords) {
+            codes[i] = Gram2Block[uint64_t(key.Words[0]) * Gram2BlockWords + key.Words[1]];
+        } else if (key.Size <= Order) {
+            pending[key.Size].push_back(i);
+        }
+    }
+
+    std::vector<TGramKey> batch;
+    std::vector<TPackedCount> found;
+    for (size_t order = 2; order <= MAX_GRAM_ORDER; ++order) {
+        const std::vector<size_t>& indexes = pending[order];
+        if (indexes.empty()) {
+            continue;
+        }
+        batch.clear();
+        for (size_t i: indexes) {
+            batch.push_back(keys[i]);
+        }
+        found.resize(batch.size());
+        Ngrams->FindBatch(&batch[0], batch.size(), &found[0]);
+        for (size_t i = 0; i < indexes.size(); ++i) {
+            codes[indexes[i]] = found[i];
+        }
+    }
+
+    // unigrams already got theirs from GetGram1HashCode
+    if (!Delta.Empty()) {
+        for (size_t i = 0; i < count; ++i) {
+            if (keys[i].Size > 1 && keys[i].Size <= Order) {
+                codes[i] = AddDeltaCount(codes[i], keys[i].Words, keys[i].Size);
+            }
+        }
+    }
+}
+
+TSentenceScorer::TSentenceScorer(const TLangModel& model, const TWords& sentence,
+                                 const TUserDictionary* dictionary)
+    : Model(model)
+    , Dictionary(dictionary)
+    , Sentence(sentence)
+    , Ids(sentence.size(), model.UnknownWordId)
+    , Resolved(sentence.size(), false)
 {
-    constexpr int TMP_BUF_SIZE = 128;
-    static char tmpBuff[TMP_BUF_SIZE];
-    static MemStream tmpBuffStream(tmpBuff, TMP_BUF_SIZE - 1);
-    static std::ostream out(&tmpBuffStream);
+}
 
-    tmpBuffStream.Reset();
+void TSentenceScorer::SetWord(size_t position, const TWord& word) {
+    assert(position < Sentence.size());
+    Sentence[position] = word;
+    Resolved[position] = false;
+}
 
-    NHandyPack::Dump(out, key);
+std::vector<double> TSentenceScorer::Score(size_t position, const TWords& candidates) const {
+    switch (Model.Order) {
+    case 2: return ScoreImpl<2>(position, candidates);
+    case 3: return ScoreImpl<3>(position, candidates);
+    case 4: return ScoreImpl<4>(position, candidates);
+    case 5: return ScoreImpl<5>(position, candidates);
+    }
+    assert(false && "wrong n-gram order");
+    return std::vector<double>();
+}
 
-    uint32_t bucket = ph.Hash(tmpBuff, tmpBuffStream.Size());
+const TUserDictionary* TSentenceScorer::GetDictionary() const {
+    return Dictionary;
+}
 
-    assert(bucket < ph.BucketsNumber());
-    const std::pair<uint16_t, uint16_t>& data = buckets[bucket];
+template<size_t N>
+std::vector<double> TSentenceScorer::ScoreImpl(size_t position, const TWords& candidates) const {
+    std::vector<double> scores;
+    if (position >= Sentence.size()) {
+        return scores;
+    }
+    scores.reserve(candidates.size());
+
+    size_t from = position >= N - 1 ? position - (N - 1) : 0;
+    size_t to = std::min(position + N - 1, Sentence.size() - 1);
+    size_t len = to - from + 1;
+    size_t candPos = position - from;
+
+    // window padded with unknown words, the same way TLangModel::Score does
+    TWordIds window(len + N - 1, Model.UnknownWordId);
+    for (size_t i = 0; i < len; ++i) {
+        if (i != candPos) {
+            window[i] = GetWordId(from + i);
+        }
+    }
 
-    TCount res = TCount();
-    if (data.first == CityHash16(tmpBuff, tmpBuffStream.Size())) {
-        res = UnpackInt32(data.second);
+    // terms[N * i + n] is the log probability of the (n+1)-gram starting at i
+    auto touchesCandidate = [candPos](size_t i, size_t n) {
+        return i <= candPos && i + n >= candPos;
+    };
+    size_t firstTouching = candPos >= N - 1 ? candPos - (N - 1) : 0;
+
+    // look up every n-gram of the context and of all candidates in one batch
+    TWordIds candIds;
+    candIds.reserve(candidates.size());
+    std::vector<TGramKey> keys;
+    for (size_t i = 0; i < len; ++i) {
+        for (size_t n = 0; n < N; ++n) {
+            if (!touchesCandidate(i, n)) {
+                AddKeys(window, i, n, keys);
+            }
+        }
+    }
+    for (auto&& cand: candidates) {
+        candIds.push_back(GetWordId(cand));
+        window[candPos] = candIds.back();
+        for (size_t i = firstTouching; i <= candPos; ++i) {
+            for (size_t n = candPos - i; n < N; ++n) {
+                AddKeys(window, i, n, keys);
+            }
+        }
+    }
+    FetchCodes(keys);
+
+    std::vector<double> terms(N * len);
+    for (size_t i = 0; i < len; ++i) {
+        for (size_t n = 0; n < N; ++n) {
+            if (!touchesCandidate(i, n)) {
+                terms[N * i + n] = GetTerm(window, i, n);
+            }
+        }
     }
-    return res;
+
+    for (TWordId candId: candIds) {
+        window[candPos] = candId;
+        for (size_t i = firstTouching; i <= candPos; ++i) {
+            for (size_t n = candPos - i; n < N; ++n) {
+                terms[N * i + n] = GetTerm(window, i, n);
+            }
+        }
+        double result = 0;
+        for (auto&& t: terms) {
+            result += t;
+        }
+        scores.push_back(result);
+    }
+    return scores;
+}
+
+TWordId TSentenceScorer::GetWordId(size_t position) const {
+    if (!Resolved[position]) {
+        Ids[position] = GetWordId(Sentence[position]);
+        Resolved[position] = true;
+    }
+    return Ids[position];
+}
+
+TWordId TSentenceScorer::GetWordId(const TWord& word) const {
+    TWordId wid = Model.GetWordIdNoCreate(word);
+    if (wid == Model.UnknownWordId && Dictionary) {
+        wid = Dictionary->GetWordId(word);
+    }
+    return wid;
 }
 
-TCount TLangModel::GetGram1HashCount(TWordId word) const {
-    if (word == UnknownWordId) {
-        return TCount();
+TPackedCount TSentenceScorer::AddDictionaryCount(TPackedCount code, const TWordId* words, size_t size) const {
+    TCount count = Dictionary->GetCount(words, size);
+    if (!count) {
+        return code;
     }
-    TGram1Key key = word;
-    return GetGramHashCount(key, PerfectHash, Buckets);
+    return PackInt32(std::min<uint64_t>(uint64_t(Unpack(code)) + count, MAX_PACKED_COUNT));
 }
 
-TCount TLangModel::GetGram2HashCount(TWordId word1, TWordId word2) const {
-    if (word1 == UnknownWordId || word2 == UnknownWordId) {
-        return TCount();
+TPackedCount TSentenceScorer::GetCode(const TWordId* words, size_t size) const {
+    if (size == 1) {
+        TPackedCount code = Model.GetGram1HashCode(words[0]);
+        return Dictionary ? AddDictionaryCount(code, words, size) : code;
+    }
+    TGramKey key(words, size);
+    auto it = Codes.find(key);
+    if (it != Codes.end()) {
+        return it->second;
+    }
+    TPackedCount code = Model.GetGramHashCode(words, size);
+    if (Dictionary) {
+        code = AddDictionaryCount(code, words, size);
+    }
+    Codes[key] = code;
+    return code;
+}
+
+void TSentenceScorer::AddKeys(const TWordIds& window, size_t i, size_t n, std::vector<TGramKey>& keys) const {
+    for (size_t size = 2; size <= n + 1; ++size) {
+        keys.push_back(TGramKey(&window[i], size));
+    }
+}
+
+void TSentenceScorer::FetchCodes(const std::vector<TGramKey>& keys) const {
+    std::vector<TGramKey> missing;
+    for (auto&& key: keys) {
+        if (Codes.insert(std::make_pair(key, TPackedCount())).second) {
+            missing.push_back(key);
+        }
+    }
+    if (missing.empty()) {
+        return;
+    }
+    std::vector<TPackedCount> codes(missing.size());
+    Model.GetCodesBatch(&missing[0], missing.size(), &codes[0]);
+    for (size_t i = 0; i < missing.size(); ++i) {
+        if (Dictionary) {
+            codes[i] = AddDictionaryCount(codes[i], missing[i].Words, missing[i].Size);
+        }
+        Codes[missing[i]] = codes[i];
     }
-    TGram2Key key({word1, word2});
-    return GetGramHashCount(key, PerfectHash, Buckets);
 }
 
-TCount TLangModel::GetGram3HashCount(TWordId word1, TWordId word2, TWordId word3) const {
-    if (word1 == UnknownWordId || word2 == UnknownWordId || word3 == UnknownWordId) {
-        return TCount();
+double TSentenceScorer::GetTerm(const TWordIds& window, size_t i, size_t n) const {
+    if (n == 0) {
+        return Model.GetGram1LogProb(GetCode(&window[i], 1));
     }
-    TGram3Key key(word1, word2, word3);
-    return GetGramHashCount(key, PerfectHash, Buckets);
+    return Model.GetGramLogProb(GetCode(&window[i], n), GetCode(&window[i], n + 1));
 }
 
 } // NJamSpell
@@ -9,39 +9,62 @@
 #include <contrib/handypack/handypack.hpp>
 #include <contrib/tsl/robin_map.h>
 #include "utils.hpp"
-#include "perfect_hash.hpp"
+#include "ngram_store.hpp"
+#include "ngram_counts.hpp"
+#include "checkpoint.hpp"
+#include "model_container.hpp"
+#include "vocab_index.hpp"
 
 
 namespace NJamSpell {
 
 
 constexpr uint64_t LANG_MODEL_MAGIC_BYTE = 8559322735408079685L;
-constexpr uint16_t LANG_MODEL_VERSION = 9;
+constexpr uint16_t LANG_MODEL_VERSION = 17;
+constexpr uint16_t LANG_MODEL_STREAM_VERSION = 16; // all fields in a single stream, no sections
+constexpr uint16_t LANG_MODEL_LEGACY_VERSION = 9; // unigrams stored in the perfect hash
 constexpr double LANG_MODEL_DEFAULT_K = 0.05;
 
-using TWordId = uint32_t;
-using TCount = uint32_t;
-
-using TGram1Key = TWordId;
-using TGram2Key = std::pair<TWordId, TWordId>;
-using TGram3Key = std::tuple<TWordId, TWordId, TWordId>;
 using TWordIds = std::vector<TWordId>;
 using TIdSentences = std::vector<TWordIds>;
 
-struct TGram2KeyHash {
-public:
-  std::size_t operator()(const TGram2Key& x) const {
-      return (size_t)x.first ^ ((size_t)x.second << 16);
-  }
+struct TTrainOptions {
+    int MinWordFreq = 0;
+    // Longest n-gram counted, MIN_GRAM_ORDER to MAX_GRAM_ORDER
+    uint32_t Order = DEFAULT_GRAM_ORDER;
+    // Bigrams between the BigramBlockWords most frequent words are stored
+    // in a dense matrix instead of the perfect hash (0 disables it)
+    TWordId BigramBlockWords = 0;
+    uint64_t BigramBlockMaxBytes = 64ULL << 20;
+    // Memory for a count-min sketch pre-pass: n-grams that can not reach
+    // MinWordFreq are skipped while counting (0 disables it)
+    uint64_t CountSketchBytes = 0;
+    ENgramStoreType NgramStore = NS_PERFECT_HASH;
+    // Serialized model size limit, n-grams of orders 2 and up that add the
+    // least information are pruned to meet it (0 disables it)
+    uint64_t MaxModelBytes = 0;
+    // Share of sentences, in percent, kept out of training to report the
+    // score perplexity of the model on, see GetScorePerplexity
+    uint32_t HeldOutPercent = 0;
+    // Fingerprint and count bit widths of the perfect hash buckets
+    EBucketLayout BucketLayout = BL_16_16;
+    TPerfectHashOptions PerfectHash;
+    // Training state is saved to files starting with this prefix after the
+    // expensive phases (empty disables checkpoints)
+    std::string CheckpointPrefix;
+    // Continues from the checkpoints of an interrupted run with the same
+    // input and options
+    bool Resume = false;
 };
 
-struct TGram3KeyHash {
-public:
-  std::size_t operator()(const TGram3Key& x) const {
-    return (size_t)std::get<0>(x) ^
-            ((size_t)std::get<1>(x) << 16) ^
-            ((size_t)std::get<2>(x) << 32);
-  }
+// Exact n-gram counts a model is built from
+struct TTrainCounts {
+    std::unordered_map<TGram1Key, TCount> Grams1;
+    TGramCounts<2> Grams2;
+    TGramCounts<3> Grams3;
+    TGramCounts<4> Grams4;
+    TGramCounts<5> Grams5;
+    static_assert(MAX_GRAM_ORDER == 5, "count maps should cover every order");
 };
 
 class TRobinSerializer: public NHandyPack::TUnorderedMapSerializer<tsl::robin_map<std::wstring, TWordId>, std::wstring, TWordId> {};
@@ -55,56 +78,228 @@ public:
     }
 };
 
+// Figures of a model, as reported by the inspect mode
+struct TModelStats {
+    uint32_t Order = 0;
+    uint64_t VocabWords = 0;
+    uint64_t TotalWords = 0;
+    // Distinct n-grams by order, index n. N-grams of the store are counted
+    // when it is built, for files saved before only the unigrams and the
+    // dense block are.
+    std::vector<uint64_t> NgramsByOrder;
+    bool StoreNgramsCounted = false;
+    uint64_t DenseBigrams = 0; // of the bigrams, the ones in the dense block
+    ENgramStoreType NgramStore = NS_PERFECT_HASH;
+    // Perfect hash stores only
+    EPerfectHashBackend PerfectHashBackend = PHB_PHF;
+    EBucketLayout BucketLayout = BL_16_16;
+    EFingerprintType FingerprintType = FT_PERFECT_HASH;
+    uint64_t Buckets = 0;
+    uint64_t FilledBuckets = 0;
+    // Expected share of lookups of unseen n-grams that get a false count
+    double FingerprintFalsePositiveRate = 0.0;
+};
+
+// How TLangModel turns n-gram counts into log probabilities
+enum class EScoringMode {
+    Exact,      // log() of every probability, as computed from unpacked counts
+    LogTables,  // float log tables indexed by packed counts, no log() calls
+};
+
+class TLangModel;
+class TUserDictionary;
+
+// Scores candidate windows of a single sentence. Context word ids are
+// resolved once per sentence and n-gram counts are memoized, so ranking
+// candidates only computes the terms that touch the candidate position.
+// Counts of a user dictionary, when given, are added to those of the model.
+class TSentenceScorer {
+public:
+    TSentenceScorer(const TLangModel& model, const TWords& sentence,
+                    const TUserDictionary* dictionary = nullptr);
+    void SetWord(size_t position, const TWord& word);
+    // Same results as TLangModel::Score on the window of up to order - 1
+    // words around position, with the candidate placed at position
+    std::vector<double> Score(size_t position, const TWords& candidates) const;
+    const TUserDictionary* GetDictionary() const;
+private:
+    template<size_t N>
+    std::vector<double> ScoreImpl(size_t position, const TWords& candidates) const;
+    TWordId GetWordId(size_t position) const;
+    TWordId GetWordId(const TWord& word) const;
+    TPackedCount AddDictionaryCount(TPackedCount code, const TWordId* words, size_t size) const;
+    TPackedCount GetCode(const TWordId* words, size_t size) const;
+    double GetTerm(const TWordIds& window, size_t i, size_t n) const;
+    void AddKeys(const TWordIds& window, size_t i, size_t n, std::vector<TGramKey>& keys) const;
+    void FetchCodes(const std::vector<TGramKey>& keys) const;
+private:
+    const TLangModel& Model;
+    const TUserDictionary* Dictionary;
+    TWords Sentence;
+    mutable TWordIds Ids;
+    mutable std::vector<bool> Resolved;
+    mutable std::unordered_map<TGramKey, TPackedCount, TGramKeyHash> Codes;
+};
+
 class TLangModel {
+    friend class TSentenceScorer;
 public:
     bool Train(const std::string& fileName, const std::string& alphabetFile, const int& minWordFreq=0);
+    bool Train(const std::string& fileName, const std::string& alphabetFile, const TTrainOptions& options);
+    // Builds the model from the output of the count and merge stages
+    bool Train(const TNgramCounts& counts, const TTrainOptions& options);
     bool FinetuneVocab(const std::string vocabFileName, const std::string& alphabetFile);
+    // Adds the counts of new text, as made by the count stage, on top of the
+    // model. Unknown words get new ids once their counts summed over the
+    // updates reach the minimal word frequency of the model, like a rebuild
+    // with the counts would keep them. Not safe while other threads score,
+    // and the model can not be dumped until it is rebuilt with the counts.
+    bool AddDelta(const TNgramCounts& counts);
+    size_t GetDeltaSize() const;
+    void Swap(TLangModel& other);
+    // Rebuilds the model without the words removed from its vocabulary and
+    // the n-grams that contain them, renumbering the rest. Perfect hash
+    // models keep no n-gram keys, so they are rebuilt from the counts they
+    // were trained from; trie models from their own n-grams.
+    bool Compact(const TTrainOptions& options, const TNgramCounts* counts = nullptr);
+    // Options that build a store like the current one, with the word
+    // frequency threshold and size budget the model was trained with
+    void GetStoreOptions(TTrainOptions& options) const;
     double Score(const TWords& words) const;
     double Score(const std::wstring& str) const;
     TWord GetWord(const std::wstring& word) const;
     const std::unordered_set<wchar_t>& GetAlphabet() const;
     TSentences Tokenize(const std::wstring& text) const;
 
-    bool Dump(const std::string& modelFileName) const;
+    // Compressed files are smaller to ship and store, and take a decoding
+    // pass at load
+    bool Dump(const std::string& modelFileName, bool compressed = false) const;
     bool DumpVocab(const std::string& modelVocabFileName, const std::string& modelVocabFreqFileName) const;
     bool Load(const std::string& modelFileName);
+    // Loads the model sections of a container, leaving others to their readers
+    bool Load(const TModelContainer& container);
+    // Adds the model sections to a file being written
+    void AddSections(TModelWriter& writer, bool compressed = false) const;
     void Clear();
 
     const TRobinHash& GetWordToId();
+    // Calls f(word, id) for every word of the vocabulary, in id order for
+    // loaded models; unlike GetWordToId it leaves the vocabulary frozen
+    template<class TFunc>
+    void ForEachWord(TFunc&& f) const {
+        if (!Vocab.Empty()) {
+            for (TWordId wid = 0; wid < Vocab.Size(); ++wid) {
+                TWord word = Vocab.GetWord(wid);
+                if (word.Ptr && word.Len) {
+                    f(word, wid);
+                }
+            }
+            return;
+        }
+        for (auto&& it: WordToId) {
+            f(TWord(it.first), it.second);
+        }
+    }
 
     TWordId GetWordId(const TWord& word);
     TWordId GetWordIdNoCreate(const TWord& word) const;
     TWord GetWordById(TWordId wid) const;
     TCount GetWordCount(TWordId wid) const;
+    // Looks up counts of many n-grams at once, overlapping their cache misses
+    void GetCountsBatch(const TGramKey* keys, size_t count, TCount* counts) const;
+
+    void SetScoringMode(EScoringMode mode);
+    EScoringMode GetScoringMode() const;
 
     uint64_t GetCheckSum() const;
+    size_t GetOrder() const;
+    // Minimal word frequency the model was trained with, 0 if unknown
+    int GetMinWordFreq() const;
+    TModelStats GetStats() const;
+    // Vocabulary (hash table and string heap, or the frozen index), counts
+    // of every order, delta counts and log tables
+    TMemoryUsage MemoryUsage() const;
+    // Applies memory options to the arrays looked up while scoring: the
+    // vocabulary index, unigrams, the dense bigram block and the n-gram store
+    bool AdviseMemory(const TMemoryOptions& options) const;
 
-    HANDYPACK(WordToId, LastWordID, TotalWords, VocabSize,
-              PerfectHash, Buckets, Tokenizer, CheckSum)
+    HANDYPACK(Order, WordToId, LastWordID, TotalWords, VocabSize,
+              Grams1, Gram2BlockWords, Gram2Block,
+              Ngrams, Tokenizer, CheckSum)
 private:
     TIdSentences ConvertToIds(const TSentences& sentences);
+    void InitializeGram2Block(TGramCounts<2>& grams2,
+                              const TTrainOptions& options);
+    void RenumberByFrequency(std::unordered_map<TGram1Key, TCount>& grams1, TIdSentences& sentences);
     void RemoveLowFreqWord(const std::unordered_map<TGram1Key, TCount>& grams1, const int& minWordFreq);
+    bool CountText(const std::string& fileName, const std::string& alphabetFile, const TTrainOptions& options,
+                   std::vector<std::vector<std::wstring>>& heldOut, TTrainCounts& counts);
+    // Drops rare words and n-grams, fills unigrams and the bigram block and
+    // moves the remaining n-grams to grams
+    void PrepareCounts(TTrainCounts& counts, const TTrainOptions& options, TGramCountList& grams);
+    bool BuildFromCounts(TGramCountList& grams, const TTrainOptions& options, const TCheckpoints& checkpoints);
+    bool BuildNgramStore(const TGramCountList& grams, const TTrainOptions& options,
+                         const TCheckpoints* checkpoints = nullptr);
+    // Vocabulary and unigrams, the part of the model built before n-grams
+    void DumpTrainState(std::ostream& out) const;
+    void LoadTrainState(std::istream& in);
+    bool PruneToBudget(TGramCountList& grams, const TTrainOptions& options);
+    std::vector<size_t> RankByRelativeEntropy(const TGramCountList& grams) const;
+    uint64_t GetSerializedSize() const;
+    // Not a per-token perplexity, see the definition
+    double GetScorePerplexity(const std::vector<std::vector<std::wstring>>& sentences) const;
 
-    double GetGram1Prob(TWordId word) const;
-    double GetGram2Prob(TWordId word1, TWordId word2) const;
-    double GetGram3Prob(TWordId word1, TWordId word2, TWordId word3) const;
+    template<size_t N>
+    double ScoreImpl(const TWordIds& sentence) const;
 
-    TCount GetGram1HashCount(TWordId word) const;
-    TCount GetGram2HashCount(TWordId word1, TWordId word2) const;
-    TCount GetGram3HashCount(TWordId word1, TWordId word2, TWordId word3) const;
+    double GetGram1LogProb(TPackedCount codeGram1) const;
+    // Log probability of an n-gram given its (n-1)-gram prefix
+    double GetGramLogProb(TPackedCount codePrefix, TPackedCount codeGram) const;
+
+    double GetGram1Prob(TCount countsGram1) const;
+    double GetGramProb(TCount countsPrefix, TCount countsGram) const;
+
+    TPackedCount GetGram1HashCode(TWordId word) const;
+    TPackedCount GetGramHashCode(const TWordId* words, size_t size) const;
+    TPackedCount AddDeltaCount(TPackedCount code, const TWordId* words, size_t size) const;
+    void GetCodesBatch(const TGramKey* keys, size_t count, TPackedCount* codes) const;
+
+    void UpdateLogTables();
+    void LoadLegacy(std::istream& in);
+    bool LoadVocab(const TModelContainer& container);
+    void FinishLoad();
+    // Moves the vocabulary from the read-only index to the hash map before
+    // it is changed
+    void ThawVocab();
+
+public:
+    // Id of words missing in the vocabulary, as returned by GetWordIdNoCreate
+    static constexpr TWordId UnknownWordId = std::numeric_limits<TWordId>::max();
 
 private:
-    const TWordId UnknownWordId = std::numeric_limits<TWordId>::max();
+    uint8_t Order = DEFAULT_GRAM_ORDER;
     double K = LANG_MODEL_DEFAULT_K;
     TRobinHash WordToId;
     std::vector<std::wstring> IdToWord;
+    TVocabIndex Vocab; // vocabulary of loaded models until it changes, WordToId and IdToWord are empty meanwhile
     TWordId LastWordID = 0;
     TWordId TotalWords = 0;
     TWordId VocabSize = 0;
     TTokenizer Tokenizer;
-    std::vector<std::pair<uint16_t, uint16_t>> Buckets;
-    TPerfectHash PerfectHash;
+    std::vector<TPackedCount> Grams1; // indexed by word id, kept out of the perfect hash
+    TWordId Gram2BlockWords = 0;
+    std::vector<TPackedCount> Gram2Block; // word1 * Gram2BlockWords + word2, for both ids below Gram2BlockWords
+    TNgramStorage Ngrams; // n-grams of orders 2 to Order outside of the dense block
+    TNgramDelta Delta; // counts added by AddDelta, summed with the ones above
+    std::unordered_map<std::wstring, TCount> PendingDeltaWords; // new words of AddDelta below MinWordFreq, with their counts
+    int MinWordFreq = 0; // the model was trained with, applied to words of AddDelta
+    uint64_t MaxModelBytes = 0; // the model was trained with, applied again by Compact
+    std::vector<uint64_t> StoreNgramsByOrder; // n-grams in Ngrams by order, index n, empty if unknown
     uint64_t CheckSum;
+    EScoringMode ScoringMode = EScoringMode::Exact;
+    std::vector<float> LogGram1Table;
+    std::vector<float> LogNumeratorTable;
+    std::vector<float> LogDenominatorTable;
 };
 
 
@@ -0,0 +1,195 @@
+#include <algorithm>
+
+#include <contrib/cityhash/city.h>
+
+#include "model_container.hpp"
+
+namespace NJamSpell {
+
+// Passes the bytes of a section on to the file, hashing them in chunks of
+// SECTION_HASH_CHUNK bytes like TModelContainer::CheckSection reads them
+class TSectionWriter: public std::streambuf {
+public:
+    explicit TSectionWriter(std::ostream& out)
+        : Out(out)
+        , Chunk(SECTION_HASH_CHUNK)
+    {
+        setp(&Chunk[0], &Chunk[0] + Chunk.size());
+    }
+    // Writes the last chunk out, returns the hash of all the bytes
+    uint64_t Finish() {
+        WriteChunk();
+        return Hash;
+    }
+    uint64_t GetSize() const {
+        return Size;
+    }
+protected:
+    int_type overflow(int_type c) override {
+        WriteChunk();
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+private:
+    void WriteChunk() {
+        size_t size = pptr() - pbase();
+        if (size) {
+            Hash = CityHash64WithSeed(pbase(), size, Hash);
+            Out.write(pbase(), size);
+            Size += size;
+        }
+        setp(&Chunk[0], &Chunk[0] + Chunk.size());
+    }
+private:
+    std::ostream& Out;
+    std::vector<char> Chunk;
+    uint64_t Hash = 0;
+    uint64_t Size = 0;
+};
+
+void TModelWriter::AddSection(const std::string& name, const std::function<void(std::ostream&)>& dump) {
+    Sections.push_back(std::make_pair(name, dump));
+}
+
+bool TModelWriter::Save(const std::string& fileName, uint64_t magicByte, uint16_t version) const {
+    std::ofstream out(fileName, std::ios::binary);
+    if (!out.is_open()) {
+        return false;
+    }
+    std::vector<TModelSection> toc = GetEmptyToc();
+    // the table of contents has a fixed size, it is written again once
+    // offsets and hashes are known
+    NHandyPack::Dump(out, magicByte, version, toc);
+    for (size_t i = 0; i < Sections.size(); ++i) {
+        toc[i].Offset = out.tellp();
+        TSectionWriter writer(out);
+        std::ostream sectionOut(&writer);
+        Sections[i].second(sectionOut);
+        toc[i].Hash = writer.Finish();
+        toc[i].Length = writer.GetSize();
+    }
+    NHandyPack::Dump(out, magicByte);
+    out.seekp(0);
+    NHandyPack::Dump(out, magicByte, version, toc);
+    out.close();
+    return !out.fail();
+}
+
+uint64_t TModelWriter::GetByteSize(uint64_t magicByte, uint16_t version) const {
+    TByteCounter counter;
+    std::ostream out(&counter);
+    NHandyPack::Dump(out, magicByte, version, GetEmptyToc());
+    for (auto&& section: Sections) {
+        section.second(out);
+    }
+    NHandyPack::Dump(out, magicByte);
+    return counter.Size;
+}
+
+std::vector<TModelSection> TModelWriter::GetEmptyToc() const {
+    std::vector<TModelSection> toc(Sections.size());
+    for (size_t i = 0; i < Sections.size(); ++i) {
+        toc[i].Name = Sections[i].first;
+    }
+    return toc;
+}
+
+bool TModelContainer::Open(const std::string& fileName, uint64_t magicByte, uint16_t version) {
+    In.close();
+    In.clear();
+    Sections.clear();
+    In.open(fileName, std::ios::binary | std::ios::ate);
+    if (!In.is_open()) {
+        return false;
+    }
+    uint64_t fileSize = In.tellg();
+    In.seekg(0);
+    uint64_t fileMagicByte = 0;
+    uint16_t fileVersion = 0;
+    NHandyPack::Load(In, fileMagicByte, fileVersion);
+    if (!In.good() || fileMagicByte != magicByte || fileVersion != version) {
+        return false;
+    }
+    NHandyPack::Load(In, Sections);
+    if (!In.good()) {
+        Sections.clear();
+        return false;
+    }
+    uint64_t tocEnd = In.tellg();
+    for (auto&& section: Sections) {
+        if (section.Offset < tocEnd || section.Offset + section.Length + sizeof(magicByte) > fileSize) {
+            std::cerr << "[error] model section " << section.Name << " is out of the file" << std::endl;
+            Sections.clear();
+            return false;
+        }
+    }
+    FileName = fileName;
+    return true;
+}
+
+bool TModelContainer::HasSection(const std::string& name) const {
+    return FindSection(name) != nullptr;
+}
+
+bool TModelContainer::LoadSection(const std::string& name, const std::function<void(std::istream&)>& load) const {
+    const TModelSection* section = FindSection(name);
+    if (!section) {
+        std::cerr << "[error] model has no section " << name << std::endl;
+        return false;
+    }
+    if (!CheckSection(*section)) {
+        return false;
+    }
+    In.clear();
+    In.seekg(section->Offset);
+    load(In);
+    if (In.fail() || uint64_t(In.tellg()) > section->Offset + section->Length) {
+        std::cerr << "[error] failed to load model section " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+const std::vector<TModelSection>& TModelContainer::GetSections() const {
+    return Sections;
+}
+
+const std::string& TModelContainer::GetFileName() const {
+    return FileName;
+}
+
+bool TModelContainer::CheckSection(const TModelSection& section) const {
+    In.clear();
+    In.seekg(section.Offset);
+    std::vector<char> chunk(std::min<uint64_t>(SECTION_HASH_CHUNK, section.Length));
+    uint64_t hash = 0;
+    for (uint64_t left = section.Length; left > 0; ) {
+        size_t size = std::min<uint64_t>(chunk.size(), left);
+        In.read(&chunk[0], size);
+        if (!In.good()) {
+            std::cerr << "[error] failed to read model section " << section.Name << std::endl;
+            return false;
+        }
+        hash = CityHash64WithSeed(&chunk[0], size, hash);
+        left -= size;
+    }
+    if (hash != section.Hash) {
+        std::cerr << "[error] model section " << section.Name << " is corrupted" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+const TModelSection* TModelContainer::FindSection(const std::string& name) const {
+    for (auto&& section: Sections) {
+        if (section.Name == name) {
+            return &section;
+        }
+    }
+    return nullptr;
+}
+
+} // NJamSpell
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <fstream>
+#include <cstdint>
+
+#include <contrib/handypack/handypack.hpp>
+
+namespace NJamSpell {
+
+// Counts the bytes written to it without storing them
+class TByteCounter: public std::streambuf {
+public:
+    uint64_t Size = 0;
+protected:
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        Size += count;
+        return count;
+    }
+    int_type overflow(int_type c) override {
+        if (c != traits_type::eof()) {
+            Size += 1;
+        }
+        return traits_type::not_eof(c);
+    }
+};
+
+constexpr size_t SECTION_HASH_CHUNK = 1 << 20;
+
+struct TModelSection {
+    std::string Name;
+    uint64_t Offset = 0;  // from the start of the file
+    uint64_t Length = 0;
+    uint64_t Hash = 0;    // of the section bytes, CityHash64WithSeed chained over SECTION_HASH_CHUNK blocks
+
+    HANDYPACK(Name, Offset, Length, Hash)
+};
+
+// Writes a file of named sections: magic, version, the table of contents
+// with offset, length and content hash of every section, the sections
+// themselves and the magic again. Sections are serialized straight into
+// the file and hashed on the way, holding one hash chunk in memory.
+class TModelWriter {
+public:
+    void AddSection(const std::string& name, const std::function<void(std::ostream&)>& dump);
+    bool Save(const std::string& fileName, uint64_t magicByte, uint16_t version) const;
+    // Size of the file Save would write, without keeping any of it
+    uint64_t GetByteSize(uint64_t magicByte, uint16_t version) const;
+private:
+    std::vector<TModelSection> GetEmptyToc() const;
+private:
+    std::vector<std::pair<std::string, std::function<void(std::ostream&)>>> Sections;
+};
+
+// Reads the table of contents of a file made by TModelWriter; sections are
+// read when asked for. A section is hashed in chunks first, then parsed
+// straight from the file, so it is never held in memory twice.
+class TModelContainer {
+public:
+    // False for files of other formats and versions
+    bool Open(const std::string& fileName, uint64_t magicByte, uint16_t version);
+    bool HasSection(const std::string& name) const;
+    bool LoadSection(const std::string& name, const std::function<void(std::istream&)>& load) const;
+    const std::vector<TModelSection>& GetSections() const;
+    const std::string& GetFileName() const;
+private:
+    const TModelSection* FindSection(const std::string& name) const;
+    // Reads the section in chunks and compares its hash with the table
+    bool CheckSection(const TModelSection& section) const;
+private:
+    std::string FileName;
+    std::vector<TModelSection> Sections;
+    mutable std::ifstream In;
+};
+
+} // NJamSpell
@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <memory>
+#include <limits>
+#include <unordered_map>
+#include <cassert>
+
+#include "ngram_counts.hpp"
+
+namespace NJamSpell {
+
+// Reads a count file sequentially, one n-gram at a time
+class TCountsReader {
+public:
+    bool Open(const std::string& fileName, TNgramCounts& header) {
+        In.open(fileName, std::ios::binary);
+        if (!In.is_open()) {
+            return false;
+        }
+        uint64_t magicByte = 0;
+        uint16_t version = 0;
+        NHandyPack::Load(In, magicByte, version);
+        if (magicByte != NGRAM_COUNTS_MAGIC_BYTE || version != NGRAM_COUNTS_VERSION) {
+            return false;
+        }
+        NHandyPack::Load(In, header.Order, header.Tokenizer, header.TotalWords,
+                         header.Words, header.WordCounts);
+        return In.good() && header.Order >= MIN_GRAM_ORDER && header.Order <= MAX_GRAM_ORDER &&
+               header.Words.size() == header.WordCounts.size();
+    }
+
+    bool BeginTable(size_t size) {
+        Size = size;
+        NHandyPack::Load(In, Left);
+        return In.good();
+    }
+
+    // Returns false at the end of the table
+    bool Next(TGramKey& key, TCount& count) {
+        if (!Left) {
+            return false;
+        }
+        key.Size = Size;
+        In.read((char*)key.Words, Size * sizeof(TWordId));
+        In.read((char*)&count, sizeof(TCount));
+        Left -= 1;
+        return In.good();
+    }
+
+    bool Finish() {
+        uint64_t magicByte = 0;
+        NHandyPack::Load(In, magicByte);
+        return In.good() && magicByte == NGRAM_COUNTS_MAGIC_BYTE;
+    }
+
+private:
+    std::ifstream In;
+    size_t Size = 0;
+    uint64_t Left = 0;
+};
+
+// Writes a count file; the number of n-grams of every table is patched in
+// once the table is complete
+class TCountsWriter {
+public:
+    bool Open(const std::string& fileName, const TNgramCounts& header) {
+        Out.open(fileName, std::ios::binary);
+        if (!Out.is_open()) {
+            return false;
+        }
+        NHandyPack::Dump(Out, NGRAM_COUNTS_MAGIC_BYTE, NGRAM_COUNTS_VERSION);
+        NHandyPack::Dump(Out, header.Order, header.Tokenizer, header.TotalWords,
+                         header.Words, header.WordCounts);
+        return Out.good();
+    }
+
+    void BeginTable() {
+        TablePos = Out.tellp();
+        Written = 0;
+        NHandyPack::Dump(Out, Written);
+    }
+
+    void Add(const TWordId* words, size_t size, TCount count) {
+        Out.write((const char*)words, size * sizeof(TWordId));
+        Out.write((const char*)&count, sizeof(TCount));
+        Written += 1;
+    }
+
+    void EndTable() {
+        std::streampos end = Out.tellp();
+        Out.seekp(TablePos);
+        NHandyPack::Dump(Out, Written);
+        Out.seekp(end);
+    }
+
+    bool Finish() {
+        NHandyPack::Dump(Out, NGRAM_COUNTS_MAGIC_BYTE);
+        Out.close();
+        return !Out.fail();
+    }
+
+private:
+    std::ofstream Out;
+    std::streampos TablePos;
+    uint64_t Written = 0;
+};
+
+// Sums of counts of several shards stop at the largest count
+static inline TCount SaturateCount(uint64_t count) {
+    return TCount(std::min<uint64_t>(count, std::numeric_limits<TCount>::max()));
+}
+
+template<size_t N>
+static void FillTable(const TGramCounts<N>& grams, const std::vector<TWordId>& newIds, TGramTable& table) {
+    std::vector<std::pair<TGramWords<N>, TCount>> sorted;
+    sorted.reserve(grams.size());
+    for (auto&& it: grams) {
+        TGramWords<N> key;
+        for (size_t i = 0; i < N; ++i) {
+            key[i] = newIds[it.first[i]];
+        }
+        sorted.push_back(std::make_pair(key, it.second));
+    }
+    std::sort(sorted.begin(), sorted.end());
+    table.Words.reserve(sorted.size() * N);
+    table.Counts.reserve(sorted.size());
+    for (auto&& it: sorted) {
+        table.Words.insert(table.Words.end(), it.first.begin(), it.first.end());
+        table.Counts.push_back(it.second);
+    }
+}
+
+bool TNgramCounts::Count(const std::string& textFile, const std::string& alphabetFile, uint32_t order) {
+    if (order < MIN_GRAM_ORDER || order > MAX_GRAM_ORDER) {
+        std::cerr << "[error] n-gram order should be from " << MIN_GRAM_ORDER
+                  << " to " << MAX_GRAM_ORDER << std::endl;
+        return false;
+    }
+    Order = order;
+    if (!Tokenizer.LoadAlphabet(alphabetFile)) {
+        std::cerr << "[error] failed to load alphabet" << std::endl;
+        return false;
+    }
+
+    std::cerr << "[info] loading text" << std::endl;
+    std::vector<std::vector<TWordId>> sentenceIds;
+    std::unordered_map<std::wstring, TWordId> wordIds;
+    Words.clear();
+    WordCounts.clear();
+    TotalWords = 0;
+    {
+        std::wstring text = UTF8ToWide(LoadFile(textFile));
+        ToLower(text);
+        TSentences sentences = Tokenizer.Process(text);
+        for (auto&& sentence: sentences) {
+            sentenceIds.emplace_back();
+            for (auto&& w: sentence) {
+                auto it = wordIds.insert(std::make_pair(std::wstring(w.Ptr, w.Len), TWordId(Words.size())));
+                if (it.second) {
+                    Words.push_back(it.first->first);
+                    WordCounts.push_back(0);
+                }
+                WordCounts[it.first->second] += 1;
+                sentenceIds.back().push_back(it.first->second);
+                TotalWords += 1;
+            }
+        }
+    }
+    if (sentenceIds.empty()) {
+        std::cerr << "[error] no sentences" << std::endl;
+        return false;
+    }
+
+    std::cerr << "[info] counting N-grams, " << sentenceIds.size() << " sentences" << std::endl;
+    TGramCounts<2> grams2;
+    TGramCounts<3> grams3;
+    TGramCounts<4> grams4;
+    TGramCounts<5> grams5;
+    static_assert(MAX_GRAM_ORDER == 5, "count maps should cover every order");
+    for (auto&& words: sentenceIds) {
+        CountNgrams(words, grams2);
+        if (Order >= 3) {
+            CountNgrams(words, grams3);
+        }
+        if (Order >= 4) {
+            CountNgrams(words, grams4);
+        }
+        if (Order >= 5) {
+            CountNgrams(words, grams5);
+        }
+    }
+
+    // renumber words in lexicographic order
+    std::vector<TWordId> sortedIds(Words.size());
+    for (TWordId wid = 0; wid < sortedIds.size(); ++wid) {
+        sortedIds[wid] = wid;
+    }
+    std::sort(sortedIds.begin(), sortedIds.end(), [this](TWordId a, TWordId b) {
+        return Words[a] < Words[b];
+    });
+    std::vector<TWordId> newIds(Words.size());
+    std::vector<std::wstring> words(Words.size());
+    std::vector<TCount> wordCounts(Words.size());
+    for (TWordId wid = 0; wid < sortedIds.size(); ++wid) {
+        newIds[sortedIds[wid]] = wid;
+        words[wid].swap(Words[sortedIds[wid]]);
+        wordCounts[wid] = WordCounts[sortedIds[wid]];
+    }
+    Words.swap(words);
+    WordCounts.swap(wordCounts);
+
+    Tables.assign(Order - 1, TGramTable());
+    FillTable(grams2, newIds, Tables[0]);
+    if (Order >= 3) {
+        FillTable(grams3, newIds, Tables[1]);
+    }
+    if (Order >= 4) {
+        FillTable(grams4, newIds, Tables[2]);
+    }
+    if (Order >= 5) {
+        FillTable(grams5, newIds, Tables[3]);
+    }
+
+    std::cerr << "[info] words: " << Words.size() << ", total: " << TotalWords;
+    for (size_t n = MIN_GRAM_ORDER; n <= Order; ++n) {
+        std::cerr << ", ngrams" << n << ": " << Tables[n - 2].Counts.size();
+    }
+    std::cerr << std::endl;
+    return true;
+}
+
+bool TNgramCounts::Dump(const std::string& fileName) const {
+    assert(Tables.size() + 1 == Order);
+    TCountsWriter writer;
+    if (!writer.Open(fileName, *this)) {
+        return false;
+    }
+    for (size_t n = MIN_GRAM_ORDER; n <= Order; ++n) {
+        const TGramTable& table = Tables[n - 2];
+        writer.BeginTable();
+        for (size_t i = 0; i < table.Counts.size(); ++i) {
+            writer.Add(&table.Words[i * n], n, table.Counts[i]);
+        }
+        writer.EndTable();
+    }
+    return writer.Finish();
+}
+
+bool TNgramCounts::Load(const std::string& fileName) {
+    TCountsReader reader;
+    if (!reader.Open(fileName, *this)) {
+        return false;
+    }
+    Tables.assign(Order - 1, TGramTable());
+    TGramKey key;
+    TCount count = 0;
+    for (size_t n = MIN_GRAM_ORDER; n <= Order; ++n) {
+        TGramTable& table = Tables[n - 2];
+        if (!reader.BeginTable(n)) {
+            return false;
+        }
+        while (reader.Next(key, count)) {
+            table.Words.insert(table.Words.end(), key.Words, key.Words + n);
+            table.Counts.push_back(count);
+        }
+    }
+    return reader.Finish();
+}
+
+bool TNgramCounts::Merge(const std::vector<std::string>& inputFiles, const std::string& outputFile) {
+    if (inputFiles.empty()) {
+        return false;
+    }
+    std::vector<std::unique_ptr<TCountsReader>> readers;
+    std::vector<TNgramCounts> headers(inputFiles.size());
+    for (size_t i = 0; i < inputFiles.size(); ++i) {
+        readers.emplace_back(new TCountsReader());
+        if (!readers.back()->Open(inputFiles[i], headers[i])) {
+            std::cerr << "[error] failed to read counts " << inputFiles[i] << std::endl;
+            return false;
+        }
+        if (headers[i].Order != headers[0].Order ||
+            headers[i].Tokenizer.GetAlphabet() != headers[0].Tokenizer.GetAlphabet())
+        {
+            std::cerr << "[error] " << inputFiles[i] << " was counted with a different order or alphabet" << std::endl;
+            return false;
+        }
+    }
+
+    // the merged vocabulary is sorted as well, so word ids only grow when
+    // they are renumbered into it
+    TNgramCounts merged;
+    merged.Order = headers[0].Order;
+    merged.Tokenizer = headers[0].Tokenizer;
+    for (auto&& header: headers) {
+        merged.TotalWords += header.TotalWords;
+        merged.Words.insert(merged.Words.end(), header.Words.begin(), header.Words.end());
+    }
+    std::sort(merged.Words.begin(), merged.Words.end());
+    merged.Words.erase(std::unique(merged.Words.begin(), merged.Words.end()), merged.Words.end());
+    merged.WordCounts.assign(merged.Words.size(), 0);
+    std::vector<std::vector<TWordId>> newIds(headers.size());
+    for (size_t i = 0; i < headers.size(); ++i) {
+        const TNgramCounts& header = headers[i];
+        newIds[i].resize(header.Words.size());
+        for (size_t wid = 0; wid < header.Words.size(); ++wid) {
+            auto it = std::lower_bound(merged.Words.begin(), merged.Words.end(), header.Words[wid]);
+            newIds[i][wid] = TWordId(it - merged.Words.begin());
+            TCount& count = merged.WordCounts[newIds[i][wid]];
+            count = SaturateCount(uint64_t(count) + header.WordCounts[wid]);
+        }
+        headers[i] = TNgramCounts();
+    }
+
+    TCountsWriter writer;
+    if (!writer.Open(outputFile, merged)) {
+        std::cerr << "[error] failed to write counts " << outputFile << std::endl;
+        return false;
+    }
+    std::cerr << "[info] merging " << inputFiles.size() << " count files, words: " << merged.Words.size() << std::endl;
+
+    // k-way merge of every table, through a heap of the current n-gram of
+    // each input
+    using TEntry = std::pair<TGramKey, size_t>;
+    auto greater = [](const TEntry& a, const TEntry& b) {
+        return b.first < a.first || (a.first == b.first && a.second > b.second);
+    };
+    std::vector<TCount> current(readers.size());
+    for (size_t n = MIN_GRAM_ORDER; n <= merged.Order; ++n) {
+        std::priority_queue<TEntry, std::vector<TEntry>, decltype(greater)> heap(greater);
+        auto advance = [&](size_t i) {
+            TGramKey key;
+            if (readers[i]->Next(key, current[i])) {
+                for (size_t j = 0; j < n; ++j) {
+                    key.Words[j] = newIds[i][key.Words[j]];
+                }
+                heap.push(std::make_pair(key, i));
+            }
+        };
+        for (size_t i = 0; i < readers.size(); ++i) {
+            if (!readers[i]->BeginTable(n)) {
+                return false;
+            }
+            advance(i);
+        }
+        writer.BeginTable();
+        uint64_t written = 0;
+        while (!heap.empty()) {
+            TGramKey key = heap.top().first;
+            uint64_t count = 0;
+            while (!heap.empty() && heap.top().first == key) {
+                size_t i = heap.top().second;
+                heap.pop();
+                count += current[i];
+                advance(i);
+            }
+            writer.Add(key.Words, n, SaturateCount(count));
+            written += 1;
+        }
+        writer.EndTable();
+        std::cerr << "[info] ngrams" << n << ": " << written << std::endl;
+    }
+    for (auto&& reader: readers) {
+        if (!reader->Finish()) {
+            return false;
+        }
+    }
+    return writer.Finish();
+}
+
+} // NJamSpell
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ngram_store.hpp"
+#include "count_min_sketch.hpp"
+#include "utils.hpp"
+
+namespace NJamSpell {
+
+constexpr uint64_t NGRAM_COUNTS_MAGIC_BYTE = 7306916115429565796ULL;
+constexpr uint16_t NGRAM_COUNTS_VERSION = 1;
+
+// Counts n-grams of the sentence; with a sketch, only those that may occur
+// minCount times or more
+template<size_t N>
+void CountNgrams(const std::vector<TWordId>& words, TGramCounts<N>& grams,
+                 const TCountMinSketch* sketch = nullptr, uint32_t minCount = 0)
+{
+    TGramWords<N> key;
+    for (size_t j = 0; j + N <= words.size(); ++j) {
+        std::copy(words.begin() + j, words.begin() + j + N, key.begin());
+        if (sketch && sketch->Estimate((const char*)&key[0], sizeof(key)) < minCount) {
+            continue;
+        }
+        grams[key] += 1;
+    }
+}
+
+template<size_t N>
+void SketchNgrams(const std::vector<TWordId>& words, TCountMinSketch& sketch) {
+    TGramWords<N> key;
+    for (size_t j = 0; j + N <= words.size(); ++j) {
+        std::copy(words.begin() + j, words.begin() + j + N, key.begin());
+        sketch.Add((const char*)&key[0], sizeof(key));
+    }
+}
+
+// Counts of the n-grams of one order, sorted by words
+struct TGramTable {
+    std::vector<TWordId> Words;   // n words per n-gram
+    std::vector<TCount> Counts;
+};
+
+// N-gram counts of a corpus shard, the output of the count stage of
+// training. Words are numbered in lexicographic order, so renumbering
+// several count files into their merged vocabulary keeps every table
+// sorted, and files are merged in a single streaming pass.
+//
+// File: magic, version, order, alphabet, total words, vocabulary with word
+// counts, then for every order from 2 a number of n-grams followed by the
+// n-grams themselves as raw word ids and count, and the magic again.
+struct TNgramCounts {
+    uint32_t Order = DEFAULT_GRAM_ORDER;
+    TTokenizer Tokenizer;
+    uint64_t TotalWords = 0;
+    std::vector<std::wstring> Words;
+    std::vector<TCount> WordCounts;
+    std::vector<TGramTable> Tables;   // Tables[n - 2] holds the n-grams
+
+    bool Count(const std::string& textFile, const std::string& alphabetFile, uint32_t order);
+    bool Dump(const std::string& fileName) const;
+    bool Load(const std::string& fileName);
+    // Sums the counts of several files into one, without loading their n-grams
+    static bool Merge(const std::vector<std::string>& inputFiles, const std::string& outputFile);
+};
+
+} // NJamSpell
@@ -0,0 +1,460 @@
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+
+#include "ngram_store.hpp"
+#include "utils.hpp"
+
+namespace NJamSpell {
+
+// Key bytes of legacy models, written by NHandyPack: bigrams were pairs,
+// dumped in order, trigrams tuples, dumped from the last element to the
+// first. Longer n-grams follow the trigram layout.
+static size_t SerializeGramKey(const TWordId* words, size_t size, char* buff) {
+    TWordId* out = (TWordId*)buff;
+    for (size_t i = 0; i < size; ++i) {
+        out[i] = size == 2 ? words[i] : words[size - 1 - i];
+    }
+    return size * sizeof(TWordId);
+}
+
+static std::string GramKeyBytes(const TGramKey& key) {
+    TWordId keyBuff[MAX_GRAM_ORDER];
+    size_t keySize = SerializeGramKey(key.Words, key.Size, (char*)keyBuff);
+    return std::string((const char*)keyBuff, keySize);
+}
+
+bool TPerfectHashStore::Build(const TGramCountList& grams, EBucketLayout layout,
+                              const TPerfectHashOptions& options, const TCheckpoints* checkpoints)
+{
+    bool resumed = checkpoints && checkpoints->Load(PERFECT_HASH_CHECKPOINT, [this](std::istream& in) {
+        PerfectHash.Load(in);
+    });
+    if (!resumed) {
+        std::vector<std::string> keys;
+        keys.reserve(grams.size());
+        for (auto&& it: grams) {
+            keys.push_back(GramKeyBytes(it.first));
+        }
+
+        std::cerr << "[info] generating perf hash" << std::endl;
+
+        if (!PerfectHash.Init(keys, options)) {
+            return false;
+        }
+        if (checkpoints) {
+            checkpoints->Save(PERFECT_HASH_CHECKPOINT, [this](std::ostream& out) {
+                PerfectHash.Dump(out);
+            });
+        }
+    }
+
+    std::cerr << "[info] finished, buckets: " << PerfectHash.BucketsNumber()
+              << ", partitions: " << PerfectHash.PartitionsNumber()
+              << ", size: " << PerfectHash.ByteSize() << " bytes\n";
+
+    FingerprintType = FT_PERFECT_HASH;
+    Buckets.Init(layout, PerfectHash.BucketsNumber());
+    for (auto&& it: grams) {
+        std::string key = GramKeyBytes(it.first);
+        uint32_t fingerprint = 0;
+        uint32_t bucket = PerfectHash.Hash(key.data(), key.size(), fingerprint);
+        assert(bucket < Buckets.Size());
+        Buckets.Set(bucket, fingerprint, PackInt32(it.second));
+    }
+
+    std::cerr << "[info] buckets filled, layout " << GetBucketLayoutInfo(Buckets.GetLayout()).Name
+              << ", size " << Buckets.ByteSize() << " bytes"
+              << ", expected false positive rate " << Buckets.FalsePositiveRate() << std::endl;
+    return true;
+}
+
+void TPerfectHashStore::LoadLegacy(std::istream& in) {
+    std::vector<std::pair<uint16_t, uint16_t>> buckets;
+    PerfectHash.LoadLegacy(in);
+    NHandyPack::Load(in, buckets);
+    FingerprintType = FT_CITY_HASH;
+    Buckets.InitLegacy(buckets);
+}
+
+void TPerfectHashStore::DumpPacked(std::ostream& out) const {
+    NHandyPack::Dump(out, FingerprintType);
+    PerfectHash.DumpPacked(out);
+    NHandyPack::Dump(out, Buckets);
+}
+
+void TPerfectHashStore::LoadPacked(std::istream& in) {
+    NHandyPack::Load(in, FingerprintType);
+    PerfectHash.LoadPacked(in);
+    NHandyPack::Load(in, Buckets);
+}
+
+ENgramStoreType TPerfectHashStore::GetType() const {
+    return NS_PERFECT_HASH;
+}
+
+TPackedCount TPerfectHashStore::Find(const TWordId* words, size_t size) const {
+    TWordId keyBuff[MAX_GRAM_ORDER];
+    const char* key = (const char*)keyBuff;
+    size_t keySize = SerializeGramKey(words, size, (char*)keyBuff);
+    uint32_t fingerprint = 0;
+    uint32_t bucket = PerfectHash.Hash(key, keySize, fingerprint);
+    if (FingerprintType == FT_CITY_HASH) {
+        fingerprint = CityHash16(key, keySize);
+    }
+    assert(bucket < PerfectHash.BucketsNumber());
+    return Buckets.Find(bucket, fingerprint);
+}
+
+void TPerfectHashStore::FindBatch(const TGramKey* keys, size_t count, TPackedCount* codes) const {
+    // Resolve the lookups in chunks: hash every key and prefetch its first
+    // probe, then prefetch the buckets, and only then compare fingerprints,
+    // so that the cache misses overlap
+    constexpr size_t CHUNK_SIZE = 32;
+    TWordId keyBuff[CHUNK_SIZE * MAX_GRAM_ORDER];
+    uint32_t bucketIds[CHUNK_SIZE];
+    uint32_t fingerprints[CHUNK_SIZE];
+    for (size_t from = 0; from < count; from += CHUNK_SIZE) {
+        size_t n = std::min(CHUNK_SIZE, count - from);
+        size_t order = keys[from].Size;
+        size_t keySize = order * sizeof(TWordId);
+        char* keyData = (char*)keyBuff;
+        for (size_t i = 0; i < n; ++i) {
+            assert(keys[from + i].Size == order);
+            SerializeGramKey(keys[from + i].Words, order, keyData + i * keySize);
+        }
+        PerfectHash.HashBatch(keyData, keySize, n, bucketIds, fingerprints);
+        if (FingerprintType == FT_CITY_HASH) {
+            for (size_t i = 0; i < n; ++i) {
+                fingerprints[i] = CityHash16(keyData + i * keySize, keySize);
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            Buckets.Prefetch(bucketIds[i]);
+        }
+        Buckets.FindBatch(bucketIds, fingerprints, n, codes + from);
+    }
+}
+
+uint64_t TPerfectHashStore::ByteSize() const {
+    return PerfectHash.ByteSize() + Buckets.ByteSize();
+}
+
+void TPerfectHashStore::GetMemoryUsage(TMemoryUsage& usage) const {
+    usage.Add("perfect_hash", PerfectHash.ByteSize());
+    usage.Add("buckets", Buckets.ByteSize());
+}
+
+bool TPerfectHashStore::AdviseMemory(const TMemoryOptions& options) const {
+    return Buckets.AdviseMemory(options);
+}
+
+EBucketLayout TPerfectHashStore::GetBucketLayout() const {
+    return Buckets.GetLayout();
+}
+
+EPerfectHashBackend TPerfectHashStore::GetBackend() const {
+    return PerfectHash.GetBackend();
+}
+
+EFingerprintType TPerfectHashStore::GetFingerprintType() const {
+    return EFingerprintType(FingerprintType);
+}
+
+const TBuckets& TPerfectHashStore::GetBuckets() const {
+    return Buckets;
+}
+
+bool TTrieStore::Build(const TGramCountList& grams, TWordId vocabSize) {
+    std::cerr << "[info] generating trie" << std::endl;
+
+    size_t order = MIN_GRAM_ORDER;
+    for (auto&& it: grams) {
+        assert(it.first.Size >= MIN_GRAM_ORDER && it.first.Size <= MAX_GRAM_ORDER);
+        order = std::max<size_t>(order, it.first.Size);
+    }
+    size_t levels = order - 1;
+    Offsets.assign(levels, TPackedArray());
+    Words.assign(levels, TPackedArray());
+    Counts.assign(levels, TPackedArray());
+
+    uint32_t wordBits = TPackedArray::BitsFor(vocabSize);
+    uint32_t countBits = TPackedArray::BitsFor(PACKED_COUNT_CODES - 1);
+    std::vector<TGramKey> parents;
+    std::cerr << "[info] trie nodes per order:";
+    for (size_t level = 0; level < levels; ++level) {
+        size_t size = level + 2;
+
+        // Nodes are the stored n-grams of this order plus the prefixes of
+        // all longer ones, some of which may live outside of this store
+        std::vector<std::pair<TGramKey, TCount>> nodes;
+        for (auto&& it: grams) {
+            if (it.first.Size >= size) {
+                TCount count = it.first.Size == size ? it.second : 0;
+                nodes.push_back(std::make_pair(TGramKey(it.first.Words, size), count));
+            }
+        }
+        // a stored n-gram sorts before the prefix nodes with the same words
+        std::sort(nodes.begin(), nodes.end(), [](const std::pair<TGramKey, TCount>& a,
+                                                 const std::pair<TGramKey, TCount>& b) {
+            return a.first < b.first || (a.first == b.first && a.second > b.second);
+        });
+        nodes.erase(std::unique(nodes.begin(), nodes.end(), [](const std::pair<TGramKey, TCount>& a,
+                                                               const std::pair<TGramKey, TCount>& b) {
+            return a.first == b.first;
+        }), nodes.end());
+
+        uint64_t parentsCount = level == 0 ? uint64_t(vocabSize) : parents.size();
+        Offsets[level] = TPackedArray(parentsCount + 1, TPackedArray::BitsFor(nodes.size()));
+        Words[level] = TPackedArray(nodes.size(), wordBits);
+        Counts[level] = TPackedArray(nodes.size(), countBits);
+
+        uint64_t node = 0;
+        for (uint64_t parent = 0; parent <= parentsCount; ++parent) {
+            Offsets[level].Set(parent, node);
+            if (parent == parentsCount) {
+                break;
+            }
+            for (; node < nodes.size(); ++node) {
+                const TGramKey& key = nodes[node].first;
+                bool child = level == 0 ? key.Words[0] == parent
+                                        : std::equal(key.Words, key.Words + size - 1, parents[parent].Words);
+                if (!child) {
+                    break;
+                }
+                assert(key.Words[size - 1] < vocabSize);
+                Words[level].Set(node, key.Words[size - 1]);
+                Counts[level].Set(node, PackInt32(nodes[node].second));
+            }
+        }
+        if (node != nodes.size()) {
+            std::cerr << std::endl;
+            return false;
+        }
+
+        std::cerr << " " << nodes.size();
+        parents.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            parents[i] = nodes[i].first;
+        }
+    }
+
+    std::cerr << ", size: " << ByteSize() << " bytes" << std::endl;
+    return true;
+}
+
+void TTrieStore::GetNgrams(TGramCountList& grams) const {
+    std::vector<TGramKey> parents;
+    for (size_t level = 0; level < Words.size(); ++level) {
+        size_t size = level + 2;
+        std::vector<TGramKey> nodes(Words[level].Size());
+        uint64_t parentsCount = Offsets[level].Size() - 1;
+        for (uint64_t parent = 0; parent < parentsCount; ++parent) {
+            TWordId word = TWordId(parent);
+            const TWordId* prefix = level == 0 ? &word : parents[parent].Words;
+            for (uint64_t node = Offsets[level].Get(parent); node < Offsets[level].Get(parent + 1); ++node) {
+                TGramKey& key = nodes[node];
+                std::copy(prefix, prefix + size - 1, key.Words);
+                key.Words[size - 1] = TWordId(Words[level].Get(node));
+                key.Size = size;
+                // prefix nodes of longer n-grams have no count of their own
+                TPackedCount code = TPackedCount(Counts[level].Get(node));
+                if (code) {
+                    grams.push_back(std::make_pair(key, UnpackInt32(code)));
+                }
+            }
+        }
+        parents.swap(nodes);
+    }
+}
+
+ENgramStoreType TTrieStore::GetType() const {
+    return NS_TRIE;
+}
+
+uint64_t TTrieStore::Search(const TPackedArray& words, uint64_t from, uint64_t to, TWordId word) {
+    // Interpolation search, falling back to bisection when the ids are
+    // skewed enough for interpolation to stop halving the range
+    constexpr uint64_t LINEAR_SCAN = 8;
+    uint64_t lo = from;
+    uint64_t hi = to;
+    bool interpolate = true;
+    while (hi - lo > LINEAR_SCAN) {
+        TWordId first = words.Get(lo);
+        TWordId last = words.Get(hi - 1);
+        if (word < first || word > last) {
+            return to;
+        }
+        uint64_t pos = lo + (hi - lo) / 2;
+        if (interpolate && last > first) {
+            pos = lo + uint64_t(word - first) * (hi - 1 - lo) / (last - first);
+        }
+        uint64_t size = hi - lo;
+        TWordId value = words.Get(pos);
+        if (value == word) {
+            return pos;
+        }
+        if (value < word) {
+            lo = pos + 1;
+        } else {
+            hi = pos;
+        }
+        interpolate = (hi - lo) * 2 <= size;
+    }
+    for (; lo < hi; ++lo) {
+        TWordId value = words.Get(lo);
+        if (value == word) {
+            return lo;
+        }
+        if (value > word) {
+            break;
+        }
+    }
+    return to;
+}
+
+TPackedCount TTrieStore::Find(const TWordId* words, size_t size) const {
+    assert(size >= MIN_GRAM_ORDER);
+    if (size > Words.size() + 1 || uint64_t(words[0]) + 1 >= Offsets[0].Size()) {
+        return TPackedCount();
+    }
+    uint64_t from = Offsets[0].Get(words[0]);
+    uint64_t to = Offsets[0].Get(words[0] + 1);
+    for (size_t level = 0;; ++level) {
+        uint64_t node = Search(Words[level], from, to, words[level + 1]);
+        if (node == to) {
+            return TPackedCount();
+        }
+        if (level + 2 == size) {
+            return Counts[level].Get(node);
+        }
+        from = Offsets[level + 1].Get(node);
+        to = Offsets[level + 1].Get(node + 1);
+    }
+}
+
+void TTrieStore::FindBatch(const TGramKey* keys, size_t count, TPackedCount* codes) const {
+    for (size_t i = 0; i < count && !Offsets.empty(); ++i) {
+        if (keys[i].Words[0] < Offsets[0].Size()) {
+            Prefetch(Offsets[0].Address(keys[i].Words[0]));
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        codes[i] = Find(keys[i].Words, keys[i].Size);
+    }
+}
+
+uint64_t TTrieStore::ByteSize() const {
+    uint64_t size = 0;
+    for (size_t level = 0; level < Words.size(); ++level) {
+        size += Offsets[level].ByteSize() + Words[level].ByteSize() + Counts[level].ByteSize();
+    }
+    return size;
+}
+
+void TTrieStore::GetMemoryUsage(TMemoryUsage& usage) const {
+    usage.Add("trie", ByteSize());
+}
+
+void TNgramStorage::Reset(TNgramStore* store) {
+    Store.reset(store);
+}
+
+void TNgramStorage::Clear() {
+    Store.reset();
+}
+
+bool TNgramStorage::Empty() const {
+    return !Store;
+}
+
+const TNgramStore& TNgramStorage::operator*() const {
+    assert(Store && "Not initialized");
+    return *Store;
+}
+
+const TNgramStore* TNgramStorage::operator->() const {
+    assert(Store && "Not initialized");
+    return Store.get();
+}
+
+void TNgramStorage::Dump(std::ostream& out) const {
+    assert(Store && "Not initialized");
+    uint8_t type = Store->GetType();
+    NHandyPack::Dump(out, type);
+    Store->Dump(out);
+}
+
+void TNgramStorage::Load(std::istream& in) {
+    uint8_t type = 0;
+    NHandyPack::Load(in, type);
+    Store.reset(in.good() ? Create(type) : nullptr);
+    if (!Store) {
+        // corrupted files, or files of newer versions
+        in.setstate(std::ios::failbit);
+        return;
+    }
+    Store->Load(in);
+}
+
+void TNgramStorage::DumpPacked(std::ostream& out) const {
+    assert(Store && "Not initialized");
+    uint8_t type = Store->GetType();
+    NHandyPack::Dump(out, type);
+    Store->DumpPacked(out);
+}
+
+void TNgramStorage::LoadPacked(std::istream& in) {
+    uint8_t type = 0;
+    NHandyPack::Load(in, type);
+    Store.reset(in.good() ? Create(type) : nullptr);
+    if (!Store) {
+        // corrupted files, or files of newer versions
+        in.setstate(std::ios::failbit);
+        return;
+    }
+    Store->LoadPacked(in);
+}
+
+TNgramStore* TNgramStorage::Create(uint8_t type) {
+    if (type == NS_PERFECT_HASH) {
+        return new TPerfectHashStore();
+    }
+    if (type == NS_TRIE) {
+        return new TTrieStore();
+    }
+    std::cerr << "[error] unknown n-gram store type " << int(type) << std::endl;
+    return nullptr;
+}
+
+void TNgramDelta::Add(const TWordId* words, size_t size, TCount count) {
+    Counts[TGramKey(words, size)] += count;
+}
+
+TCount TNgramDelta::Find(const TWordId* words, size_t size) const {
+    auto it = Counts.find(TGramKey(words, size));
+    if (it == Counts.end()) {
+        return TCount();
+    }
+    return it->second;
+}
+
+bool TNgramDelta::Empty() const {
+    return Counts.empty();
+}
+
+size_t TNgramDelta::Size() const {
+    return Counts.size();
+}
+
+void TNgramDelta::Clear() {
+    std::unordered_map<TGramKey, TCount, TGramKeyHash>().swap(Counts);
+}
+
+uint64_t TNgramDelta::ByteSize() const {
+    // every node holds the entry, the next node pointer and the cached hash
+    return Counts.bucket_count() * sizeof(void*) +
+           Counts.size() * (sizeof(std::pair<const TGramKey, TCount>) + sizeof(void*) + sizeof(size_t));
+}
+
+} // NJamSpell
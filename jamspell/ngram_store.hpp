@@ -0,0 +1,238 @@
+#pragma once
+
+#include <unordered_map>
+#include <memory>
+#include <utility>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include <contrib/handypack/handypack.hpp>
+#include "perfect_hash.hpp"
+#include "buckets.hpp"
+#include "packed_array.hpp"
+#include "checkpoint.hpp"
+#include "utils.hpp"
+
+namespace NJamSpell {
+
+using TWordId = uint32_t;
+using TCount = uint32_t;
+
+using TGram1Key = TWordId;
+
+constexpr size_t MIN_GRAM_ORDER = 2;
+constexpr size_t MAX_GRAM_ORDER = 5;
+constexpr size_t DEFAULT_GRAM_ORDER = 3;
+
+// An n-gram of up to MAX_GRAM_ORDER word ids, for batched lookups; unused
+// words are zero
+struct TGramKey {
+    TGramKey() = default;
+    TGramKey(TWordId word1)
+        : Words{word1}
+        , Size(1)
+    {
+    }
+    TGramKey(TWordId word1, TWordId word2)
+        : Words{word1, word2}
+        , Size(2)
+    {
+    }
+    TGramKey(TWordId word1, TWordId word2, TWordId word3)
+        : Words{word1, word2, word3}
+        , Size(3)
+    {
+    }
+    TGramKey(const TWordId* words, size_t size)
+        : Size(size)
+    {
+        assert(size <= MAX_GRAM_ORDER);
+        std::copy(words, words + size, Words);
+    }
+    TWordId Words[MAX_GRAM_ORDER] = {};
+    uint32_t Size = 0;
+};
+
+inline bool operator==(const TGramKey& a, const TGramKey& b) {
+    return a.Size == b.Size && std::equal(a.Words, a.Words + a.Size, b.Words);
+}
+
+// Lexicographic by words; keys of the same size only
+inline bool operator<(const TGramKey& a, const TGramKey& b) {
+    return std::lexicographical_compare(a.Words, a.Words + a.Size, b.Words, b.Words + b.Size);
+}
+
+struct TGramKeyHash {
+public:
+  std::size_t operator()(const TGramKey& x) const {
+      size_t h = x.Size;
+      for (size_t i = 0; i < x.Size; ++i) {
+          h = (h ^ x.Words[i]) * 1099511628211ULL;
+      }
+      return h;
+  }
+};
+
+// Fixed size n-gram keys used while counting, one type per order
+template<size_t N>
+using TGramWords = std::array<TWordId, N>;
+
+template<size_t N>
+struct TGramWordsHash {
+public:
+  std::size_t operator()(const TGramWords<N>& x) const {
+      size_t h = 0;
+      for (size_t i = 0; i < N; ++i) {
+          h ^= (size_t)x[i] << ((16 * i) & 63);
+      }
+      return h;
+  }
+};
+
+template<size_t N>
+using TGramCounts = std::unordered_map<TGramWords<N>, TCount, TGramWordsHash<N>>;
+
+// N-grams of all orders a store is built from
+using TGramCountList = std::vector<std::pair<TGramKey, TCount>>;
+
+// Where a model keeps its bigram and trigram counts
+enum ENgramStoreType: uint8_t {
+    NS_PERFECT_HASH = 0,    // perfect hash + fingerprinted buckets, unseen n-grams may collide
+    NS_TRIE = 1,            // sorted word id arrays, exact
+};
+
+// How bucket fingerprints are computed; stored in the model
+enum EFingerprintType: uint8_t {
+    FT_CITY_HASH = 0,       // separate CityHash16 pass over the key, legacy models
+    FT_PERFECT_HASH = 1,    // derived from the perfect hash state, no second pass
+};
+
+// Packed counts of n-grams of orders 2 and up; absent n-grams have a zero count
+class TNgramStore {
+public:
+    virtual ~TNgramStore() = default;
+    virtual ENgramStoreType GetType() const = 0;
+    virtual TPackedCount Find(const TWordId* words, size_t size) const = 0;
+    // Looks up keys of the same size at once, overlapping their cache misses
+    virtual void FindBatch(const TGramKey* keys, size_t count, TPackedCount* codes) const = 0;
+    virtual uint64_t ByteSize() const = 0;
+    // ByteSize by parts of the store
+    virtual void GetMemoryUsage(TMemoryUsage& usage) const = 0;
+    // Applies memory options to the arrays hit by random lookups, none by default
+    virtual bool AdviseMemory(const TMemoryOptions&) const {
+        return true;
+    }
+    virtual void Dump(std::ostream& out) const = 0;
+    virtual void Load(std::istream& in) = 0;
+    // Smaller encoding for shipping, decoded at load; the plain one for
+    // stores that are compact already
+    virtual void DumpPacked(std::ostream& out) const {
+        Dump(out);
+    }
+    virtual void LoadPacked(std::istream& in) {
+        Load(in);
+    }
+};
+
+// Checkpoint phase of the perfect hash of TPerfectHashStore::Build
+constexpr const char* PERFECT_HASH_CHECKPOINT = "phf";
+
+class TPerfectHashStore: public TNgramStore {
+public:
+    // With checkpoints, the perfect hash is saved once generated, or loaded
+    // instead of generating it when resuming
+    bool Build(const TGramCountList& grams, EBucketLayout layout, const TPerfectHashOptions& options,
+               const TCheckpoints* checkpoints = nullptr);
+    // Loads the perfect hash and buckets of legacy models
+    void LoadLegacy(std::istream& in);
+
+    ENgramStoreType GetType() const override;
+    TPackedCount Find(const TWordId* words, size_t size) const override;
+    void FindBatch(const TGramKey* keys, size_t count, TPackedCount* codes) const override;
+    uint64_t ByteSize() const override;
+    void GetMemoryUsage(TMemoryUsage& usage) const override;
+    bool AdviseMemory(const TMemoryOptions& options) const override;
+    EBucketLayout GetBucketLayout() const;
+    EPerfectHashBackend GetBackend() const;
+    EFingerprintType GetFingerprintType() const;
+    const TBuckets& GetBuckets() const;
+    // Buckets are bit-packed by their layout, only the perfect hash is packed further
+    void DumpPacked(std::ostream& out) const override;
+    void LoadPacked(std::istream& in) override;
+
+    HANDYPACK(FingerprintType, PerfectHash, Buckets)
+private:
+    uint8_t FingerprintType = FT_PERFECT_HASH;
+    TPerfectHash PerfectHash;
+    TBuckets Buckets;
+};
+
+// Counts in a trie with a level per order: the bigrams of every first word
+// are a sorted range of second word ids, the children of every n-gram a
+// sorted range of next word ids. Ranges are searched by interpolation, so
+// lookups are exact and take a few probes per level.
+class TTrieStore: public TNgramStore {
+public:
+    bool Build(const TGramCountList& grams, TWordId vocabSize);
+    // Appends the stored n-grams with their unpacked counts
+    void GetNgrams(TGramCountList& grams) const;
+
+    ENgramStoreType GetType() const override;
+    TPackedCount Find(const TWordId* words, size_t size) const override;
+    void FindBatch(const TGramKey* keys, size_t count, TPackedCount* codes) const override;
+    uint64_t ByteSize() const override;
+    void GetMemoryUsage(TMemoryUsage& usage) const override;
+
+    HANDYPACK(Offsets, Words, Counts)
+private:
+    // Position of word in words[from, to), or to if it is absent
+    static uint64_t Search(const TPackedArray& words, uint64_t from, uint64_t to, TWordId word);
+private:
+    // Level i holds the (i+2)-grams. Offsets[0] is the first bigram of every
+    // first word, indexed by word id, Offsets[i] the first child of every
+    // node of level i-1.
+    std::vector<TPackedArray> Offsets;
+    std::vector<TPackedArray> Words;
+    std::vector<TPackedArray> Counts;
+};
+
+// A model's n-gram store, serialized together with its type
+class TNgramStorage {
+public:
+    void Reset(TNgramStore* store);
+    void Clear();
+    bool Empty() const;
+    const TNgramStore& operator*() const;
+    const TNgramStore* operator->() const;
+    void Dump(std::ostream& out) const;
+    // Sets the failbit of in for unknown store types
+    void Load(std::istream& in);
+    // With TNgramStore::DumpPacked
+    void DumpPacked(std::ostream& out) const;
+    void LoadPacked(std::istream& in);
+private:
+    // Null for unknown types
+    TNgramStore* Create(uint8_t type);
+private:
+    std::unique_ptr<TNgramStore> Store;
+};
+
+// Counts added to a model after it was built, of n-grams of any order
+// including unigrams. Looked up before the immutable store and only ever
+// grows: counts added for the same n-gram are summed.
+class TNgramDelta {
+public:
+    void Add(const TWordId* words, size_t size, TCount count);
+    TCount Find(const TWordId* words, size_t size) const;
+    bool Empty() const;
+    size_t Size() const;
+    void Clear();
+    // Estimate, with the hash table nodes
+    uint64_t ByteSize() const;
+private:
+    std::unordered_map<TGramKey, TCount, TGramKeyHash> Counts;
+};
+
+} // NJamSpell
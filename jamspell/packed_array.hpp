@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+
+#include <contrib/handypack/handypack.hpp>
+
+namespace NJamSpell {
+
+// Array of unsigned integers of Bits bits each, without padding
+class TPackedArray {
+public:
+    TPackedArray() = default;
+    TPackedArray(uint64_t size, uint32_t bits)
+        : Count(size)
+        , Bits(bits)
+        , Data((size * bits + 63) / 64 + 1, 0)
+    {
+        assert(bits <= 64);
+    }
+
+    // Bits needed to store values up to maxValue
+    static uint32_t BitsFor(uint64_t maxValue) {
+        uint32_t bits = 1;
+        while (bits < 64 && (maxValue >> bits)) {
+            ++bits;
+        }
+        return bits;
+    }
+
+    inline uint64_t Get(uint64_t index) const {
+        assert(index < Count);
+        uint64_t bit = index * Bits;
+        uint64_t word = bit >> 6;
+        uint32_t shift = bit & 63;
+        uint64_t value = Data[word] >> shift;
+        if (shift + Bits > 64) {
+            value |= Data[word + 1] << (64 - shift);
+        }
+        return value & Mask();
+    }
+
+    inline void Set(uint64_t index, uint64_t value) {
+        assert(index < Count && value <= Mask());
+        uint64_t bit = index * Bits;
+        uint64_t word = bit >> 6;
+        uint32_t shift = bit & 63;
+        Data[word] = (Data[word] & ~(Mask() << shift)) | (value << shift);
+        if (shift + Bits > 64) {
+            uint32_t written = 64 - shift;
+            Data[word + 1] = (Data[word + 1] & ~(Mask() >> written)) | (value >> written);
+        }
+    }
+
+    inline const void* Address(uint64_t index) const {
+        return &Data[(index * Bits) >> 6];
+    }
+
+    uint64_t Size() const {
+        return Count;
+    }
+
+    uint64_t ByteSize() const {
+        return Data.size() * sizeof(uint64_t);
+    }
+
+    HANDYPACK(Count, Bits, Data)
+private:
+    inline uint64_t Mask() const {
+        return Bits == 64 ? ~uint64_t(0) : (uint64_t(1) << Bits) - 1;
+    }
+private:
+    uint64_t Count = 0;
+    uint32_t Bits = 0;
+    std::vector<uint64_t> Data;
+};
+
+} // NJamSpell
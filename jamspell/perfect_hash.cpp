@@ -1,87 +1,573 @@
 #include <contrib/handypack/handypack.hpp>
 #include <contrib/phf/phf.h>
 
+#include <contrib/cityhash/city.h>
+
 #include "perfect_hash.hpp"
+#include "compact_hash.hpp"
+#include "packed_array.hpp"
+#include "utils.hpp"
 
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <limits>
+#include <algorithm>
 #include <cassert>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JAMSPELL_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
 namespace NJamSpell {
 
+// Same hash functions as PHF::hash<phf_string_t> (MurmurHash3 rounds over
+// big-endian words), split in two stages so that batches can prefetch the
+// displacement map between them.
+
+static inline uint32_t PhfRotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t PhfRound32(uint32_t k1, uint32_t h1) {
+    k1 *= 0xcc9e2d51;
+    k1 = PhfRotl32(k1, 15);
+    k1 *= 0x1b873593;
+
+    h1 ^= k1;
+    h1 = PhfRotl32(h1, 13);
+    h1 = h1 * 5 + 0xe6546b64;
+    return h1;
+}
+
+static inline uint32_t PhfRound32(const unsigned char* p, size_t n, uint32_t h1) {
+    for (; n >= 4; p += 4, n -= 4) {
+        uint32_t k1 = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        h1 = PhfRound32(k1, h1);
+    }
+    uint32_t k1 = 0;
+    switch (n & 3) {
+    case 3:
+        k1 |= uint32_t(p[2]) << 8;
+    case 2:
+        k1 |= uint32_t(p[1]) << 16;
+    case 1:
+        k1 |= uint32_t(p[0]) << 24;
+        h1 = PhfRound32(k1, h1);
+    }
+    return h1;
+}
+
+static inline uint32_t PhfMix32(uint32_t h1) {
+    h1 ^= h1 >> 16;
+    h1 *= 0x85ebca6b;
+    h1 ^= h1 >> 13;
+    h1 *= 0xc2b2ae35;
+    h1 ^= h1 >> 16;
+    return h1;
+}
+
+static inline uint32_t PhfReduce(uint32_t h, size_t n, bool nodiv) {
+    return nodiv ? (h & (n - 1)) : (h % n);
+}
+
+// Fingerprints and partitions are derived from the same state as the
+// displacement slot, through differently salted finalizers, so keys are
+// hashed only once
+static const uint32_t FINGERPRINT_SALT = 0x9e3779b9;
+static const uint32_t PARTITION_SALT = 0x7f4a7c15;
+static const phf_seed_t PHF_SEED = 42;
+static const uint64_t COMPACT_SEED = 42;
+constexpr size_t BATCH_BLOCK = 64;
+
+struct TPerfectHashImpl {
+    uint8_t Backend = PHB_PHF;
+    uint32_t Seed = PHF_SEED;
+    std::vector<uint32_t> Offsets; // first bucket of every partition
+    uint32_t Buckets = 0;
+    std::vector<phf> Phfs;
+    std::vector<TCompactHash> Compact;
+
+    ~TPerfectHashImpl() {
+        for (phf& p: Phfs) {
+            PHF::destroy(&p);
+        }
+    }
+
+    inline uint32_t Partition(uint32_t partitionHash) const {
+        return uint32_t((uint64_t(partitionHash) * Offsets.size()) >> 32);
+    }
+
+    void DumpPhf(std::ostream& out, const phf& perfHash) const {
+        NHandyPack::Dump(out, perfHash.d_max,
+                             perfHash.g_op,
+                             perfHash.m,
+                             perfHash.r,
+                             perfHash.seed,
+                             perfHash.nodiv);
+        out.write((const char*)perfHash.g, perfHash.r * sizeof(uint32_t));
+    }
+
+    void DumpPhfPacked(std::ostream& out, const phf& perfHash) const {
+        NHandyPack::Dump(out, perfHash.d_max,
+                             perfHash.g_op,
+                             perfHash.m,
+                             perfHash.r,
+                             perfHash.seed,
+                             perfHash.nodiv);
+        uint32_t maxDisplacement = 0;
+        for (size_t i = 0; i < perfHash.r; ++i) {
+            maxDisplacement = std::max(maxDisplacement, perfHash.g[i]);
+        }
+        TPackedArray g(perfHash.r, TPackedArray::BitsFor(maxDisplacement));
+        for (size_t i = 0; i < perfHash.r; ++i) {
+            g.Set(i, perfHash.g[i]);
+        }
+        NHandyPack::Dump(out, g);
+    }
+
+    void LoadPhf(std::istream& in, phf& perfHash) {
+        perfHash = phf();
+        NHandyPack::Load(in, perfHash.d_max,
+                            perfHash.g_op,
+                            perfHash.m,
+                            perfHash.r,
+                            perfHash.seed,
+                            perfHash.nodiv);
+        perfHash.g = (uint32_t*)calloc(perfHash.r, sizeof(uint32_t));
+        in.read((char*)perfHash.g, perfHash.r * sizeof(uint32_t));
+    }
+
+    void LoadPhfPacked(std::istream& in, phf& perfHash) {
+        perfHash = phf();
+        NHandyPack::Load(in, perfHash.d_max,
+                            perfHash.g_op,
+                            perfHash.m,
+                            perfHash.r,
+                            perfHash.seed,
+                            perfHash.nodiv);
+        TPackedArray g;
+        NHandyPack::Load(in, g);
+        perfHash.g = (uint32_t*)calloc(perfHash.r, sizeof(uint32_t));
+        if (g.Size() != perfHash.r) {
+            in.setstate(std::ios::failbit);
+            return;
+        }
+        for (size_t i = 0; i < perfHash.r; ++i) {
+            perfHash.g[i] = g.Get(i);
+        }
+    }
+};
+
+static inline uint32_t PhfBucket(const phf& p, uint32_t d, const char* value, size_t size) {
+    uint32_t h1 = PhfRound32(d, p.seed);
+    h1 = PhfRound32((const unsigned char*)value, size, h1);
+    return PhfReduce(PhfMix32(h1), p.m, p.nodiv);
+}
+
+// First stage of a phf lookup: picks the partition and the displacement slot
+static inline uint32_t PhfDisplacementSlot(const TPerfectHashImpl& impl, uint32_t h1,
+                                           uint32_t& partition, uint32_t* fingerprint)
+{
+    if (fingerprint) {
+        *fingerprint = PhfMix32(h1 ^ FINGERPRINT_SALT);
+    }
+    partition = impl.Partition(PhfMix32(h1 ^ PARTITION_SALT));
+    const phf& p = impl.Phfs[partition];
+    return PhfReduce(PhfMix32(h1), p.r, p.nodiv);
+}
+
+static inline uint64_t CompactKeyHash(const char* value, size_t size) {
+    return CityHash64WithSeed(value, size, COMPACT_SEED);
+}
+
+static inline uint32_t CompactPartition(const TPerfectHashImpl& impl, uint64_t hash) {
+    return impl.Partition(uint32_t(hash >> 32));
+}
+
+static inline uint32_t CompactFingerprint(uint64_t hash) {
+    return uint32_t(hash);
+}
+
+#ifdef JAMSPELL_AVX2_KERNEL
+
+// AVX2 versions of the functions above, hashing eight keys of the same
+// width per call: lane i holds the state of key i.
+
+constexpr size_t AVX2_LANES = 8;
+constexpr size_t AVX2_MAX_KEY_WORDS = 8;
+
+template<int R>
+__attribute__((target("avx2")))
+static inline __m256i PhfRotl32x8(__m256i x) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, R), _mm256_srli_epi32(x, 32 - R));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i PhfRound32x8(__m256i k1, __m256i h1) {
+    k1 = _mm256_mullo_epi32(k1, _mm256_set1_epi32(0xcc9e2d51));
+    k1 = PhfRotl32x8<15>(k1);
+    k1 = _mm256_mullo_epi32(k1, _mm256_set1_epi32(0x1b873593));
+
+    h1 = _mm256_xor_si256(h1, k1);
+    h1 = PhfRotl32x8<13>(h1);
+    h1 = _mm256_add_epi32(_mm256_mullo_epi32(h1, _mm256_set1_epi32(5)), _mm256_set1_epi32(0xe6546b64));
+    return h1;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i PhfMix32x8(__m256i h1) {
+    h1 = _mm256_xor_si256(h1, _mm256_srli_epi32(h1, 16));
+    h1 = _mm256_mullo_epi32(h1, _mm256_set1_epi32(0x85ebca6b));
+    h1 = _mm256_xor_si256(h1, _mm256_srli_epi32(h1, 13));
+    h1 = _mm256_mullo_epi32(h1, _mm256_set1_epi32(0xc2b2ae35));
+    h1 = _mm256_xor_si256(h1, _mm256_srli_epi32(h1, 16));
+    return h1;
+}
+
+// Loads word j of eight consecutive keys, converted to big-endian like PhfRound32 reads them
+__attribute__((target("avx2")))
+static inline __m256i PhfLoadWords32x8(const char* keys, size_t words, size_t j) {
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(lanes, _mm256_set1_epi32(words)), _mm256_set1_epi32(j));
+    __m256i w = _mm256_i32gather_epi32((const int*)keys, index, 4);
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    return _mm256_shuffle_epi8(w, bswap);
+}
+
+__attribute__((target("avx2")))
+static void PhfDisplacementSlotsAvx2(const TPerfectHashImpl& impl, const char* keys, size_t keySize,
+                                     size_t count, uint32_t* slots, uint32_t* partitions,
+                                     uint32_t* fingerprints)
+{
+    size_t words = keySize / 4;
+    bool partitioned = impl.Offsets.size() > 1;
+    alignas(32) uint32_t hashes[AVX2_LANES];
+    alignas(32) uint32_t partitionHashes[AVX2_LANES] = {};
+    for (size_t i = 0; i + AVX2_LANES <= count; i += AVX2_LANES) {
+        const char* batchKeys = keys + i * keySize;
+        __m256i h1 = _mm256_set1_epi32(impl.Seed);
+        for (size_t j = 0; j < words; ++j) {
+            h1 = PhfRound32x8(PhfLoadWords32x8(batchKeys, words, j), h1);
+        }
+        if (fingerprints) {
+            __m256i fp = PhfMix32x8(_mm256_xor_si256(h1, _mm256_set1_epi32(FINGERPRINT_SALT)));
+            _mm256_storeu_si256((__m256i*)(fingerprints + i), fp);
+        }
+        if (partitioned) {
+            __m256i ph = PhfMix32x8(_mm256_xor_si256(h1, _mm256_set1_epi32(PARTITION_SALT)));
+            _mm256_store_si256((__m256i*)partitionHashes, ph);
+        }
+        _mm256_store_si256((__m256i*)hashes, PhfMix32x8(h1));
+        for (size_t k = 0; k < AVX2_LANES; ++k) {
+            partitions[i + k] = impl.Partition(partitionHashes[k]);
+            const phf& p = impl.Phfs[partitions[i + k]];
+            slots[i + k] = PhfReduce(hashes[k], p.r, p.nodiv);
+            Prefetch(&p.g[slots[i + k]]);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void PhfBucketsAvx2(const TPerfectHashImpl& impl, const char* keys, size_t keySize,
+                           size_t count, uint32_t* buckets, const uint32_t* partitions)
+{
+    size_t words = keySize / 4;
+    alignas(32) uint32_t hashes[AVX2_LANES];
+    alignas(32) uint32_t displacements[AVX2_LANES];
+    for (size_t i = 0; i + AVX2_LANES <= count; i += AVX2_LANES) {
+        const char* batchKeys = keys + i * keySize;
+        for (size_t k = 0; k < AVX2_LANES; ++k) {
+            displacements[k] = impl.Phfs[partitions[i + k]].g[buckets[i + k]];
+        }
+        __m256i d = _mm256_load_si256((const __m256i*)displacements);
+        __m256i h1 = PhfRound32x8(d, _mm256_set1_epi32(impl.Seed));
+        for (size_t j = 0; j < words; ++j) {
+            h1 = PhfRound32x8(PhfLoadWords32x8(batchKeys, words, j), h1);
+        }
+        _mm256_store_si256((__m256i*)hashes, PhfMix32x8(h1));
+        for (size_t k = 0; k < AVX2_LANES; ++k) {
+            const phf& p = impl.Phfs[partitions[i + k]];
+            buckets[i + k] = impl.Offsets[partitions[i + k]] + PhfReduce(hashes[k], p.m, p.nodiv);
+        }
+    }
+}
+
+static bool CanUseAvx2(size_t keySize) {
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2 && keySize % 4 == 0 && keySize / 4 <= AVX2_MAX_KEY_WORDS;
+}
+
+#endif
+
+static void PhfHashBlock(const TPerfectHashImpl& impl, const char* keys, size_t keySize,
+                         size_t count, uint32_t* buckets, uint32_t* fingerprints)
+{
+    assert(count <= BATCH_BLOCK);
+    uint32_t partitions[BATCH_BLOCK];
+    size_t from = 0;
+#ifdef JAMSPELL_AVX2_KERNEL
+    if (CanUseAvx2(keySize)) {
+        from = count - count % AVX2_LANES;
+        PhfDisplacementSlotsAvx2(impl, keys, keySize, from, buckets, partitions, fingerprints);
+    }
+#endif
+    for (size_t i = from; i < count; ++i) {
+        uint32_t* fingerprint = fingerprints ? fingerprints + i : nullptr;
+        uint32_t h1 = PhfRound32((const unsigned char*)(keys + i * keySize), keySize, impl.Seed);
+        buckets[i] = PhfDisplacementSlot(impl, h1, partitions[i], fingerprint);
+        Prefetch(&impl.Phfs[partitions[i]].g[buckets[i]]);
+    }
+#ifdef JAMSPELL_AVX2_KERNEL
+    if (from) {
+        PhfBucketsAvx2(impl, keys, keySize, from, buckets, partitions);
+    }
+#endif
+    for (size_t i = from; i < count; ++i) {
+        const phf& p = impl.Phfs[partitions[i]];
+        buckets[i] = impl.Offsets[partitions[i]] + PhfBucket(p, p.g[buckets[i]], keys + i * keySize, keySize);
+    }
+}
+
+static void CompactHashBlock(const TPerfectHashImpl& impl, const char* keys, size_t keySize,
+                             size_t count, uint32_t* buckets, uint32_t* fingerprints)
+{
+    assert(count <= BATCH_BLOCK);
+    uint64_t hashes[BATCH_BLOCK];
+    for (size_t i = 0; i < count; ++i) {
+        hashes[i] = CompactKeyHash(keys + i * keySize, keySize);
+        impl.Compact[CompactPartition(impl, hashes[i])].Prefetch(hashes[i]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t partition = CompactPartition(impl, hashes[i]);
+        buckets[i] = impl.Offsets[partition] + impl.Compact[partition].Find(hashes[i]);
+        if (fingerprints) {
+            fingerprints[i] = CompactFingerprint(hashes[i]);
+        }
+    }
+}
+
+// Runs func(0) ... func(count - 1) on the given number of threads
+static void ParallelFor(size_t count, uint32_t threads, const std::function<void(size_t)>& func) {
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            func(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (uint32_t i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t: pool) {
+        t.join();
+    }
+}
+
 void TPerfectHash::Dump(std::ostream& out) const {
-    const phf& perfHash = *(const phf*)Phf;
-    NHandyPack::Dump(out, perfHash.d_max,
-                         perfHash.g_op,
-                         perfHash.m,
-                         perfHash.r,
-                         perfHash.seed,
-                         perfHash.nodiv);
-    out.write((const char*)perfHash.g, perfHash.r * sizeof(uint32_t));
+    Dump(out, false);
+}
+
+void TPerfectHash::DumpPacked(std::ostream& out) const {
+    Dump(out, true);
 }
 
 void TPerfectHash::Load(std::istream& in) {
+    Load(in, false);
+}
+
+void TPerfectHash::LoadPacked(std::istream& in) {
+    Load(in, true);
+}
+
+void TPerfectHash::Dump(std::ostream& out, bool packed) const {
+    assert(PerfectHash && "Not initialized");
+    const TPerfectHashImpl& impl = *PerfectHash;
+    NHandyPack::Dump(out, impl.Backend, impl.Seed, impl.Offsets, impl.Buckets);
+    for (const phf& p: impl.Phfs) {
+        if (packed) {
+            impl.DumpPhfPacked(out, p);
+        } else {
+            impl.DumpPhf(out, p);
+        }
+    }
+    for (const TCompactHash& compact: impl.Compact) {
+        NHandyPack::Dump(out, compact);
+    }
+}
+
+void TPerfectHash::Load(std::istream& in, bool packed) {
+    Clear();
+    std::unique_ptr<TPerfectHashImpl> impl(new TPerfectHashImpl());
+    NHandyPack::Load(in, impl->Backend, impl->Seed, impl->Offsets, impl->Buckets);
+    if (impl->Backend == PHB_PHF) {
+        impl->Phfs.resize(impl->Offsets.size());
+        for (phf& p: impl->Phfs) {
+            if (packed) {
+                impl->LoadPhfPacked(in, p);
+            } else {
+                impl->LoadPhf(in, p);
+            }
+        }
+    } else {
+        impl->Compact.resize(impl->Offsets.size());
+        for (TCompactHash& compact: impl->Compact) {
+            NHandyPack::Load(in, compact);
+        }
+    }
+    PerfectHash = std::move(impl);
+}
+
+void TPerfectHash::LoadLegacy(std::istream& in) {
     Clear();
-    Phf = new phf();
-    phf& perfHash = *(phf*)Phf;
-    NHandyPack::Load(in, perfHash.d_max,
-                        perfHash.g_op,
-                        perfHash.m,
-                        perfHash.r,
-                        perfHash.seed,
-                        perfHash.nodiv);
-    perfHash.g = (uint32_t*)calloc(perfHash.r, sizeof(uint32_t));
-    in.read((char*)perfHash.g, perfHash.r * sizeof(uint32_t));
+    std::unique_ptr<TPerfectHashImpl> impl(new TPerfectHashImpl());
+    impl->Phfs.resize(1);
+    impl->LoadPhf(in, impl->Phfs[0]);
+    impl->Seed = impl->Phfs[0].seed;
+    impl->Offsets.push_back(0);
+    impl->Buckets = impl->Phfs[0].m;
+    PerfectHash = std::move(impl);
 }
 
 bool TPerfectHash::Init(const std::vector<std::string>& keys) {
-    std::vector<phf_string_t> keysForPhf;
-    keysForPhf.reserve(keys.size());
-    for (const std::string& s: keys) {
-        keysForPhf.push_back({&s[0], s.size()});
+    return Init(keys, TPerfectHashOptions());
+}
+
+bool TPerfectHash::Init(const std::vector<std::string>& keys, const TPerfectHashOptions& options) {
+    std::unique_ptr<TPerfectHashImpl> impl(new TPerfectHashImpl());
+    impl->Backend = options.Backend;
+    // 0 is taken as 1, a partition per key
+    uint64_t partitionKeys = std::max<uint64_t>(1, options.PartitionKeys);
+    size_t partitions = std::max<uint64_t>(1, keys.size() / partitionKeys + (keys.size() % partitionKeys != 0));
+    impl->Offsets.resize(partitions);
+    uint32_t threads = options.Threads ? options.Threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<size_t>(threads, partitions);
+
+    std::atomic<bool> failed(false);
+    if (impl->Backend == PHB_PHF) {
+        std::vector<std::vector<phf_string_t>> partitionKeys(partitions);
+        for (const std::string& s: keys) {
+            uint32_t h1 = PhfRound32((const unsigned char*)s.data(), s.size(), impl->Seed);
+            uint32_t partition = impl->Partition(PhfMix32(h1 ^ PARTITION_SALT));
+            partitionKeys[partition].push_back({&s[0], s.size()});
+        }
+        impl->Phfs.resize(partitions, phf());
+        ParallelFor(partitions, threads, [&](size_t i) {
+            std::vector<phf_string_t>& k = partitionKeys[i];
+            phf_error_t res = PHF::init<phf_string_t, false>(&impl->Phfs[i], k.data(), k.size(), 4, 80, PHF_SEED);
+            assert(res != 0 || impl->Phfs[i].g_op == phf::PHF_G_UINT32_MOD_R);
+            if (res != 0) {
+                failed = true;
+            }
+            std::vector<phf_string_t>().swap(k);
+        });
+    } else {
+        std::vector<std::vector<uint64_t>> partitionHashes(partitions);
+        for (const std::string& s: keys) {
+            uint64_t hash = CompactKeyHash(s.data(), s.size());
+            partitionHashes[CompactPartition(*impl, hash)].push_back(hash);
+        }
+        impl->Compact.resize(partitions);
+        ParallelFor(partitions, threads, [&](size_t i) {
+            impl->Compact[i].Build(partitionHashes[i]);
+        });
+    }
+    if (failed) {
+        return false;
     }
 
-    phf* tempPhf = new phf();
-    phf_error_t res = PHF::init<phf_string_t, false>(tempPhf, &keysForPhf[0], keysForPhf.size(), 4, 80, 42);
-    if (res != 0) {
-        PHF::destroy(tempPhf);
-        delete tempPhf;
+    uint64_t buckets = 0;
+    for (size_t i = 0; i < partitions; ++i) {
+        impl->Offsets[i] = buckets;
+        buckets += impl->Backend == PHB_PHF ? impl->Phfs[i].m : impl->Compact[i].Size();
+    }
+    if (buckets > std::numeric_limits<uint32_t>::max()) {
         return false;
     }
-    Clear();
-    Phf = tempPhf;
+    impl->Buckets = buckets;
+    PerfectHash = std::move(impl);
     return true;
 }
 
 void TPerfectHash::Clear() {
-    if (!Phf) {
-        return;
-    }
-    PHF::destroy((phf*)Phf);
-    delete (phf*)Phf;
+    PerfectHash.reset();
 }
 
 uint32_t TPerfectHash::Hash(const std::string& value) const {
-    assert(Phf && "Not initialized");
-    return PHF::hash<std::string>((phf*)Phf, value);
+    return Hash(value.data(), value.size());
 }
 
 uint32_t TPerfectHash::Hash(const char* value, size_t size) const {
-    assert(Phf && "Not initialized");
-    phf_string_t phfValue = {value, size};
-    return PHF::hash<phf_string_t>((phf*)Phf, phfValue);
+    uint32_t fingerprint;
+    return Hash(value, size, fingerprint);
 }
 
-uint32_t TPerfectHash::BucketsNumber() const {
-    const phf* p = (phf*)Phf;
-    return p->m;
+uint32_t TPerfectHash::Hash(const char* value, size_t size, uint32_t& fingerprint) const {
+    assert(PerfectHash && "Not initialized");
+    const TPerfectHashImpl& impl = *PerfectHash;
+    if (impl.Backend == PHB_COMPACT) {
+        uint64_t hash = CompactKeyHash(value, size);
+        uint32_t partition = CompactPartition(impl, hash);
+        fingerprint = CompactFingerprint(hash);
+        return impl.Offsets[partition] + impl.Compact[partition].Find(hash);
+    }
+    uint32_t partition = 0;
+    uint32_t h1 = PhfRound32((const unsigned char*)value, size, impl.Seed);
+    uint32_t slot = PhfDisplacementSlot(impl, h1, partition, &fingerprint);
+    const phf& p = impl.Phfs[partition];
+    return impl.Offsets[partition] + PhfBucket(p, p.g[slot], value, size);
 }
 
-TPerfectHash::TPerfectHash()
-    : Phf(nullptr)
+void TPerfectHash::HashBatch(const char* keys, size_t keySize, size_t count,
+                             uint32_t* buckets, uint32_t* fingerprints) const
 {
+    assert(PerfectHash && "Not initialized");
+    const TPerfectHashImpl& impl = *PerfectHash;
+    for (size_t from = 0; from < count; from += BATCH_BLOCK) {
+        size_t n = std::min(BATCH_BLOCK, count - from);
+        uint32_t* blockFingerprints = fingerprints ? fingerprints + from : nullptr;
+        if (impl.Backend == PHB_COMPACT) {
+            CompactHashBlock(impl, keys + from * keySize, keySize, n, buckets + from, blockFingerprints);
+        } else {
+            PhfHashBlock(impl, keys + from * keySize, keySize, n, buckets + from, blockFingerprints);
+        }
+    }
+}
+
+uint32_t TPerfectHash::BucketsNumber() const {
+    assert(PerfectHash && "Not initialized");
+    return PerfectHash->Buckets;
+}
+
+EPerfectHashBackend TPerfectHash::GetBackend() const {
+    assert(PerfectHash && "Not initialized");
+    return EPerfectHashBackend(PerfectHash->Backend);
+}
+
+uint32_t TPerfectHash::PartitionsNumber() const {
+    assert(PerfectHash && "Not initialized");
+    return PerfectHash->Offsets.size();
+}
+
+uint64_t TPerfectHash::ByteSize() const {
+    assert(PerfectHash && "Not initialized");
+    uint64_t size = PerfectHash->Offsets.size() * sizeof(uint32_t);
+    for (const phf& p: PerfectHash->Phfs) {
+        size += p.r * sizeof(uint32_t);
+    }
+    for (const TCompactHash& compact: PerfectHash->Compact) {
+        size += compact.ByteSize();
+    }
+    return size;
+}
+
+TPerfectHash::TPerfectHash() {
 }
 
 TPerfectHash::~TPerfectHash() {
-    Clear();
 }
 
 } // NJamSpell
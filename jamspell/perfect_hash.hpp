@@ -1,9 +1,28 @@
 #pragma once
 
 #include <ostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
 
 namespace NJamSpell {
 
+enum EPerfectHashBackend: uint8_t {
+    PHB_PHF = 0,        // CHD displacement hash from contrib/phf, two probes per key
+    PHB_COMPACT = 1,    // minimal BBHash-style hash, about a third of the size
+};
+
+struct TPerfectHashOptions {
+    EPerfectHashBackend Backend = PHB_PHF;
+    // Keys are split by a top-level hash into partitions of about this
+    // many keys, built independently and in parallel (0 is taken as 1)
+    uint64_t PartitionKeys = 1 << 22;
+    uint32_t Threads = 0; // 0 - one per cpu
+};
+
+struct TPerfectHashImpl;
+
 class TPerfectHash {
 public:
     TPerfectHash();
@@ -11,13 +30,33 @@ public:
     ~TPerfectHash();
     void Dump(std::ostream& out) const;
     void Load(std::istream& in);
+    // Same with the displacements bit-packed to the width of the largest
+    // one instead of 32 bits, unpacked again at load
+    void DumpPacked(std::ostream& out) const;
+    void LoadPacked(std::istream& in);
+    // Loads a single phf as stored by legacy models
+    void LoadLegacy(std::istream& in);
     bool Init(const std::vector<std::string>& keys);
+    bool Init(const std::vector<std::string>& keys, const TPerfectHashOptions& options);
     void Clear();
     uint32_t Hash(const std::string& value) const;
     uint32_t Hash(const char* value, size_t size) const;
+    // Also returns a key fingerprint derived from the same hash state
+    uint32_t Hash(const char* value, size_t size, uint32_t& fingerprint) const;
+    // Hashes count keys of keySize bytes each, stored back to back, using
+    // AVX2 when the cpu supports it. The first probe of every key is
+    // prefetched before resolving any. Fingerprints are optional.
+    void HashBatch(const char* keys, size_t keySize, size_t count,
+                   uint32_t* buckets, uint32_t* fingerprints = nullptr) const;
     uint32_t BucketsNumber() const;
+    EPerfectHashBackend GetBackend() const;
+    uint32_t PartitionsNumber() const;
+    uint64_t ByteSize() const;
+private:
+    void Dump(std::ostream& out, bool packed) const;
+    void Load(std::istream& in, bool packed);
 private:
-    void* Phf; // sort of forward declaration
+    std::unique_ptr<TPerfectHashImpl> PerfectHash;
 };
 
 } // NJamSpell
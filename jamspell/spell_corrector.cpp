@@ -1,44 +1,48 @@
 #include <algorithm>
 #include <fstream>
+#include <cstdio>
 
 #include "spell_corrector.hpp"
 
 namespace NJamSpell {
 
 
-static std::vector<std::wstring> GetDeletes1(const std::wstring& w) {
-    std::vector<std::wstring> results;
-    for (size_t i = 0; i < w.size(); ++i) {
-        auto nw = w.substr(0, i) + w.substr(i+1);
-        if (!nw.empty()) {
-            results.push_back(nw);
-        }
-    }
-    return results;
-}
+// Section of model files with the candidate cache
+constexpr const char* SPELL_CACHE_SECTION = "deletes";
 
-static std::vector<std::vector<std::wstring>> GetDeletes2(const std::wstring& w) {
-    std::vector<std::vector<std::wstring>> results;
-    for (size_t i = 0; i < w.size(); ++i) {
-        auto nw = w.substr(0, i) + w.substr(i+1);
-        if (!nw.empty()) {
-            std::vector<std::wstring> currResults = GetDeletes1(nw);
-            currResults.push_back(nw);
-            results.push_back(currResults);
-        }
-    }
-    return results;
+// By content, so that candidates with equal counts or scores come in the
+// same order whatever the addresses of their words
+static bool WordLess(const TWord& a, const TWord& b) {
+    return std::lexicographical_compare(a.Ptr, a.Ptr + a.Len, b.Ptr, b.Ptr + b.Len);
 }
 
-bool TSpellCorrector::LoadLangModel(const std::string& modelFile) {
-    if (!LangModel.Load(modelFile)) {
+bool TSpellCorrector::LoadLangModel(const std::string& modelFile, bool saveCache) {
+    TModelContainer container;
+    if (container.Open(modelFile, LANG_MODEL_MAGIC_BYTE, LANG_MODEL_VERSION)) {
+        if (!LangModel.Load(container)) {
+            return false;
+        }
+        bool cacheLoaded = false;
+        if (container.HasSection(SPELL_CACHE_SECTION)) {
+            container.LoadSection(SPELL_CACHE_SECTION, [this, &cacheLoaded](std::istream& in) {
+                cacheLoaded = LoadCache(in);
+            });
+        }
+        if (cacheLoaded) {
+            AdviseMemory();
+            return true;
+        }
+    } else if (!LangModel.Load(modelFile)) {
         return false;
     }
     std::string cacheFile = modelFile + ".spell";
     if (!LoadCache(cacheFile)) {
         PrepareCache();
-        SaveCache(cacheFile);
+        if (saveCache) {
+            SaveCache(cacheFile);
+        }
     }
+    AdviseMemory();
     return true;
 }
 
@@ -47,30 +51,145 @@ bool TSpellCorrector::TrainLangModel(const std::string& textFile, const std::str
         return false;
     }
     PrepareCache();
-    if (!LangModel.Dump(modelFile)) {
+    return SaveLangModel(modelFile);
+}
+
+bool TSpellCorrector::SaveLangModel(const std::string& modelFile, bool compressed) const {
+    if (!Deletes1 || !Deletes2 || LangModel.GetDeltaSize()) {
         return false;
     }
-    std::string cacheFile = modelFile + ".spell";
-    if (!SaveCache(cacheFile)) {
+    TModelWriter writer;
+    LangModel.AddSections(writer, compressed);
+    writer.AddSection(SPELL_CACHE_SECTION, [this](std::ostream& out) {
+        SaveCache(out);
+    });
+    return writer.Save(modelFile, LANG_MODEL_MAGIC_BYTE, LANG_MODEL_VERSION);
+}
+
+void TSpellCorrector::SwapLangModel(TLangModel& model) {
+    LangModel.Swap(model);
+    PrepareCache();
+    AdviseMemory();
+}
+
+bool TSpellCorrector::UpdateLangModel(const std::string& countsFile) {
+    TNgramCounts counts;
+    if (!counts.Load(countsFile)) {
+        std::cerr << "[error] failed to load n-gram counts" << std::endl;
+        return false;
+    }
+    std::vector<std::wstring> newWords;
+    for (auto&& word: counts.Words) {
+        if (!word.empty() && !LangModel.GetWord(word).Ptr) {
+            newWords.push_back(word);
+        }
+    }
+    if (!LangModel.AddDelta(counts)) {
+        return false;
+    }
+    if (Deletes1 && Deletes2) {
+        for (auto&& word: newWords) {
+            // words below the minimal frequency are not in the model yet
+            if (LangModel.GetWord(word).Ptr) {
+                AddToCache(word);
+            }
+        }
+    }
+    if (Compaction.valid()) {
+        CompactionUpdates.push_back(countsFile);
+    }
+    return true;
+}
+
+bool TSpellCorrector::StartCompaction(const std::vector<std::string>& countsFiles, const TTrainOptions& options) {
+    if (Compaction.valid() || countsFiles.empty()) {
+        return false;
+    }
+    if (options.MinWordFreq > LangModel.GetMinWordFreq()) {
+        std::cerr << "[error] compaction would drop words of the model, its minimal word frequency is "
+                  << LangModel.GetMinWordFreq() << std::endl;
+        return false;
+    }
+    CompactionUpdates.clear();
+    Compaction = std::async(std::launch::async, [countsFiles, options]() {
+        std::unique_ptr<TLangModel> model;
+        TNgramCounts counts;
+        std::string mergedFile = countsFiles[0] + ".compaction";
+        bool loaded = countsFiles.size() == 1
+                          ? counts.Load(countsFiles[0])
+                          : TNgramCounts::Merge(countsFiles, mergedFile) && counts.Load(mergedFile);
+        std::remove(mergedFile.c_str());
+        if (!loaded) {
+            std::cerr << "[error] failed to load n-gram counts to compact" << std::endl;
+            return model;
+        }
+        model.reset(new TLangModel());
+        if (!model->Train(counts, options)) {
+            std::cerr << "[error] failed to rebuild model" << std::endl;
+            model.reset();
+        }
+        return model;
+    });
+    return true;
+}
+
+bool TSpellCorrector::FinishCompaction() {
+    if (!Compaction.valid()) {
         return false;
     }
+    std::unique_ptr<TLangModel> model = Compaction.get();
+    std::vector<std::string> updates;
+    updates.swap(CompactionUpdates);
+    if (!model) {
+        return false;
+    }
+    for (auto&& countsFile: updates) {
+        TNgramCounts counts;
+        if (!counts.Load(countsFile) || !model->AddDelta(counts)) {
+            std::cerr << "[error] failed to apply update " << countsFile << " to the rebuilt model" << std::endl;
+            return false;
+        }
+    }
+    // words of the old model are in the bloom filters already, the rebuilt
+    // one may also know words whose counts were split between updates
+    if (Deletes1 && Deletes2) {
+        model->ForEachWord([this](const TWord& word, TWordId) {
+            std::wstring w(word.Ptr, word.Len);
+            if (!LangModel.GetWord(w).Ptr) {
+                AddToCache(w);
+            }
+        });
+    }
+    model->SetScoringMode(LangModel.GetScoringMode());
+    LangModel.Swap(*model);
+    AdviseMemory();
     return true;
 }
 
-TScoredWords TSpellCorrector::GetCandidatesRawWithScores(const TWords& sentence, size_t position) const {
+TScoredWords TSpellCorrector::GetCandidatesRawWithScores(const TWords& sentence, size_t position,
+                                                         const TUserDictionary* dictionary) const
+{
+    TSentenceScorer scorer(LangModel, sentence, dictionary);
+    return GetCandidatesRawWithScores(sentence, position, scorer);
+}
+
+TScoredWords TSpellCorrector::GetCandidatesRawWithScores(const TWords& sentence, size_t position,
+                                                         const TSentenceScorer& scorer) const
+{
     TScoredWords scoredCandidates;
 
     if (position >= sentence.size()) {
         return scoredCandidates;
     }
 
+    const TUserDictionary* dictionary = scorer.GetDictionary();
     TWord w = sentence[position];
-    TWords candidates = Edits2(w);
+    TWords candidates = Edits2(w, dictionary);
 
     bool firstLevel = true;
     bool knownWord = false;
     if (candidates.size() < MinCandidatesToCheck) {
-        candidates = Edits(w);
+        candidates = Edits(w, dictionary);
         firstLevel = false;
     }
 
@@ -79,7 +198,7 @@ TScoredWords TSpellCorrector::GetCandidatesRawWithScores(const TWords& sentence,
     }
 
     {
-        TWord c = LangModel.GetWord(std::wstring(w.Ptr, w.Len));
+        TWord c = GetWord(std::wstring(w.Ptr, w.Len), dictionary);
         if (c.Ptr && c.Len) {
             w = c;
             candidates.push_back(c);
@@ -91,24 +210,16 @@ TScoredWords TSpellCorrector::GetCandidatesRawWithScores(const TWords& sentence,
 
     std::unordered_set<TWord, TWordHashPtr> uniqueCandidates(candidates.begin(), candidates.end());
 
-    FilterCandidatesByFrequency(uniqueCandidates, w);
+    FilterCandidatesByFrequency(uniqueCandidates, w, scorer);
     scoredCandidates.reserve(uniqueCandidates.size());
 
-    for (TWord cand: uniqueCandidates) {
-        TWords candSentence;
-        for (size_t i = 0; i < sentence.size(); ++i) {
-            if (i == position) {
-                candSentence.push_back(cand);
-            } else if ((i < position && i + 2 >= position) ||
-                       (i > position && i <= position + 2))
-            {
-                candSentence.push_back(sentence[i]);
-            }
-        }
+    TWords uniqueCandidatesList(uniqueCandidates.begin(), uniqueCandidates.end());
+    std::vector<double> scores = scorer.Score(position, uniqueCandidatesList);
 
+    for (size_t i = 0; i < uniqueCandidatesList.size(); ++i) {
         TScoredWord scored;
-        scored.Word = cand;
-        scored.Score = LangModel.Score(candSentence);
+        scored.Word = uniqueCandidatesList[i];
+        scored.Score = scores[i];
         if (!(scored.Word == w)) {
             if (knownWord) {
                 if (firstLevel) {
@@ -123,23 +234,32 @@ TScoredWords TSpellCorrector::GetCandidatesRawWithScores(const TWords& sentence,
         scoredCandidates.push_back(scored);
     }
 
-    std::sort(scoredCandidates.begin(), scoredCandidates.end(), [](TScoredWord w1, TScoredWord w2) {
-        return w1.Score > w2.Score;
+    std::sort(scoredCandidates.begin(), scoredCandidates.end(), [](const TScoredWord& w1, const TScoredWord& w2) {
+        return w1.Score != w2.Score ? w1.Score > w2.Score : WordLess(w1.Word, w2.Word);
     });
     return scoredCandidates;
 }
 
-bool TSpellCorrector::WordIsKnown(const std::wstring& word) const {
-    TWord w = LangModel.GetWord(word);
+bool TSpellCorrector::WordIsKnown(const std::wstring& word, const TUserDictionary* dictionary) const {
+    TWord w = GetWord(word, dictionary);
     if (w.Ptr && w.Len) {
         return true;
     }
     return false;
 }
 
-TWords TSpellCorrector::GetCandidatesRaw(const TWords& sentence, size_t position) const {
+TWords TSpellCorrector::GetCandidatesRaw(const TWords& sentence, size_t position,
+                                         const TUserDictionary* dictionary) const
+{
+    TSentenceScorer scorer(LangModel, sentence, dictionary);
+    return GetCandidatesRaw(sentence, position, scorer);
+}
+
+TWords TSpellCorrector::GetCandidatesRaw(const TWords& sentence, size_t position,
+                                         const TSentenceScorer& scorer) const
+{
     TWords candidates;
-    TScoredWords scoredCandidates = GetCandidatesRawWithScores(sentence, position);
+    TScoredWords scoredCandidates = GetCandidatesRawWithScores(sentence, position, scorer);
 
     for (auto s: scoredCandidates) {
         candidates.push_back(s.Word);
@@ -147,7 +267,9 @@ TWords TSpellCorrector::GetCandidatesRaw(const TWords& sentence, size_t position
     return candidates;
 }
 
-void TSpellCorrector::FilterCandidatesByFrequency(std::unordered_set<TWord, TWordHashPtr>& uniqueCandidates, TWord origWord) const {
+void TSpellCorrector::FilterCandidatesByFrequency(std::unordered_set<TWord, TWordHashPtr>& uniqueCandidates, TWord origWord,
+                                                  const TSentenceScorer& scorer) const
+{
     if (uniqueCandidates.size() <= MaxCandidatesToCheck) {
         return;
     }
@@ -155,12 +277,19 @@ void TSpellCorrector::FilterCandidatesByFrequency(std::unordered_set<TWord, TWor
     using TCountCand = std::pair<TCount, TWord>;
     std::vector<TCountCand> candidateCounts;
     for (auto&& c: uniqueCandidates) {
-        TCount cnt = LangModel.GetWordCount(LangModel.GetWordIdNoCreate(c));
+        TWordId wid = LangModel.GetWordIdNoCreate(c);
+        TCount cnt = LangModel.GetWordCount(wid);
+        if (const TUserDictionary* dictionary = scorer.GetDictionary()) {
+            if (wid == TLangModel::UnknownWordId) {
+                wid = dictionary->GetWordId(c);
+            }
+            cnt += dictionary->GetCount(&wid, 1);
+        }
         candidateCounts.push_back(std::make_pair(cnt, c));
     }
     uniqueCandidates.clear();
-    std::stable_sort(candidateCounts.begin(), candidateCounts.end(), [](const TCountCand& a, const TCountCand& b) {
-        return a.first > b.first;
+    std::sort(candidateCounts.begin(), candidateCounts.end(), [](const TCountCand& a, const TCountCand& b) {
+        return a.first != b.first ? a.first > b.first : WordLess(a.second, b.second);
     });
 
     for (size_t i = 0; i < MaxCandidatesToCheck; ++ i) {
@@ -171,11 +300,12 @@ void TSpellCorrector::FilterCandidatesByFrequency(std::unordered_set<TWord, TWor
 
 std::vector<std::pair<std::wstring,double> > TSpellCorrector::GetCandidatesWithScores(
     const std::vector<std::wstring>& sentence,
-    size_t position
+    size_t position,
+    const TUserDictionary* dictionary
 ) const {
 
     TWords words(sentence.begin(), sentence.end());
-    TScoredWords scoredCandidates = GetCandidatesRawWithScores(words, position);
+    TScoredWords scoredCandidates = GetCandidatesRawWithScores(words, position, dictionary);
 
     std::vector<std::pair<std::wstring,double> > results;
     for (auto s: scoredCandidates) {
@@ -185,12 +315,14 @@ std::vector<std::pair<std::wstring,double> > TSpellCorrector::GetCandidatesWithS
     return results;
 }
 
-std::vector<std::wstring> TSpellCorrector::GetCandidates(const std::vector<std::wstring>& sentence, size_t position) const {
+std::vector<std::wstring> TSpellCorrector::GetCandidates(const std::vector<std::wstring>& sentence, size_t position,
+                                                        const TUserDictionary* dictionary) const
+{
     TWords words;
     for (auto&& w: sentence) {
         words.push_back(TWord(w));
     }
-    TWords candidates = GetCandidatesRaw(words, position);
+    TWords candidates = GetCandidatesRaw(words, position, dictionary);
     std::vector<std::wstring> results;
     for (auto&& c: candidates) {
         results.push_back(std::wstring(c.Ptr, c.Len));
@@ -198,7 +330,7 @@ std::vector<std::wstring> TSpellCorrector::GetCandidates(const std::vector<std::
     return results;
 }
 
-std::wstring TSpellCorrector::FixFragment(const std::wstring& text) const {
+std::wstring TSpellCorrector::FixFragment(const std::wstring& text, const TUserDictionary* dictionary) const {
     TSentences origSentences = LangModel.Tokenize(text);
     std::wstring lowered = text;
     ToLower(lowered);
@@ -208,12 +340,14 @@ std::wstring TSpellCorrector::FixFragment(const std::wstring& text) const {
     for (size_t i = 0; i < sentences.size(); ++i) {
         TWords words = sentences[i];
         const TWords& origWords = origSentences[i];
+        TSentenceScorer scorer(LangModel, words, dictionary);
         for (size_t j = 0; j < words.size(); ++j) {
             TWord orig = origWords[j];
             TWord lowered = words[j];
-            TWords candidates = GetCandidatesRaw(words, j);
+            TWords candidates = GetCandidatesRaw(words, j, scorer);
             if (candidates.size() > 0) {
                 words[j] = candidates[0];
+                scorer.SetWord(j, words[j]);
             }
             size_t currOrigPos = orig.Ptr - &text[0];
             while (origPos < currOrigPos) {
@@ -243,17 +377,19 @@ std::wstring TSpellCorrector::FixFragment(const std::wstring& text) const {
     return result;
 }
 
-std::wstring TSpellCorrector::FixFragmentNormalized(const std::wstring& text) const {
+std::wstring TSpellCorrector::FixFragmentNormalized(const std::wstring& text, const TUserDictionary* dictionary) const {
     std::wstring lowered = text;
     ToLower(lowered);
     TSentences sentences = LangModel.Tokenize(lowered);
     std::wstring result;
     for (size_t i = 0; i < sentences.size(); ++i) {
         TWords words = sentences[i];
+        TSentenceScorer scorer(LangModel, words, dictionary);
         for (size_t i = 0; i < words.size(); ++i) {
-            TWords candidates = GetCandidatesRaw(words, i);
+            TWords candidates = GetCandidatesRaw(words, i, scorer);
             if (candidates.size() > 0) {
                 words[i] = candidates[0];
+                scorer.SetWord(i, words[i]);
             }
             result += std::wstring(words[i].Ptr, words[i].Len) + L" ";
         }
@@ -277,16 +413,47 @@ void TSpellCorrector::SetMaxCandidatesToCheck(size_t maxCandidatesToCheck) {
     MaxCandidatesToCheck = maxCandidatesToCheck;
 }
 
+void TSpellCorrector::SetScoringMode(EScoringMode mode) {
+    LangModel.SetScoringMode(mode);
+}
+
+void TSpellCorrector::SetMemoryOptions(const TMemoryOptions& options) {
+    MemoryOptions = options;
+}
+
 const TLangModel& TSpellCorrector::GetLangModel() const {
     return LangModel;
 }
 
+const TBloomFilter* TSpellCorrector::GetDeletes1Cache() const {
+    return Deletes1.get();
+}
+
+const TBloomFilter* TSpellCorrector::GetDeletes2Cache() const {
+    return Deletes2.get();
+}
+
+TMemoryUsage TSpellCorrector::MemoryUsage() const {
+    TMemoryUsage usage = LangModel.MemoryUsage();
+    usage.Add("deletes1", Deletes1 ? Deletes1->ByteSize() : 0);
+    usage.Add("deletes2", Deletes2 ? Deletes2->ByteSize() : 0);
+    return usage;
+}
+
 template<typename T>
 inline void AddVec(T& target, const T& source) {
     target.insert(target.end(), source.begin(), source.end());
 }
 
-TWords TSpellCorrector::Edits(const TWord& word) const {
+TWord TSpellCorrector::GetWord(const std::wstring& word, const TUserDictionary* dictionary) const {
+    TWord c = LangModel.GetWord(word);
+    if (!c.Ptr && dictionary) {
+        c = dictionary->GetWord(word);
+    }
+    return c;
+}
+
+TWords TSpellCorrector::Edits(const TWord& word, const TUserDictionary* dictionary) const {
     std::wstring w(word.Ptr, word.Len);
     TWords result;
 
@@ -295,16 +462,16 @@ TWords TSpellCorrector::Edits(const TWord& word) const {
 
     for (auto&& w1: cands) {
         for (auto&& w: w1) {
-            TWord c = LangModel.GetWord(w);
+            TWord c = GetWord(w, dictionary);
             if (c.Ptr && c.Len) {
                 result.push_back(c);
             }
             std::string s = WideToUTF8(w);
-            if (Deletes1->Contains(s)) {
-                Inserts(w, result);
+            if (Deletes1->Contains(s) || (dictionary && dictionary->HasDelete1(w))) {
+                Inserts(w, dictionary, result);
             }
-            if (Deletes2->Contains(s)) {
-                Inserts2(w, result);
+            if (Deletes2->Contains(s) || (dictionary && dictionary->HasDelete2(w))) {
+                Inserts2(w, dictionary, result);
             }
         }
     }
@@ -312,7 +479,7 @@ TWords TSpellCorrector::Edits(const TWord& word) const {
     return result;
 }
 
-TWords TSpellCorrector::Edits2(const TWord& word, bool lastLevel) const {
+TWords TSpellCorrector::Edits2(const TWord& word, const TUserDictionary* dictionary, bool lastLevel) const {
     std::wstring w(word.Ptr, word.Len);
     TWords result;
 
@@ -320,12 +487,12 @@ TWords TSpellCorrector::Edits2(const TWord& word, bool lastLevel) const {
         // delete
         if (i < w.size()) {
             std::wstring s = w.substr(0, i) + w.substr(i+1);
-            TWord c = LangModel.GetWord(s);
+            TWord c = GetWord(s, dictionary);
             if (c.Ptr && c.Len) {
                 result.push_back(c);
             }
             if (!lastLevel) {
-                AddVec(result, Edits2(TWord(s)));
+                AddVec(result, Edits2(TWord(s), dictionary));
             }
         }
 
@@ -337,12 +504,12 @@ TWords TSpellCorrector::Edits2(const TWord& word, bool lastLevel) const {
             if (i + 2 < w.size()) {
                 s += w.substr(i+2);
             }
-            TWord c = LangModel.GetWord(s);
+            TWord c = GetWord(s, dictionary);
             if (c.Ptr && c.Len) {
                 result.push_back(c);
             }
             if (!lastLevel) {
-                AddVec(result, Edits2(TWord(s)));
+                AddVec(result, Edits2(TWord(s), dictionary));
             }
         }
 
@@ -350,12 +517,12 @@ TWords TSpellCorrector::Edits2(const TWord& word, bool lastLevel) const {
         if (i < w.size()) {
             for (auto&& ch: LangModel.GetAlphabet()) {
                 std::wstring s = w.substr(0, i) + ch + w.substr(i+1);
-                TWord c = LangModel.GetWord(s);
+                TWord c = GetWord(s, dictionary);
                 if (c.Ptr && c.Len) {
                     result.push_back(c);
                 }
                 if (!lastLevel) {
-                    AddVec(result, Edits2(TWord(s)));
+                    AddVec(result, Edits2(TWord(s), dictionary));
                 }
             }
         }
@@ -364,12 +531,12 @@ TWords TSpellCorrector::Edits2(const TWord& word, bool lastLevel) const {
         {
             for (auto&& ch: LangModel.GetAlphabet()) {
                 std::wstring s = w.substr(0, i) + ch + w.substr(i);
-                TWord c = LangModel.GetWord(s);
+                TWord c = GetWord(s, dictionary);
                 if (c.Ptr && c.Len) {
                     result.push_back(c);
                 }
                 if (!lastLevel) {
-                    AddVec(result, Edits2(TWord(s)));
+                    AddVec(result, Edits2(TWord(s), dictionary));
                 }
             }
         }
@@ -378,11 +545,11 @@ TWords TSpellCorrector::Edits2(const TWord& word, bool lastLevel) const {
     return result;
 }
 
-void TSpellCorrector::Inserts(const std::wstring& w, TWords& result) const {
+void TSpellCorrector::Inserts(const std::wstring& w, const TUserDictionary* dictionary, TWords& result) const {
     for (size_t i = 0; i < w.size() + 1; ++i) {
         for (auto&& ch: LangModel.GetAlphabet()) {
             std::wstring s = w.substr(0, i) + ch + w.substr(i);
-            TWord c = LangModel.GetWord(s);
+            TWord c = GetWord(s, dictionary);
             if (c.Ptr && c.Len) {
                 result.push_back(c);
             }
@@ -390,33 +557,30 @@ void TSpellCorrector::Inserts(const std::wstring& w, TWords& result) const {
     }
 }
 
-void TSpellCorrector::Inserts2(const std::wstring& w, TWords& result) const {
+void TSpellCorrector::Inserts2(const std::wstring& w, const TUserDictionary* dictionary, TWords& result) const {
     for (size_t i = 0; i < w.size() + 1; ++i) {
         for (auto&& ch: LangModel.GetAlphabet()) {
             std::wstring s = w.substr(0, i) + ch + w.substr(i);
-            if (Deletes1->Contains(WideToUTF8(s))) {
-                Inserts(s, result);
+            if (Deletes1->Contains(WideToUTF8(s)) || (dictionary && dictionary->HasDelete1(s))) {
+                Inserts(s, dictionary, result);
             }
         }
     }
 }
 
 void TSpellCorrector::PrepareCache() {
-    auto&& wordToId = LangModel.GetWordToId();
+    // over all the words, a sample would depend on the order they come in
     size_t n = 0;
     size_t s = 0;
-    for (auto&& it: wordToId) {
+    LangModel.ForEachWord([&n, &s](const TWord& word, TWordId) {
         n += 1;
-        s += it.first.size();
-        if (n > 3000) {
-            break;
-        }
-    }
-    size_t avgWordLen = std::max(int(double(s) / n) + 1, 1);
+        s += word.Len;
+    });
+    size_t avgWordLen = std::max(int(double(s) / std::max<size_t>(n, 1)) + 1, 1);
     size_t avgWordLenMinusOne = std::max(size_t(1), avgWordLen - 1);
 
-    uint64_t deletes1size = wordToId.size() * avgWordLen;
-    uint64_t deletes2size = wordToId.size() * avgWordLen * avgWordLenMinusOne;
+    uint64_t deletes1size = n * avgWordLen;
+    uint64_t deletes2size = n * avgWordLen * avgWordLenMinusOne;
     deletes1size = std::max(uint64_t(1000), deletes1size);
     deletes1size = std::max(uint64_t(1000), deletes1size);
 
@@ -424,18 +588,29 @@ void TSpellCorrector::PrepareCache() {
     Deletes1.reset(new TBloomFilter(deletes1size, falsePositiveProb));
     Deletes2.reset(new TBloomFilter(deletes2size, falsePositiveProb));
 
-    uint64_t deletes1real = 0;
-    uint64_t deletes2real = 0;
-
-    for (auto&& it: wordToId) {
-        auto deletes = GetDeletes2(it.first);
-        for (auto&& w1: deletes) {
-            Deletes1->Insert(WideToUTF8(w1.back()));
-            deletes1real += 1;
-            for (size_t i = 0; i < w1.size() - 1; ++i) {
-                Deletes2->Insert(WideToUTF8(w1[i]));
-                deletes2real += 1;
-            }
+    LangModel.ForEachWord([this](const TWord& word, TWordId) {
+        AddToCache(std::wstring(word.Ptr, word.Len));
+    });
+}
+
+bool TSpellCorrector::AdviseMemory() const {
+    bool advised = LangModel.AdviseMemory(MemoryOptions);
+    if (Deletes1 && Deletes2) {
+        advised = Deletes1->AdviseMemory(MemoryOptions) && advised;
+        advised = Deletes2->AdviseMemory(MemoryOptions) && advised;
+    }
+    if (!advised) {
+        std::cerr << "[warning] memory options were applied only in part, lookups may be slower" << std::endl;
+    }
+    return advised;
+}
+
+void TSpellCorrector::AddToCache(const std::wstring& word) {
+    auto deletes = GetDeletes2(word);
+    for (auto&& w1: deletes) {
+        Deletes1->Insert(WideToUTF8(w1.back()));
+        for (size_t i = 0; i < w1.size() - 1; ++i) {
+            Deletes2->Insert(WideToUTF8(w1[i]));
         }
     }
 }
@@ -448,6 +623,10 @@ bool TSpellCorrector::LoadCache(const std::string& cacheFile) {
     if (!in.is_open()) {
         return false;
     }
+    return LoadCache(in);
+}
+
+bool TSpellCorrector::LoadCache(std::istream& in) {
     uint16_t version = 0;
     uint64_t magicByte = 0;
     NHandyPack::Load(in, magicByte);
@@ -477,7 +656,7 @@ bool TSpellCorrector::LoadCache(const std::string& cacheFile) {
     return true;
 }
 
-bool TSpellCorrector::SaveCache(const std::string& cacheFile) {
+bool TSpellCorrector::SaveCache(const std::string& cacheFile) const {
     std::ofstream out(cacheFile, std::ios::binary);
     if (!out.is_open()) {
         return false;
@@ -485,13 +664,17 @@ bool TSpellCorrector::SaveCache(const std::string& cacheFile) {
     if (!Deletes1 || !Deletes2) {
         return false;
     }
+    SaveCache(out);
+    return true;
+}
+
+void TSpellCorrector::SaveCache(std::ostream& out) const {
     NHandyPack::Dump(out, SPELL_CHECKER_CACHE_MAGIC_BYTE);
     NHandyPack::Dump(out, SPELL_CHECKER_CACHE_VERSION);
     NHandyPack::Dump(out, LangModel.GetCheckSum());
     Deletes1->Dump(out);
     Deletes2->Dump(out);
     NHandyPack::Dump(out, SPELL_CHECKER_CACHE_MAGIC_BYTE);
-    return true;
 }
 
 
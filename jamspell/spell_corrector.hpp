@@ -1,36 +1,84 @@
 #pragma once
 
 #include <memory>
+#include <future>
 
 #include "lang_model.hpp"
 #include "bloom_filter.hpp"
+#include "user_dictionary.hpp"
 
 namespace NJamSpell {
 
 
 class TSpellCorrector {
 public:
-    bool LoadLangModel(const std::string& modelFile);
+    // Loads the candidate cache embedded in the model or from the .spell
+    // file next to it, else builds it and, with saveCache, writes that file
+    bool LoadLangModel(const std::string& modelFile, bool saveCache = true);
+    // Saves the model with its candidate cache embedded, to load without
+    // rebuilding the cache
     bool TrainLangModel(const std::string& textFile, const std::string& alphabetFile, const std::string& modelFile);
-    bool WordIsKnown(const std::wstring& word) const;
-    NJamSpell::TScoredWords GetCandidatesRawWithScores(const NJamSpell::TWords& sentence, size_t position) const;
-    NJamSpell::TWords GetCandidatesRaw(const NJamSpell::TWords& sentence, size_t position) const;
-    std::vector<std::wstring> GetCandidates(const std::vector<std::wstring>& sentence, size_t position) const;
-    std::vector<std::pair<std::wstring,double> > GetCandidatesWithScores(const std::vector<std::wstring>& sentence, size_t position) const;
-    std::wstring FixFragment(const std::wstring& text) const;
-    std::wstring FixFragmentNormalized(const std::wstring& text) const;
+    bool SaveLangModel(const std::string& modelFile, bool compressed = false) const;
+    // Swaps a model in and builds the candidate cache for it
+    void SwapLangModel(NJamSpell::TLangModel& model);
+    // Adds n-gram counts of new text, made by the count mode, to the model
+    // as a delta layer, so its words are known right away
+    bool UpdateLangModel(const std::string& countsFile);
+    // Rebuilds the model in a background thread from the merged counts it
+    // was built from and of its updates, folding the delta into a fresh
+    // n-gram store
+    bool StartCompaction(const std::vector<std::string>& countsFiles, const NJamSpell::TTrainOptions& options);
+    // Waits for the rebuilt model, applies to it the updates made since the
+    // start, and swaps it in. Like updates, not safe while other threads use
+    // the corrector.
+    bool FinishCompaction();
+    // Methods below take an optional user dictionary, whose words are known
+    // and suggested on top of the model, see TUserDictionary
+    bool WordIsKnown(const std::wstring& word, const NJamSpell::TUserDictionary* dictionary = nullptr) const;
+    NJamSpell::TScoredWords GetCandidatesRawWithScores(const NJamSpell::TWords& sentence, size_t position,
+                                                       const NJamSpell::TUserDictionary* dictionary = nullptr) const;
+    NJamSpell::TWords GetCandidatesRaw(const NJamSpell::TWords& sentence, size_t position,
+                                       const NJamSpell::TUserDictionary* dictionary = nullptr) const;
+    std::vector<std::wstring> GetCandidates(const std::vector<std::wstring>& sentence, size_t position,
+                                            const NJamSpell::TUserDictionary* dictionary = nullptr) const;
+    std::vector<std::pair<std::wstring,double> > GetCandidatesWithScores(const std::vector<std::wstring>& sentence, size_t position,
+                                                                         const NJamSpell::TUserDictionary* dictionary = nullptr) const;
+    std::wstring FixFragment(const std::wstring& text, const NJamSpell::TUserDictionary* dictionary = nullptr) const;
+    std::wstring FixFragmentNormalized(const std::wstring& text, const NJamSpell::TUserDictionary* dictionary = nullptr) const;
     void SetPenalty(double knownWordsPenalty, double unknownWordsPenalty);
     void SetMaxCandidatesToCheck(size_t maxCandidatesToCheck);
+    void SetScoringMode(NJamSpell::EScoringMode mode);
+    // Applied to the model arrays and candidate cache of models loaded or
+    // swapped in afterwards
+    void SetMemoryOptions(const NJamSpell::TMemoryOptions& options);
     const NJamSpell::TLangModel& GetLangModel() const;
+    // Candidate cache filters of words with one and two deletes, null until
+    // a model is loaded
+    const NJamSpell::TBloomFilter* GetDeletes1Cache() const;
+    const NJamSpell::TBloomFilter* GetDeletes2Cache() const;
+    // Memory of the model and of the candidate cache filters
+    NJamSpell::TMemoryUsage MemoryUsage() const;
 private:
-    void FilterCandidatesByFrequency(std::unordered_set<NJamSpell::TWord, NJamSpell::TWordHashPtr>& uniqueCandidates, NJamSpell::TWord origWord) const;
-    NJamSpell::TWords Edits(const NJamSpell::TWord& word) const;
-    NJamSpell::TWords Edits2(const NJamSpell::TWord& word, bool lastLevel = true) const;
-    void Inserts(const std::wstring& w, NJamSpell::TWords& result) const;
-    void Inserts2(const std::wstring& w, NJamSpell::TWords& result) const;
+    NJamSpell::TScoredWords GetCandidatesRawWithScores(const NJamSpell::TWords& sentence, size_t position,
+                                                       const NJamSpell::TSentenceScorer& scorer) const;
+    NJamSpell::TWords GetCandidatesRaw(const NJamSpell::TWords& sentence, size_t position,
+                                       const NJamSpell::TSentenceScorer& scorer) const;
+    void FilterCandidatesByFrequency(std::unordered_set<NJamSpell::TWord, NJamSpell::TWordHashPtr>& uniqueCandidates, NJamSpell::TWord origWord,
+                                     const NJamSpell::TSentenceScorer& scorer) const;
+    NJamSpell::TWord GetWord(const std::wstring& word, const NJamSpell::TUserDictionary* dictionary) const;
+    NJamSpell::TWords Edits(const NJamSpell::TWord& word, const NJamSpell::TUserDictionary* dictionary) const;
+    NJamSpell::TWords Edits2(const NJamSpell::TWord& word, const NJamSpell::TUserDictionary* dictionary, bool lastLevel = true) const;
+    void Inserts(const std::wstring& w, const NJamSpell::TUserDictionary* dictionary, NJamSpell::TWords& result) const;
+    void Inserts2(const std::wstring& w, const NJamSpell::TUserDictionary* dictionary, NJamSpell::TWords& result) const;
     void PrepareCache();
+    // Applies the memory options to the model and the candidate cache,
+    // warning if the system refused some of them; they only affect speed
+    bool AdviseMemory() const;
+    void AddToCache(const std::wstring& word);
     bool LoadCache(const std::string& cacheFile);
-    bool SaveCache(const std::string& cacheFile);
+    bool LoadCache(std::istream& in);
+    bool SaveCache(const std::string& cacheFile) const;
+    void SaveCache(std::ostream& out) const;
 private:
     TLangModel LangModel;
     std::unique_ptr<TBloomFilter> Deletes1;
@@ -39,6 +87,9 @@ private:
     double UnknownWordsPenalty = 5.0;
     size_t MaxCandidatesToCheck = 14;
     size_t MinCandidatesToCheck = 1;
+    TMemoryOptions MemoryOptions;
+    std::future<std::unique_ptr<TLangModel>> Compaction;
+    std::vector<std::string> CompactionUpdates; // counts files applied while compacting, missing in the rebuilt model
 };
 
 
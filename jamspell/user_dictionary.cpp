@@ -0,0 +1,136 @@
+#include <sstream>
+#include <limits>
+#include <cerrno>
+#include <cwchar>
+#include <cwctype>
+
+#include "user_dictionary.hpp"
+
+namespace NJamSpell {
+
+static bool IsNumber(const std::wstring& token) {
+    if (token.empty()) {
+        return false;
+    }
+    for (wchar_t ch: token) {
+        if (!std::iswdigit(ch)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TUserDictionary::TUserDictionary(const TLangModel& model)
+    : Model(model)
+{
+}
+
+bool TUserDictionary::Load(const std::string& fileName) {
+    std::wstring text = UTF8ToWide(LoadFile(fileName));
+    if (text.empty()) {
+        std::cerr << "[error] empty user dictionary " << fileName << std::endl;
+        return false;
+    }
+    ToLower(text);
+    std::wistringstream lines(text);
+    std::wstring line;
+    size_t lineNumber = 0;
+    while (std::getline(lines, line)) {
+        lineNumber += 1;
+        std::wistringstream tokens(line);
+        std::vector<std::wstring> words;
+        std::wstring token;
+        while (tokens >> token) {
+            words.push_back(token);
+        }
+        if (words.empty()) {
+            continue;
+        }
+        TCount count = DEFAULT_USER_WORD_COUNT;
+        if (words.size() > 1 && IsNumber(words.back())) {
+            errno = 0;
+            unsigned long long value = std::wcstoull(words.back().c_str(), nullptr, 10);
+            if (errno == ERANGE || value > std::numeric_limits<TCount>::max()) {
+                std::cerr << "[error] wrong count in user dictionary at line " << lineNumber << std::endl;
+                return false;
+            }
+            count = TCount(value);
+            words.pop_back();
+        }
+        if (words.size() == 1) {
+            AddWord(words[0], count);
+        } else if (words.size() == 2) {
+            AddBigram(words[0], words[1], count);
+        } else {
+            std::cerr << "[warning] wrong user dictionary entry at line " << lineNumber << ", skipped" << std::endl;
+        }
+    }
+    std::cerr << "[info] loaded user dictionary " << fileName << ", new words: " << WordToId.size() << std::endl;
+    return true;
+}
+
+void TUserDictionary::AddWord(const std::wstring& word, TCount count) {
+    TWordId wid = GetOrAddWordId(word, 0);
+    Counts.Add(&wid, 1, count);
+}
+
+void TUserDictionary::AddBigram(const std::wstring& word1, const std::wstring& word2, TCount count) {
+    TWordId words[2] = {GetOrAddWordId(word1, count), GetOrAddWordId(word2, count)};
+    Counts.Add(words, 2, count);
+}
+
+TWordId TUserDictionary::GetOrAddWordId(const std::wstring& word, TCount count) {
+    TWordId wid = Model.GetWordIdNoCreate(TWord(word));
+    if (wid != TLangModel::UnknownWordId) {
+        return wid;
+    }
+    auto it = WordToId.insert(std::make_pair(word, TWordId(FIRST_USER_WORD_ID + WordToId.size())));
+    if (!it.second) {
+        return it.first->second;
+    }
+    wid = it.first->second;
+    if (count) {
+        Counts.Add(&wid, 1, count);
+    }
+    for (auto&& w1: GetDeletes2(word)) {
+        Deletes1.insert(w1.back());
+        for (size_t i = 0; i + 1 < w1.size(); ++i) {
+            Deletes2.insert(w1[i]);
+        }
+    }
+    return wid;
+}
+
+TWord TUserDictionary::GetWord(const std::wstring& word) const {
+    auto it = WordToId.find(word);
+    if (it != WordToId.end()) {
+        return TWord(&it->first[0], it->first.size());
+    }
+    return TWord();
+}
+
+TWordId TUserDictionary::GetWordId(const TWord& word) const {
+    auto it = WordToId.find(std::wstring(word.Ptr, word.Len));
+    if (it != WordToId.end()) {
+        return it->second;
+    }
+    return TLangModel::UnknownWordId;
+}
+
+TCount TUserDictionary::GetCount(const TWordId* words, size_t size) const {
+    return Counts.Find(words, size);
+}
+
+bool TUserDictionary::HasDelete1(const std::wstring& word) const {
+    return Deletes1.count(word) > 0;
+}
+
+bool TUserDictionary::HasDelete2(const std::wstring& word) const {
+    return Deletes2.count(word) > 0;
+}
+
+size_t TUserDictionary::Size() const {
+    return WordToId.size();
+}
+
+} // NJamSpell
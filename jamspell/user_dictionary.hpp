@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "lang_model.hpp"
+
+namespace NJamSpell {
+
+// Ids of the words a dictionary adds, far above any model id
+constexpr TWordId FIRST_USER_WORD_ID = 0x80000000;
+constexpr TCount DEFAULT_USER_WORD_COUNT = 10;
+
+// Words and bigrams with pseudo-counts laid over a shared model for one
+// tenant or request. Counts are keyed by the model's word ids, so the base
+// model is not copied, and the dictionary has to be rebuilt when the model
+// is replaced. Read only once filled, so threads may share one.
+//
+// File: one entry per line, "word [count]" or "word1 word2 [count]".
+class TUserDictionary {
+public:
+    explicit TUserDictionary(const TLangModel& model);
+    bool Load(const std::string& fileName);
+    void AddWord(const std::wstring& word, TCount count = DEFAULT_USER_WORD_COUNT);
+    // Words new to both the model and the dictionary are added with the
+    // bigram count
+    void AddBigram(const std::wstring& word1, const std::wstring& word2, TCount count = DEFAULT_USER_WORD_COUNT);
+
+    // Words the dictionary adds to the model vocabulary
+    TWord GetWord(const std::wstring& word) const;
+    TWordId GetWordId(const TWord& word) const;
+    // Pseudo-count of an n-gram of model and dictionary word ids
+    TCount GetCount(const TWordId* words, size_t size) const;
+    // Whether a word of the dictionary gives the string with one or two
+    // letters deleted, like the bloom filters of TSpellCorrector
+    bool HasDelete1(const std::wstring& word) const;
+    bool HasDelete2(const std::wstring& word) const;
+    size_t Size() const;
+private:
+    TWordId GetOrAddWordId(const std::wstring& word, TCount count);
+private:
+    const TLangModel& Model;
+    std::unordered_map<std::wstring, TWordId> WordToId;
+    TNgramDelta Counts;
+    std::unordered_set<std::wstring> Deletes1;
+    std::unordered_set<std::wstring> Deletes2;
+};
+
+} // NJamSpell
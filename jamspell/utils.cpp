@@ -12,6 +12,16 @@
     #include <codecvt>
 #endif
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Synchronous collapse to huge pages, missing from older libc headers
+#if defined(__linux__) && !defined(MADV_COLLAPSE)
+#define MADV_COLLAPSE 25
+#endif
+
 #include "utils.hpp"
 
 #include <contrib/cityhash/city.h>
@@ -135,6 +145,122 @@ uint64_t GetCurrentTimeMs() {
     return ms.count();
 }
 
+void GetProcessMemory(uint64_t& rss, uint64_t& peak) {
+    rss = 0;
+    peak = 0;
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        uint64_t kb = 0;
+        fields >> name >> kb;
+        if (name == "VmRSS:") {
+            rss = kb * 1024;
+        } else if (name == "VmHWM:") {
+            peak = kb * 1024;
+        }
+    }
+}
+
+constexpr uint64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+bool AdviseMemory(const void* data, uint64_t bytes, const TMemoryOptions& options) {
+#ifndef _WIN32
+    if (!data || !bytes) {
+        return true;
+    }
+    bool advised = true;
+    uintptr_t begin = uintptr_t(data);
+    uintptr_t end = begin + bytes;
+    if (options.HugePages) {
+#ifdef MADV_HUGEPAGE
+        uintptr_t hugeBegin = (begin + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        uintptr_t hugeEnd = end & ~(HUGE_PAGE_SIZE - 1);
+        if (hugeBegin < hugeEnd) {
+            void* huge = (void*)hugeBegin;
+            size_t hugeBytes = hugeEnd - hugeBegin;
+            if (madvise(huge, hugeBytes, MADV_HUGEPAGE) != 0) {
+                std::cerr << "[warning] transparent huge pages are not available" << std::endl;
+                advised = false;
+            } else {
+                // the loader has filled the array already, so collapse its
+                // pages now instead of waiting for khugepaged; kernels
+                // before 6.1 refuse it and leave the collapse to khugepaged
+                madvise(huge, hugeBytes, MADV_COLLAPSE);
+            }
+        }
+#else
+        std::cerr << "[warning] transparent huge pages are not supported" << std::endl;
+        advised = false;
+#endif
+    }
+    if (options.Prefault) {
+        uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        volatile const char* bytesData = (const char*)data;
+        char sum = 0;
+        for (uint64_t i = 0; i < bytes; i += pageSize) {
+            sum ^= bytesData[i];
+        }
+        sum ^= bytesData[bytes - 1];
+        (void)sum;
+    }
+    if (options.Lock && mlock(data, bytes) != 0) {
+        std::cerr << "[warning] failed to lock " << bytes << " bytes in memory, check RLIMIT_MEMLOCK" << std::endl;
+        advised = false;
+    }
+    return advised;
+#else
+    (void)data;
+    (void)bytes;
+    return !options.HugePages && !options.Lock;
+#endif
+}
+
+uint64_t HeapBytes(const std::wstring& str) {
+    const char* data = (const char*)str.data();
+    if (data >= (const char*)&str && data < (const char*)(&str + 1)) {
+        return 0;
+    }
+    return (str.capacity() + 1) * sizeof(wchar_t);
+}
+
+void TMemoryUsage::Add(const std::string& part, uint64_t bytes) {
+    Parts.push_back(std::make_pair(part, bytes));
+}
+
+uint64_t TMemoryUsage::Total() const {
+    uint64_t total = 0;
+    for (auto&& part: Parts) {
+        total += part.second;
+    }
+    return total;
+}
+
+std::vector<std::wstring> GetDeletes1(const std::wstring& w) {
+    std::vector<std::wstring> results;
+    for (size_t i = 0; i < w.size(); ++i) {
+        auto nw = w.substr(0, i) + w.substr(i+1);
+        if (!nw.empty()) {
+            results.push_back(nw);
+        }
+    }
+    return results;
+}
+
+std::vector<std::vector<std::wstring>> GetDeletes2(const std::wstring& w) {
+    std::vector<std::vector<std::wstring>> results;
+    for (size_t i = 0; i < w.size(); ++i) {
+        auto nw = w.substr(0, i) + w.substr(i+1);
+        if (!nw.empty()) {
+            std::vector<std::wstring> currResults = GetDeletes1(nw);
+            currResults.push_back(nw);
+            results.push_back(currResults);
+        }
+    }
+    return results;
+}
+
 static const std::locale GLocale(std::locale::classic());
 static const std::ctype<wchar_t>& GWctype = std::use_facet<std::ctype<wchar_t>>(GLocale);
 
@@ -59,14 +59,51 @@ private:
     std::locale Locale;
 };
 
+// Bytes taken by the named parts of a structure, in the order they were added
+struct TMemoryUsage {
+    std::vector<std::pair<std::string, uint64_t>> Parts;
+
+    void Add(const std::string& part, uint64_t bytes);
+    uint64_t Total() const;
+};
+
+// How the large arrays of a loaded model are kept in memory
+struct TMemoryOptions {
+    bool HugePages = false;  // transparent huge pages, fewer TLB misses on random lookups
+    bool Prefault = false;   // touch every page, so first lookups take no page faults
+    bool Lock = false;       // mlock, so pages are never reclaimed or swapped out
+};
+
+// Applies the options to an array. Huge pages cover only the 2MB aligned
+// part of it, smaller arrays are left as they are. False, with a warning,
+// if the system refused some of them.
+bool AdviseMemory(const void* data, uint64_t bytes, const TMemoryOptions& options);
+
 std::string LoadFile(const std::string& fileName);
 void SaveFile(const std::string& fileName, const std::string& data);
 std::wstring UTF8ToWide(const std::string& text);
 std::string WideToUTF8(const std::wstring& text);
 uint64_t GetCurrentTimeMs();
+// Resident and peak resident memory of the process in bytes (VmRSS and
+// VmHWM), zeros where /proc is not available
+void GetProcessMemory(uint64_t& rss, uint64_t& peak);
+// Heap memory of a string, none for short ones kept inside the object
+uint64_t HeapBytes(const std::wstring& str);
 void ToLower(std::wstring& text);
 wchar_t MakeUpperIfRequired(wchar_t orig, wchar_t sample);
 uint16_t CityHash16(const std::string& str);
 uint16_t CityHash16(const char* str, size_t size);
+// Words with one letter deleted
+std::vector<std::wstring> GetDeletes1(const std::wstring& w);
+// For every one letter delete, its own deletes followed by it
+std::vector<std::vector<std::wstring>> GetDeletes2(const std::wstring& w);
+
+inline void Prefetch(const void* addr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr);
+#else
+    (void)addr;
+#endif
+}
 
 } // NJamSpell
@@ -0,0 +1,324 @@
+#include <cstring>
+#include <cwchar>
+#include <algorithm>
+
+#include <contrib/cityhash/city.h>
+
+#include "vocab_index.hpp"
+
+namespace NJamSpell {
+
+constexpr TWordId TVocabIndex::EMPTY_ID;
+constexpr TWordId TFrontCodedVocab::EMPTY_ID;
+constexpr uint32_t TFrontCodedVocab::BLOCK_WORDS;
+
+static inline uint64_t HashWord(const wchar_t* word, size_t len) {
+    return CityHash64((const char*)word, len * sizeof(wchar_t));
+}
+
+void TVocabIndex::Build(const std::vector<const std::wstring*>& words) {
+    Clear();
+    Offsets.reserve(words.size() + 1);
+    Offsets.push_back(0);
+    for (auto&& word: words) {
+        if (word) {
+            Arena += *word;
+            Words += 1;
+        }
+        Offsets.push_back(Arena.size());
+    }
+    BuildTable();
+}
+
+void TVocabIndex::Build(std::wstring&& arena, std::vector<uint32_t>&& offsets) {
+    Clear();
+    Arena.swap(arena);
+    Offsets.swap(offsets);
+    for (size_t i = 0; i + 1 < Offsets.size(); ++i) {
+        if (Offsets[i] != Offsets[i + 1]) {
+            Words += 1;
+        }
+    }
+    BuildTable();
+}
+
+void TVocabIndex::BuildTable() {
+    // at most half full, so probe sequences stay short
+    size_t tableSize = 1;
+    while (tableSize < 2 * size_t(Words)) {
+        tableSize *= 2;
+    }
+    Table.assign(tableSize, std::make_pair(uint32_t(0), EMPTY_ID));
+    size_t mask = tableSize - 1;
+    // words are hashed a chunk ahead of their inserts, with the first
+    // probes prefetched, so that the cache misses overlap
+    constexpr size_t CHUNK_SIZE = 32;
+    uint64_t hashes[CHUNK_SIZE];
+    TWordId wordsCount = Offsets.empty() ? 0 : TWordId(Offsets.size() - 1);
+    for (TWordId from = 0; from < wordsCount; from += CHUNK_SIZE) {
+        TWordId to = std::min<TWordId>(wordsCount, from + CHUNK_SIZE);
+        for (TWordId wid = from; wid < to; ++wid) {
+            hashes[wid - from] = HashWord(&Arena[Offsets[wid]], Offsets[wid + 1] - Offsets[wid]);
+            Prefetch(&Table[hashes[wid - from] & mask]);
+        }
+        for (TWordId wid = from; wid < to; ++wid) {
+            if (Offsets[wid] == Offsets[wid + 1]) {
+                continue;
+            }
+            uint64_t hash = hashes[wid - from];
+            size_t slot = hash & mask;
+            while (Table[slot].second != EMPTY_ID) {
+                slot = (slot + 1) & mask;
+            }
+            Table[slot] = std::make_pair(uint32_t(hash >> 32), wid);
+        }
+    }
+}
+
+TWordId TVocabIndex::Find(const wchar_t* word, size_t len) const {
+    if (Table.empty()) {
+        return EMPTY_ID;
+    }
+    uint64_t hash = HashWord(word, len);
+    uint32_t check = hash >> 32;
+    size_t mask = Table.size() - 1;
+    for (size_t slot = hash & mask; Table[slot].second != EMPTY_ID; slot = (slot + 1) & mask) {
+        if (Table[slot].first != check) {
+            continue;
+        }
+        TWordId wid = Table[slot].second;
+        size_t from = Offsets[wid];
+        if (Offsets[wid + 1] - from == len && std::memcmp(&Arena[from], word, len * sizeof(wchar_t)) == 0) {
+            return wid;
+        }
+    }
+    return EMPTY_ID;
+}
+
+TWord TVocabIndex::GetWord(TWordId wid) const {
+    if (size_t(wid) + 1 >= Offsets.size() || Offsets[wid] == Offsets[wid + 1]) {
+        return TWord();
+    }
+    return TWord(&Arena[Offsets[wid]], Offsets[wid + 1] - Offsets[wid]);
+}
+
+size_t TVocabIndex::Size() const {
+    return Words;
+}
+
+bool TVocabIndex::Empty() const {
+    return Table.empty();
+}
+
+void TVocabIndex::Clear() {
+    std::wstring().swap(Arena);
+    std::vector<uint32_t>().swap(Offsets);
+    std::vector<std::pair<uint32_t, TWordId>>().swap(Table);
+    Words = 0;
+}
+
+uint64_t TVocabIndex::ByteSize() const {
+    return Arena.size() * sizeof(wchar_t) + Offsets.size() * sizeof(uint32_t) +
+           Table.size() * sizeof(Table[0]);
+}
+
+bool TVocabIndex::AdviseMemory(const TMemoryOptions& options) const {
+    bool advised = NJamSpell::AdviseMemory(Arena.data(), Arena.size() * sizeof(wchar_t), options);
+    advised = NJamSpell::AdviseMemory(Offsets.data(), Offsets.size() * sizeof(uint32_t), options) && advised;
+    advised = NJamSpell::AdviseMemory(Table.data(), Table.size() * sizeof(Table[0]), options) && advised;
+    return advised;
+}
+
+static int CompareWords(const wchar_t* a, size_t aLen, const wchar_t* b, size_t bLen) {
+    int result = std::wmemcmp(a, b, std::min(aLen, bLen));
+    if (result != 0) {
+        return result;
+    }
+    return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+}
+
+static inline void PutVarint(std::vector<uint8_t>& data, uint32_t value) {
+    while (value >= 0x80) {
+        data.push_back(uint8_t(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back(uint8_t(value));
+}
+
+static inline void SkipVarint(const uint8_t* data, uint64_t& pos) {
+    while (data[pos++] & 0x80) {
+    }
+}
+
+static inline uint32_t GetVarint(const uint8_t* data, uint64_t& pos) {
+    uint32_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+        uint8_t byte = data[pos++];
+        value |= uint32_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+void TFrontCodedVocab::Build(const TVocabIndex& vocab, TWordId lastWordId) {
+    Clear();
+    std::vector<std::pair<TWord, TWordId>> words;
+    words.reserve(vocab.Size());
+    for (TWordId wid = 0; wid < lastWordId; ++wid) {
+        TWord word = vocab.GetWord(wid);
+        if (word.Ptr) {
+            words.push_back(std::make_pair(word, wid));
+        }
+    }
+    std::sort(words.begin(), words.end(), [](const std::pair<TWord, TWordId>& a, const std::pair<TWord, TWordId>& b) {
+        return CompareWords(a.first.Ptr, a.first.Len, b.first.Ptr, b.first.Len) < 0;
+    });
+
+    SortedIds = TPackedArray(words.size(), TPackedArray::BitsFor(lastWordId));
+    Positions = TPackedArray(lastWordId, TPackedArray::BitsFor(words.size()));
+    std::vector<uint64_t> blockOffsets;
+    for (size_t i = 0; i < words.size(); ++i) {
+        const TWord& word = words[i].first;
+        size_t shared = 0;
+        if (i % BLOCK_WORDS == 0) {
+            blockOffsets.push_back(Data.size());
+        } else {
+            const TWord& prev = words[i - 1].first;
+            while (shared < word.Len && shared < prev.Len && word.Ptr[shared] == prev.Ptr[shared]) {
+                ++shared;
+            }
+        }
+        PutVarint(Data, shared);
+        PutVarint(Data, word.Len - shared);
+        for (size_t j = shared; j < word.Len; ++j) {
+            PutVarint(Data, uint32_t(word.Ptr[j]));
+        }
+        SortedIds.Set(i, words[i].second);
+        Positions.Set(words[i].second, i + 1);
+        Chars += word.Len;
+    }
+    BlockOffsets = TPackedArray(blockOffsets.size(), TPackedArray::BitsFor(Data.size()));
+    for (size_t i = 0; i < blockOffsets.size(); ++i) {
+        BlockOffsets.Set(i, blockOffsets[i]);
+    }
+}
+
+void TFrontCodedVocab::NextWord(uint64_t& pos, std::wstring& word) const {
+    word.resize(GetVarint(&Data[0], pos));
+    uint32_t len = GetVarint(&Data[0], pos);
+    for (uint32_t i = 0; i < len; ++i) {
+        word.push_back(wchar_t(GetVarint(&Data[0], pos)));
+    }
+}
+
+TWordId TFrontCodedVocab::Find(const wchar_t* word, size_t len) const {
+    // the last block whose first word is not greater than word
+    size_t from = 0;
+    size_t to = BlockOffsets.Size();
+    std::wstring current;
+    while (from < to) {
+        size_t middle = from + (to - from) / 2;
+        uint64_t pos = BlockOffsets.Get(middle);
+        NextWord(pos, current);
+        if (CompareWords(current.data(), current.size(), word, len) <= 0) {
+            from = middle + 1;
+        } else {
+            to = middle;
+        }
+    }
+    if (from == 0) {
+        return EMPTY_ID;
+    }
+    size_t block = from - 1;
+    uint64_t pos = BlockOffsets.Get(block);
+    size_t end = std::min<size_t>(SortedIds.Size(), (block + 1) * BLOCK_WORDS);
+    for (size_t i = block * BLOCK_WORDS; i < end; ++i) {
+        NextWord(pos, current);
+        int cmp = CompareWords(current.data(), current.size(), word, len);
+        if (cmp == 0) {
+            return SortedIds.Get(i);
+        }
+        if (cmp > 0) {
+            break;
+        }
+    }
+    return EMPTY_ID;
+}
+
+bool TFrontCodedVocab::GetWord(TWordId wid, std::wstring& word) const {
+    if (wid >= Positions.Size() || Positions.Get(wid) == 0) {
+        return false;
+    }
+    size_t position = Positions.Get(wid) - 1;
+    size_t block = position / BLOCK_WORDS;
+    uint64_t pos = BlockOffsets.Get(block);
+    for (size_t i = block * BLOCK_WORDS; i <= position; ++i) {
+        NextWord(pos, word);
+    }
+    return true;
+}
+
+void TFrontCodedVocab::Decode(std::wstring& arena, std::vector<uint32_t>& offsets) const {
+    // a first pass over the lengths lays the words out in id order, then
+    // every word is decoded straight to its place, its shared prefix copied
+    // from the previous word in sorted order
+    const uint8_t* data = Data.data();
+    offsets.assign(Positions.Size() + 1, 0);
+    uint64_t pos = 0;
+    for (size_t i = 0; i < SortedIds.Size(); ++i) {
+        uint32_t shared = GetVarint(data, pos);
+        uint32_t len = GetVarint(data, pos);
+        for (uint32_t j = 0; j < len; ++j) {
+            SkipVarint(data, pos);
+        }
+        offsets[SortedIds.Get(i) + 1] = shared + len;
+    }
+    for (size_t wid = 1; wid < offsets.size(); ++wid) {
+        offsets[wid] += offsets[wid - 1];
+    }
+    arena.resize(Chars);
+    pos = 0;
+    const wchar_t* prev = nullptr;
+    // ids are in frequency order, so words land at random places: their
+    // offsets and then their places are prefetched a few words ahead
+    constexpr size_t OFFSETS_AHEAD = 32;
+    constexpr size_t WORDS_AHEAD = 16;
+    size_t words = SortedIds.Size();
+    for (size_t i = 0; i < words; ++i) {
+        if (i + OFFSETS_AHEAD < words) {
+            Prefetch(&offsets[SortedIds.Get(i + OFFSETS_AHEAD)]);
+        }
+        if (i + WORDS_AHEAD < words) {
+            Prefetch(&arena[offsets[SortedIds.Get(i + WORDS_AHEAD)]]);
+        }
+        uint32_t shared = GetVarint(data, pos);
+        uint32_t len = GetVarint(data, pos);
+        wchar_t* word = &arena[offsets[SortedIds.Get(i)]];
+        if (shared) {
+            std::wmemcpy(word, prev, shared);
+        }
+        for (uint32_t j = 0; j < len; ++j) {
+            word[shared + j] = wchar_t(GetVarint(data, pos));
+        }
+        prev = word;
+    }
+}
+
+size_t TFrontCodedVocab::Size() const {
+    return SortedIds.Size();
+}
+
+void TFrontCodedVocab::Clear() {
+    std::vector<uint8_t>().swap(Data);
+    BlockOffsets = TPackedArray();
+    SortedIds = TPackedArray();
+    Positions = TPackedArray();
+    Chars = 0;
+}
+
+uint64_t TFrontCodedVocab::ByteSize() const {
+    return Data.size() + BlockOffsets.ByteSize() + SortedIds.ByteSize() + Positions.ByteSize();
+}
+
+} // NJamSpell
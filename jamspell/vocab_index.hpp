@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <limits>
+
+#include <contrib/handypack/handypack.hpp>
+#include "ngram_store.hpp"
+#include "utils.hpp"
+#include "packed_array.hpp"
+
+namespace NJamSpell {
+
+// Read-only vocabulary kept as its serialized image: words one after
+// another in an arena, arena offsets by word id, and an open addressing
+// table of word hashes and ids over them. Loading is a few block reads
+// and the index is usable right away, with no per-word allocations or
+// rehashing.
+class TVocabIndex {
+public:
+    static constexpr TWordId EMPTY_ID = std::numeric_limits<TWordId>::max();
+
+    // From (word, id) pairs, ids below lastWordId
+    template<class TWordToId>
+    void Build(const TWordToId& wordToId, TWordId lastWordId) {
+        std::vector<const std::wstring*> words(lastWordId, nullptr);
+        for (auto&& it: wordToId) {
+            if (it.second < lastWordId) {
+                words[it.second] = &it.first;
+            }
+        }
+        Build(words);
+    }
+    // From words laid out as in the index, word id i at arena[offsets[i], offsets[i + 1])
+    void Build(std::wstring&& arena, std::vector<uint32_t>&& offsets);
+    TWordId Find(const wchar_t* word, size_t len) const;
+    // Empty word for ids without one
+    TWord GetWord(TWordId wid) const;
+    size_t Size() const;
+    bool Empty() const;
+    void Clear();
+    uint64_t ByteSize() const;
+    // See NJamSpell::AdviseMemory, for the arena, offsets and table
+    bool AdviseMemory(const TMemoryOptions& options) const;
+
+    HANDYPACK(Arena, Offsets, Table, Words)
+private:
+    void Build(const std::vector<const std::wstring*>& words);
+    void BuildTable();
+private:
+    std::wstring Arena;
+    std::vector<uint32_t> Offsets;  // word id i is Arena[Offsets[i], Offsets[i + 1])
+    std::vector<std::pair<uint32_t, TWordId>> Table;  // high bits of the hash and the id, power of two size
+    uint32_t Words = 0;
+};
+
+// Compressed vocabulary for shipping models. Words are sorted and cut
+// into blocks; the first word of a block is stored whole and the others
+// as the length of the prefix shared with the previous word and the rest,
+// with lengths and characters as varints. Find and GetWord binary search
+// the block heads and decode a single block; models do not use them, they
+// decode the whole vocabulary to a TVocabIndex at load, since words are
+// referenced by pointer (TWord) and need a stable place.
+class TFrontCodedVocab {
+public:
+    static constexpr TWordId EMPTY_ID = std::numeric_limits<TWordId>::max();
+    static constexpr uint32_t BLOCK_WORDS = 16;
+
+    void Build(const TVocabIndex& vocab, TWordId lastWordId);
+    TWordId Find(const wchar_t* word, size_t len) const;
+    // False for ids without a word
+    bool GetWord(TWordId wid, std::wstring& word) const;
+    // Words in the TVocabIndex layout, see TVocabIndex::Build
+    void Decode(std::wstring& arena, std::vector<uint32_t>& offsets) const;
+    size_t Size() const;
+    void Clear();
+    uint64_t ByteSize() const;
+
+    HANDYPACK(Data, BlockOffsets, SortedIds, Positions, Chars)
+private:
+    // Decodes the word at pos over the previous one of its block in word,
+    // moving pos past it
+    void NextWord(uint64_t& pos, std::wstring& word) const;
+private:
+    std::vector<uint8_t> Data;
+    TPackedArray BlockOffsets;  // start of every block in Data
+    TPackedArray SortedIds;     // word id of every sorted word
+    TPackedArray Positions;     // sorted position + 1 of every word id, 0 for ids without a word
+    uint64_t Chars = 0;         // total length of the words
+};
+
+} // NJamSpell
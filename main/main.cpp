@@ -1,4 +1,11 @@
 #include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <limits>
+#include <cerrno>
+#include <cctype>
+#include <cstdlib>
 
 #include <jamspell/lang_model.hpp>
 #include <jamspell/spell_corrector.hpp>
@@ -7,25 +14,264 @@ using namespace NJamSpell;
 
 void PrintUsage(const char** argv) {
     std::cerr << "Usage: " << argv[0] << " mode args" << std::endl;
-    std::cerr << "    train alphabet.txt dataset.txt resultModel.bin minWordFreq  - train model" << std::endl;
+    std::cerr << "    train alphabet.txt dataset.txt resultModel.bin [minWordFreq] [options] - train model" << std::endl;
+    std::cerr << "    count alphabet.txt dataset.txt result.counts [--order=N] - count n-grams of a corpus shard" << std::endl;
+    std::cerr << "    merge result.counts input1.counts input2.counts ... - sum n-gram counts of several shards" << std::endl;
+    std::cerr << "    build input.counts resultModel.bin [minWordFreq] [options] - build model from n-gram counts" << std::endl;
     std::cerr << "    score model.bin - input sentences and get score" << std::endl;
     std::cerr << "    correct model.bin - input sentences and get corrected one" << std::endl;
     std::cerr << "    fix model.bin input.txt output.txt - automatically fix txt file" << std::endl;
     std::cerr << "    dump_vocab model.bin vocab.txt vocab_freq.txt - dump a model's vocab into a txt" << std::endl;
     std::cerr << "    finetune_vocab model.bin alphabet.txt vocab.txt resultModel.bin - finetune vocab of model" << std::endl;
+    std::cerr << "    compact model.bin resultModel.bin [model.counts] [options] - drop n-grams of removed words, rebuild the store" << std::endl;
+    std::cerr << "        with the minWordFreq and --max-model-bytes the model was trained with; models saved without them" << std::endl;
+    std::cerr << "        take --min-word-freq=N" << std::endl;
+    std::cerr << "    inspect model.bin - report n-gram counts, bucket occupancy, memory and candidate cache figures" << std::endl;
+    std::cerr << "    convert model.bin resultModel.bin [sample.txt] [--compress] [--embed-cache] - save a model of any version" << std::endl;
+    std::cerr << "        in the current format, checking that scores of the sample sentences do not change" << std::endl;
+    std::cerr << "Train options (--order, --count-sketch-bytes and --held-out only for train):" << std::endl;
+    std::cerr << "    --order=N - longest n-gram counted, 2 to 5 (3 by default)" << std::endl;
+    std::cerr << "    --bigram-block-words=N - store bigrams of the N most frequent words in a dense block" << std::endl;
+    std::cerr << "    --bigram-block-bytes=N - memory limit for the dense bigram block" << std::endl;
+    std::cerr << "    --count-sketch-bytes=N - skip n-grams below minWordFreq with an approximate counting pre-pass" << std::endl;
+    std::cerr << "    --ngram-store=hash|trie - perfect hash with fingerprints or exact trie" << std::endl;
+    std::cerr << "    --max-model-bytes=N - prune the least informative n-grams until the model fits" << std::endl;
+    std::cerr << "    --held-out=PERCENT - keep sentences out of training to report score perplexity on" << std::endl;
+    std::cerr << "    --bucket-layout=16+16|8+8|20+12|24+8 - fingerprint and count bits per n-gram" << std::endl;
+    std::cerr << "    --perfect-hash=phf|compact - perfect hash backend" << std::endl;
+    std::cerr << "    --partition-keys=N - keys per independently built perfect hash partition" << std::endl;
+    std::cerr << "    --threads=N - threads building perfect hash partitions, one per cpu by default" << std::endl;
+    std::cerr << "    --checkpoints - save training state to resultModel.bin.checkpoint.* files after the expensive phases" << std::endl;
+    std::cerr << "    --resume - continue an interrupted run with --checkpoints from its checkpoint files" << std::endl;
+    std::cerr << "    --embed-cache - build the candidate cache and save it inside the model file" << std::endl;
+    std::cerr << "    --compress - save a smaller model for shipping, decoded at load" << std::endl;
+}
+
+using TFlags = std::unordered_map<std::string, std::string>;
+
+// Splits "--name=value" options out of the positional arguments
+std::vector<std::string> ParseArgs(int argc, const char** argv, TFlags& flags) {
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            size_t eq = arg.find('=');
+            if (eq == std::string::npos) {
+                flags[arg.substr(2)] = "";
+            } else {
+                flags[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+        } else {
+            args.push_back(arg);
+        }
+    }
+    return args;
+}
+
+// Parses a decimal number that fits into value, false for anything else
+template<class T>
+bool ParseNumber(const std::string& str, T& value) {
+    if (str.empty() || !std::isdigit((unsigned char)str[0])) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long number = std::strtoull(str.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE || number > (unsigned long long)std::numeric_limits<T>::max()) {
+        return false;
+    }
+    value = T(number);
+    return true;
+}
+
+// Reads a numeric flag into value, which is left as is without the flag
+template<class T>
+bool GetNumberFlag(const TFlags& flags, const std::string& name, T& value) {
+    auto it = flags.find(name);
+    if (it == flags.end()) {
+        return true;
+    }
+    if (!ParseNumber(it->second, value)) {
+        std::cerr << "[error] wrong value of --" << name << ": " << it->second << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string GetFlag(const TFlags& flags, const std::string& name, const std::string& defaultValue) {
+    auto it = flags.find(name);
+    if (it == flags.end()) {
+        return defaultValue;
+    }
+    return it->second;
+}
+
+// Reads the train options shared by the train, build and compact modes;
+// options without a flag keep their value
+bool ParseTrainOptions(const TFlags& flags, const std::string& resultModelFile, TTrainOptions& options) {
+    if (!GetNumberFlag(flags, "order", options.Order) ||
+        !GetNumberFlag(flags, "bigram-block-words", options.BigramBlockWords) ||
+        !GetNumberFlag(flags, "bigram-block-bytes", options.BigramBlockMaxBytes) ||
+        !GetNumberFlag(flags, "count-sketch-bytes", options.CountSketchBytes) ||
+        !GetNumberFlag(flags, "max-model-bytes", options.MaxModelBytes) ||
+        !GetNumberFlag(flags, "held-out", options.HeldOutPercent) ||
+        !GetNumberFlag(flags, "partition-keys", options.PerfectHash.PartitionKeys) ||
+        !GetNumberFlag(flags, "threads", options.PerfectHash.Threads))
+    {
+        return false;
+    }
+    if (options.PerfectHash.PartitionKeys == 0) {
+        std::cerr << "[error] wrong value of --partition-keys: 0" << std::endl;
+        return false;
+    }
+    std::string store = GetFlag(flags, "ngram-store", "");
+    if (store == "trie") {
+        options.NgramStore = NS_TRIE;
+    } else if (store == "hash") {
+        options.NgramStore = NS_PERFECT_HASH;
+    } else if (!store.empty()) {
+        std::cerr << "[error] unknown n-gram store" << std::endl;
+        return false;
+    }
+    if (options.HeldOutPercent >= 100) {
+        std::cerr << "[error] held out share should be below 100%" << std::endl;
+        return false;
+    }
+    std::string layout = GetFlag(flags, "bucket-layout", "");
+    if (!layout.empty() && !ParseBucketLayout(layout, options.BucketLayout)) {
+        std::cerr << "[error] unknown bucket layout" << std::endl;
+        return false;
+    }
+    std::string backend = GetFlag(flags, "perfect-hash", "");
+    if (backend == "compact") {
+        options.PerfectHash.Backend = PHB_COMPACT;
+    } else if (backend == "phf") {
+        options.PerfectHash.Backend = PHB_PHF;
+    } else if (!backend.empty()) {
+        std::cerr << "[error] unknown perfect hash backend" << std::endl;
+        return false;
+    }
+    // a resumed run keeps saving checkpoints, in case it is interrupted again
+    options.Resume = flags.count("resume") > 0;
+    if (flags.count("checkpoints") || options.Resume) {
+        options.CheckpointPrefix = resultModelFile + ".checkpoint";
+    }
+    return true;
+}
+
+// The build and compact modes take the order from the counts or the model
+// and do no counting, so counting options would be silently ignored
+bool RejectCountingFlags(const TFlags& flags, const std::string& mode) {
+    for (auto&& flag: {"order", "held-out", "count-sketch-bytes"}) {
+        if (flags.count(flag)) {
+            std::cerr << "[error] --" << flag << " only applies to the train mode, not to " << mode << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rejects flags the mode does not take, so a misspelled option is not
+// silently ignored; modes without options take no flags at all
+bool CheckFlags(const TFlags& flags, const std::string& mode) {
+    static const std::unordered_set<std::string> TRAIN_FLAGS = {
+        "order", "bigram-block-words", "bigram-block-bytes", "count-sketch-bytes", "ngram-store",
+        "max-model-bytes", "held-out", "bucket-layout", "perfect-hash", "partition-keys", "threads",
+        "checkpoints", "resume", "embed-cache", "compress",
+    };
+    static const std::unordered_map<std::string, std::unordered_set<std::string>> MODE_FLAGS = {
+        {"count", {"order"}},
+        {"convert", {"compress", "embed-cache"}},
+    };
+    for (auto&& flag: flags) {
+        bool known = false;
+        if (mode == "train" || mode == "build" || mode == "compact") {
+            known = TRAIN_FLAGS.count(flag.first) || (mode == "compact" && flag.first == "min-word-freq");
+        } else {
+            auto it = MODE_FLAGS.find(mode);
+            known = it != MODE_FLAGS.end() && it->second.count(flag.first);
+        }
+        if (!known) {
+            std::cerr << "[error] unknown option --" << flag.first << " for " << mode << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Saves a model made by the train, build or compact modes
+int SaveModel(TLangModel& model, const std::string& resultModelFile, const TFlags& flags) {
+    bool saved = false;
+    bool compressed = flags.count("compress") > 0;
+    if (flags.count("embed-cache")) {
+        std::cerr << "[info] building candidate cache" << std::endl;
+        TSpellCorrector corrector;
+        corrector.SwapLangModel(model);
+        saved = corrector.SaveLangModel(resultModelFile, compressed);
+    } else {
+        saved = model.Dump(resultModelFile, compressed);
+    }
+    if (!saved) {
+        std::cerr << "[error] failed to save model" << std::endl;
+        return 42;
+    }
+    std::ifstream savedFile(resultModelFile, std::ios::binary | std::ios::ate);
+    std::cerr << "[info] model size: " << savedFile.tellg() << " bytes" << std::endl;
+    return 0;
 }
 
 int Train(const std::string& alphabetFile,
           const std::string& datasetFile,
           const std::string& resultModelFile,
-	  const int& minWordFreq)
+          const TTrainOptions& options,
+          const TFlags& flags)
 {
     TLangModel model;
-    model.Train(datasetFile, alphabetFile, minWordFreq);
-    model.Dump(resultModelFile);
+    if (!model.Train(datasetFile, alphabetFile, options)) {
+        std::cerr << "[error] failed to train model" << std::endl;
+        return 42;
+    }
+    return SaveModel(model, resultModelFile, flags);
+}
+
+int Count(const std::string& alphabetFile,
+          const std::string& datasetFile,
+          const std::string& resultCountsFile,
+          uint32_t order)
+{
+    TNgramCounts counts;
+    if (!counts.Count(datasetFile, alphabetFile, order)) {
+        std::cerr << "[error] failed to count n-grams" << std::endl;
+        return 42;
+    }
+    if (!counts.Dump(resultCountsFile)) {
+        std::cerr << "[error] failed to save n-gram counts" << std::endl;
+        return 42;
+    }
     return 0;
 }
 
+int Build(const std::string& countsFile,
+          const std::string& resultModelFile,
+          const TTrainOptions& options,
+          const TFlags& flags)
+{
+    TLangModel model;
+    {
+        TNgramCounts counts;
+        std::cerr << "[info] loading n-gram counts" << std::endl;
+        if (!counts.Load(countsFile)) {
+            std::cerr << "[error] failed to load n-gram counts" << std::endl;
+            return 42;
+        }
+        if (!model.Train(counts, options)) {
+            std::cerr << "[error] failed to build model" << std::endl;
+            return 42;
+        }
+    }
+    return SaveModel(model, resultModelFile, flags);
+}
+
 int Score(const std::string& modelFile) {
     TLangModel model;
     std::cerr << "[info] loading model" << std::endl;
@@ -118,68 +364,306 @@ int FinetuneVocab(const std::string& modelFile, const std::string& alphabetFile,
     return 0;
 }
 
+int Compact(const std::string& modelFile,
+            const std::string& resultModelFile,
+            const std::string& countsFile,
+            const TFlags& flags)
+{
+    TLangModel model;
+    std::cerr << "[info] loading model" << std::endl;
+    if (!model.Load(modelFile)) {
+        std::cerr << "[error] failed to load model" << std::endl;
+        return 42;
+    }
+    TTrainOptions options;
+    model.GetStoreOptions(options);
+    if (!RejectCountingFlags(flags, "compact") || !ParseTrainOptions(flags, resultModelFile, options) ||
+        !GetNumberFlag(flags, "min-word-freq", options.MinWordFreq))
+    {
+        return 42;
+    }
+    TNgramCounts counts;
+    if (!countsFile.empty()) {
+        std::cerr << "[info] loading n-gram counts" << std::endl;
+        if (!counts.Load(countsFile)) {
+            std::cerr << "[error] failed to load n-gram counts" << std::endl;
+            return 42;
+        }
+    }
+    if (!model.Compact(options, countsFile.empty() ? nullptr : &counts)) {
+        std::cerr << "[error] failed to compact model" << std::endl;
+        return 42;
+    }
+    return SaveModel(model, resultModelFile, flags);
+}
+
+// Version of a model file, 0 if it is not one
+uint16_t GetModelVersion(const std::string& modelFile) {
+    std::ifstream in(modelFile, std::ios::binary);
+    uint64_t magicByte = 0;
+    uint16_t version = 0;
+    NHandyPack::Load(in, magicByte, version);
+    if (!in.good() || magicByte != LANG_MODEL_MAGIC_BYTE) {
+        return 0;
+    }
+    return version;
+}
+
+void PrintBloomFilter(const std::string& name, const TBloomFilter* filter) {
+    if (!filter) {
+        return;
+    }
+    std::cout << name << ": " << filter->Elements() << " elements, " << filter->ByteSize() << " bytes"
+              << ", fill ratio " << filter->FillRatio()
+              << ", false positive rate " << filter->FalsePositiveRate() << std::endl;
+}
+
+int Inspect(const std::string& modelFile) {
+    uint16_t version = GetModelVersion(modelFile);
+    if (!version) {
+        std::cerr << "[error] not a model file" << std::endl;
+        return 42;
+    }
+    TSpellCorrector corrector;
+    std::cerr << "[info] loading model" << std::endl;
+    // a report writes nothing, a cache missing from the model is only built
+    if (!corrector.LoadLangModel(modelFile, false)) {
+        std::cerr << "[error] failed to load model" << std::endl;
+        return 42;
+    }
+    TModelStats stats = corrector.GetLangModel().GetStats();
+
+    std::ifstream file(modelFile, std::ios::binary | std::ios::ate);
+    std::cout << "file: " << modelFile << ", " << file.tellg() << " bytes, version " << version << std::endl;
+    TModelContainer container;
+    if (version == LANG_MODEL_VERSION && container.Open(modelFile, LANG_MODEL_MAGIC_BYTE, LANG_MODEL_VERSION)) {
+        for (auto&& section: container.GetSections()) {
+            std::cout << "section " << section.Name << ": " << section.Length << " bytes" << std::endl;
+        }
+    }
+    std::cout << "order: " << stats.Order << std::endl;
+    std::cout << "vocabulary: " << stats.VocabWords << " words, trained on " << stats.TotalWords << " words" << std::endl;
+    for (size_t n = 1; n < stats.NgramsByOrder.size(); ++n) {
+        if (n > 1 && !stats.StoreNgramsCounted) {
+            std::cout << "n-grams of order " << n << ": not counted in this file" << std::endl;
+            continue;
+        }
+        std::cout << "n-grams of order " << n << ": " << stats.NgramsByOrder[n];
+        if (n == 2 && stats.DenseBigrams) {
+            std::cout << " (" << stats.DenseBigrams << " in the dense block)";
+        }
+        std::cout << std::endl;
+    }
+    if (stats.NgramStore == NS_PERFECT_HASH) {
+        std::cout << "n-gram store: perfect hash, " << (stats.PerfectHashBackend == PHB_COMPACT ? "compact" : "phf")
+                  << " backend" << std::endl;
+        std::cout << "buckets: " << stats.Buckets << ", filled " << stats.FilledBuckets << " ("
+                  << (stats.Buckets ? 100.0 * stats.FilledBuckets / stats.Buckets : 0.0) << "%), layout "
+                  << GetBucketLayoutInfo(stats.BucketLayout).Name << std::endl;
+        std::cout << "fingerprints: " << (stats.FingerprintType == FT_CITY_HASH ? "cityhash" : "perfect hash")
+                  << ", false positive rate for unseen n-grams " << stats.FingerprintFalsePositiveRate
+                  << ", " << uint64_t(stats.FingerprintFalsePositiveRate * 1000000) << " per million lookups" << std::endl;
+    } else {
+        std::cout << "n-gram store: trie" << std::endl;
+    }
+    TMemoryUsage usage = corrector.MemoryUsage();
+    for (auto&& part: usage.Parts) {
+        std::cout << "memory, " << part.first << ": " << part.second << " bytes" << std::endl;
+    }
+    std::cout << "memory, total: " << usage.Total() << " bytes" << std::endl;
+    PrintBloomFilter("candidate cache, one delete", corrector.GetDeletes1Cache());
+    PrintBloomFilter("candidate cache, two deletes", corrector.GetDeletes2Cache());
+    return 0;
+}
+
+// Scores every line of the sample with both models, returns the number of
+// lines that differ
+size_t CompareScores(const TLangModel& model, const TLangModel& converted, const std::string& sampleFile) {
+    std::ifstream in(sampleFile);
+    size_t lines = 0;
+    size_t mismatches = 0;
+    for (std::string line; std::getline(in, line);) {
+        std::wstring text = UTF8ToWide(line);
+        double score = model.Score(text);
+        double convertedScore = converted.Score(text);
+        if (score != convertedScore) {
+            if (!mismatches) {
+                std::cerr << "[error] score of line " << lines + 1 << " changed from " << score
+                          << " to " << convertedScore << std::endl;
+            }
+            mismatches += 1;
+        }
+        lines += 1;
+    }
+    std::cerr << "[info] compared scores of " << lines << " lines, " << mismatches << " differ" << std::endl;
+    return mismatches;
+}
+
+int Convert(const std::string& modelFile,
+            const std::string& resultModelFile,
+            const std::string& sampleFile,
+            const TFlags& flags)
+{
+    std::cerr << "[info] converting model of version " << GetModelVersion(modelFile) << std::endl;
+    bool compressed = flags.count("compress") > 0;
+    TSpellCorrector corrector;
+    TLangModel model;
+    bool embedCache = flags.count("embed-cache") > 0;
+    // the corrector takes the cache from the .spell file of older models
+    // instead of rebuilding it, and writes no .spell file when there is none
+    bool loaded = embedCache ? corrector.LoadLangModel(modelFile, false) : model.Load(modelFile);
+    if (!loaded) {
+        std::cerr << "[error] failed to load model" << std::endl;
+        return 42;
+    }
+    bool saved = embedCache ? corrector.SaveLangModel(resultModelFile, compressed)
+                            : model.Dump(resultModelFile, compressed);
+    if (!saved) {
+        std::cerr << "[error] failed to save model" << std::endl;
+        return 42;
+    }
+    std::ifstream savedFile(resultModelFile, std::ios::binary | std::ios::ate);
+    std::cerr << "[info] model size: " << savedFile.tellg() << " bytes" << std::endl;
+    if (sampleFile.empty()) {
+        return 0;
+    }
+    TLangModel converted;
+    if (!converted.Load(resultModelFile)) {
+        std::cerr << "[error] failed to load converted model" << std::endl;
+        return 42;
+    }
+    if (CompareScores(embedCache ? corrector.GetLangModel() : model, converted, sampleFile)) {
+        std::cerr << "[error] converted model scores differently" << std::endl;
+        return 42;
+    }
+    return 0;
+}
+
 int main(int argc, const char** argv) {
-    if (argc < 2) {
+    TFlags flags;
+    std::vector<std::string> args = ParseArgs(argc, argv, flags);
+    if (args.size() < 2) {
+        PrintUsage(argv);
+        return 42;
+    }
+    std::string mode = args[1];
+    if (!CheckFlags(flags, mode)) {
         PrintUsage(argv);
         return 42;
     }
-    std::string mode = argv[1];
     if (mode == "train") {
-        if (argc < 5) {
+        if (args.size() < 5) {
+            PrintUsage(argv);
+            return 42;
+        }
+        std::string alphabetFile = args[2];
+        std::string datasetFile = args[3];
+        std::string resultModelFile = args[4];
+        TTrainOptions options;
+        if (args.size() >= 6 && !ParseNumber(args[5], options.MinWordFreq)) {
+            PrintUsage(argv);
+            return 42;
+        }
+        if (!ParseTrainOptions(flags, resultModelFile, options)) {
+            return 42;
+        }
+        return Train(alphabetFile, datasetFile, resultModelFile, options, flags);
+    } else if (mode == "count") {
+        if (args.size() < 5) {
+            PrintUsage(argv);
+            return 42;
+        }
+        uint32_t order = DEFAULT_GRAM_ORDER;
+        if (!GetNumberFlag(flags, "order", order)) {
+            return 42;
+        }
+        return Count(args[2], args[3], args[4], order);
+    } else if (mode == "merge") {
+        if (args.size() < 4) {
             PrintUsage(argv);
             return 42;
         }
-        std::string alphabetFile = argv[2];
-        std::string datasetFile = argv[3];
-        std::string resultModelFile = argv[4];
-		int minWordFreq = 0;
-		if (argc >= 6) {
-			minWordFreq = std::stoi(argv[5]);
-		}
-        return Train(alphabetFile, datasetFile, resultModelFile, minWordFreq);
+        std::vector<std::string> inputFiles(args.begin() + 3, args.end());
+        if (!TNgramCounts::Merge(inputFiles, args[2])) {
+            std::cerr << "[error] failed to merge n-gram counts" << std::endl;
+            return 42;
+        }
+        return 0;
+    } else if (mode == "build") {
+        if (args.size() < 4) {
+            PrintUsage(argv);
+            return 42;
+        }
+        TTrainOptions options;
+        if (args.size() >= 5 && !ParseNumber(args[4], options.MinWordFreq)) {
+            PrintUsage(argv);
+            return 42;
+        }
+        if (!RejectCountingFlags(flags, mode) || !ParseTrainOptions(flags, args[3], options)) {
+            return 42;
+        }
+        return Build(args[2], args[3], options, flags);
     } else if (mode == "score") {
-        if (argc < 3) {
+        if (args.size() < 3) {
             PrintUsage(argv);
             return 42;
         }
-        std::string modelFile = argv[2];
+        std::string modelFile = args[2];
         return Score(modelFile);
     } else if (mode == "correct") {
-        if (argc < 3) {
+        if (args.size() < 3) {
             PrintUsage(argv);
             return 42;
         }
-        std::string modelFile = argv[2];
+        std::string modelFile = args[2];
         return Correct(modelFile);
     } else if (mode == "fix") {
-        if (argc < 5) {
+        if (args.size() < 5) {
             PrintUsage(argv);
             return 42;
         }
-        std::string modelFile = argv[2];
-        std::string inFile = argv[3];
-        std::string outFile = argv[4];
+        std::string modelFile = args[2];
+        std::string inFile = args[3];
+        std::string outFile = args[4];
         return Fix(modelFile, inFile, outFile);
     } else if (mode == "dump_vocab") {
-        if (argc < 5) {
+        if (args.size() < 5) {
             PrintUsage(argv);
             return 42;
         }
-        std::string modelFile = argv[2];
-        std::string modelVocabFile = argv[3];
-	std::string modelVocabFreqFile = argv[4];
+        std::string modelFile = args[2];
+        std::string modelVocabFile = args[3];
+	std::string modelVocabFreqFile = args[4];
         return DumpModelVocab(modelFile, modelVocabFile, modelVocabFreqFile);
     } else if (mode == "finetune_vocab") {
-        if (argc < 6) {
+        if (args.size() < 6) {
             PrintUsage(argv);
             return 42;
         }
-	std::string modelFile = argv[2];
-        std::string alphabetFile = argv[3];
-        std::string vocabTextFile = argv[4];
-        std::string resultModelFile = argv[5];
+	std::string modelFile = args[2];
+        std::string alphabetFile = args[3];
+        std::string vocabTextFile = args[4];
+        std::string resultModelFile = args[5];
         return FinetuneVocab(modelFile, alphabetFile, vocabTextFile, resultModelFile);
-    } 
+    } else if (mode == "compact") {
+        if (args.size() < 4) {
+            PrintUsage(argv);
+            return 42;
+        }
+        return Compact(args[2], args[3], args.size() >= 5 ? args[4] : "", flags);
+    } else if (mode == "inspect") {
+        if (args.size() < 3) {
+            PrintUsage(argv);
+            return 42;
+        }
+        return Inspect(args[2]);
+    } else if (mode == "convert") {
+        if (args.size() < 4) {
+            PrintUsage(argv);
+            return 42;
+        }
+        return Convert(args[2], args[3], args.size() >= 5 ? args[4] : "", flags);
+    }
 
     PrintUsage(argv);
     return 42;
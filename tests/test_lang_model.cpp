@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <map>
+#include <cwctype>
+
+#include <gtest/gtest.h>
+
+#include <jamspell/lang_model.hpp>
+#include <jamspell/spell_corrector.hpp>
+
+#include "test_utils.hpp"
+
+using namespace NJamSpell;
+
+class LangModelTest: public ::testing::Test {
+protected:
+    static void SetUpTestCase() {
+        Model = new TLangModel();
+        ASSERT_TRUE(Model->Train(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt"));
+    }
+    static void TearDownTestCase() {
+        delete Model;
+        Model = nullptr;
+    }
+    static TLangModel* Model;
+};
+
+TLangModel* LangModelTest::Model = nullptr;
+
+TEST_F(LangModelTest, sentenceScorerMatchesScore) {
+    std::wstring text = L"i have seen the old man in the strete yesterday";
+    TWords sentence = Model->Tokenize(text)[0];
+    std::vector<std::wstring> candidates = {L"street", L"strete", L"the", L"xyzzy"};
+
+    TSentenceScorer scorer(*Model, sentence);
+    for (size_t position = 0; position < sentence.size(); ++position) {
+        TWords cands;
+        for (auto&& c: candidates) {
+            cands.push_back(TWord(c));
+        }
+        std::vector<double> scores = scorer.Score(position, cands);
+        ASSERT_EQ(cands.size(), scores.size());
+        for (size_t k = 0; k < cands.size(); ++k) {
+            TWords window;
+            for (size_t i = 0; i < sentence.size(); ++i) {
+                if (i + 2 >= position && i <= position + 2) {
+                    window.push_back(i == position ? cands[k] : sentence[i]);
+                }
+            }
+            ASSERT_EQ(Model->Score(window), scores[k]);
+        }
+    }
+}
+
+TEST_F(LangModelTest, vocabIndexFindsEveryWord) {
+    const TRobinHash& wordToId = Model->GetWordToId();
+    TVocabIndex vocab;
+    vocab.Build(wordToId, wordToId.size());
+    ASSERT_EQ(wordToId.size(), vocab.Size());
+    for (auto&& it: wordToId) {
+        ASSERT_EQ(it.second, vocab.Find(it.first.data(), it.first.size()));
+        TWord word = vocab.GetWord(it.second);
+        ASSERT_EQ(it.first, std::wstring(word.Ptr, word.Len));
+    }
+    std::wstring unknown = L"xyzzyq";
+    ASSERT_EQ(TVocabIndex::EMPTY_ID, vocab.Find(unknown.data(), unknown.size()));
+    ASSERT_EQ(nullptr, vocab.GetWord(wordToId.size()).Ptr);
+}
+
+TEST_F(LangModelTest, compressedModelScoresLikePlain) {
+    const TRobinHash& wordToId = Model->GetWordToId();
+    TVocabIndex vocab;
+    vocab.Build(wordToId, wordToId.size());
+    TFrontCodedVocab packed;
+    packed.Build(vocab, wordToId.size());
+    ASSERT_LT(packed.ByteSize(), vocab.ByteSize());
+    std::wstring word;
+    for (auto&& it: wordToId) {
+        ASSERT_EQ(it.second, packed.Find(it.first.data(), it.first.size()));
+        ASSERT_TRUE(packed.GetWord(it.second, word));
+        ASSERT_EQ(it.first, word);
+    }
+    std::wstring unknown = L"xyzzyq";
+    ASSERT_EQ(TFrontCodedVocab::EMPTY_ID, packed.Find(unknown.data(), unknown.size()));
+
+    TTempFiles files;
+    std::string plainFile = files.Path("plain.bin");
+    std::string compressedFile = files.Path("compressed.bin");
+    ASSERT_TRUE(Model->Dump(plainFile));
+    ASSERT_TRUE(Model->Dump(compressedFile, true));
+    ASSERT_LT(LoadFile(compressedFile).size(), LoadFile(plainFile).size());
+    TLangModel compressed;
+    ASSERT_TRUE(compressed.Load(compressedFile));
+    for (auto&& text: {L"i have seen the old man in the strete yesterday", L"the game is afoot watson"}) {
+        ASSERT_EQ(Model->Score(text), compressed.Score(text));
+    }
+}
+
+TEST_F(LangModelTest, logTablesScoreDrift) {
+    std::wstring text = UTF8ToWide(LoadFile(JAMSPELL_TEST_DATA "sherlockholmes.txt")).substr(0, 200000);
+    ToLower(text);
+    TSentences sentences = Model->Tokenize(text);
+    ASSERT_FALSE(sentences.empty());
+
+    std::vector<double> exactScores;
+    for (auto&& s: sentences) {
+        exactScores.push_back(Model->Score(s));
+    }
+
+    Model->SetScoringMode(EScoringMode::LogTables);
+    double maxDrift = 0;
+    for (size_t i = 0; i < sentences.size(); ++i) {
+        double score = Model->Score(sentences[i]);
+        double drift = std::abs(score - exactScores[i]) / std::max(1.0, std::abs(exactScores[i]));
+        maxDrift = std::max(maxDrift, drift);
+    }
+    Model->SetScoringMode(EScoringMode::Exact);
+
+    ASSERT_LT(maxDrift, 1e-5);
+}
+
+TEST(LangModelPruneTest, prunedModelFitsBudget) {
+    TTrainOptions options;
+    options.MaxModelBytes = 400000;
+    options.HeldOutPercent = 5;
+    TLangModel model;
+    ASSERT_TRUE(model.Train(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt", options));
+    TTempFiles files;
+    std::string modelFile = files.Path("model.bin");
+    ASSERT_TRUE(model.Dump(modelFile));
+    ASSERT_LE(LoadFile(modelFile).size(), options.MaxModelBytes);
+}
+
+TEST(LangModelOrderTest, trieStoreScoresEveryOrder) {
+    TTempFiles files;
+    std::string modelFile = files.Path("model.bin");
+    std::wstring text = L"i have seen the old man in the strete yesterday";
+    std::vector<std::wstring> candidates = {L"street", L"strete", L"the", L"xyzzy"};
+    for (uint32_t order: {2, 5}) {
+        TTrainOptions options;
+        options.Order = order;
+        options.NgramStore = NS_TRIE;
+        TLangModel model;
+        ASSERT_TRUE(model.Train(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt", options));
+        TWords sentence = model.Tokenize(text)[0];
+        TWords cands;
+        for (auto&& c: candidates) {
+            cands.push_back(TWord(c));
+        }
+
+        TSentenceScorer scorer(model, sentence);
+        for (size_t position = 0; position < sentence.size(); ++position) {
+            std::vector<double> scores = scorer.Score(position, cands);
+            ASSERT_EQ(cands.size(), scores.size());
+            for (size_t k = 0; k < cands.size(); ++k) {
+                TWords window;
+                for (size_t i = 0; i < sentence.size(); ++i) {
+                    if (i + order - 1 >= position && i <= position + order - 1) {
+                        window.push_back(i == position ? cands[k] : sentence[i]);
+                    }
+                }
+                ASSERT_EQ(model.Score(window), scores[k]);
+            }
+        }
+
+        ASSERT_TRUE(model.Dump(modelFile));
+        TLangModel loaded;
+        ASSERT_TRUE(loaded.Load(modelFile));
+        for (auto&& t: {text.c_str(), L"the game is afoot watson"}) {
+            ASSERT_EQ(model.Score(t), loaded.Score(t));
+        }
+    }
+}
+
+TEST(LangModelStatsTest, storeNgramsMatchFilledBuckets) {
+    TTrainOptions options;
+    options.Order = 4;
+    options.BigramBlockWords = 200;
+    TLangModel model;
+    ASSERT_TRUE(model.Train(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt", options));
+    TTempFiles files;
+    std::string modelFile = files.Path("model.bin");
+    ASSERT_TRUE(model.Dump(modelFile));
+    TLangModel loaded;
+    ASSERT_TRUE(loaded.Load(modelFile));
+
+    TModelStats stats = loaded.GetStats();
+    ASSERT_TRUE(stats.StoreNgramsCounted);
+    ASSERT_EQ(5u, stats.NgramsByOrder.size());
+    ASSERT_GT(stats.DenseBigrams, 0u);
+    uint64_t storeNgrams = stats.NgramsByOrder[2] + stats.NgramsByOrder[3] + stats.NgramsByOrder[4] - stats.DenseBigrams;
+    ASSERT_EQ(stats.FilledBuckets, storeNgrams);
+    ASSERT_GT(stats.FingerprintFalsePositiveRate, 0.0);
+    ASSERT_LT(stats.FingerprintFalsePositiveRate, 1e-4);
+
+    TMemoryUsage usage = loaded.MemoryUsage();
+    uint64_t total = 0;
+    std::map<std::string, uint64_t> parts;
+    for (auto&& part: usage.Parts) {
+        total += part.second;
+        parts[part.first] = part.second;
+    }
+    ASSERT_EQ(usage.Total(), total);
+    ASSERT_GT(parts["vocab_index"], 0u);
+    ASSERT_GT(parts["perfect_hash"], 0u);
+    ASSERT_GE(parts["buckets"], stats.Buckets);
+}
+
+TEST(LangModelSketchTest, sketchKeepsFrequentNgrams) {
+    TTrainOptions options;
+    options.MinWordFreq = 2;
+    // exact store, so that scores do not depend on the order n-grams were counted in
+    options.NgramStore = NS_TRIE;
+    TLangModel exact;
+    ASSERT_TRUE(exact.Train(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt", options));
+    // small enough for many collisions, which may only let extra n-grams in
+    options.CountSketchBytes = 1 << 16;
+    TLangModel sketched;
+    ASSERT_TRUE(sketched.Train(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt", options));
+
+    std::wstring text = UTF8ToWide(LoadFile(JAMSPELL_TEST_DATA "sherlockholmes.txt")).substr(0, 50000);
+    ToLower(text);
+    for (auto&& sentence: exact.Tokenize(text)) {
+        ASSERT_EQ(exact.Score(sentence), sketched.Score(sentence));
+    }
+}
+
+TEST(LangModelDeltaTest, compactionFoldsDelta) {
+    std::string text = LoadFile(JAMSPELL_TEST_DATA "sherlockholmes.txt");
+    size_t split = text.find(". ", text.size() * 3 / 4) + 2;
+    TTempFiles files;
+    std::string baseFile = files.Path("base.txt");
+    std::string updateFile = files.Path("update.txt");
+    std::string modelFile = files.Path("model.bin");
+    files.Path("model.bin.spell");
+    SaveFile(baseFile, text.substr(0, split));
+    SaveFile(updateFile, text.substr(split));
+    std::vector<std::string> countsFiles = {files.Path("base.counts"), files.Path("update.counts")};
+    TNgramCounts base;
+    ASSERT_TRUE(base.Count(baseFile, JAMSPELL_TEST_DATA "alphabet_en.txt", 3));
+    ASSERT_TRUE(base.Dump(countsFiles[0]));
+    TNgramCounts update;
+    ASSERT_TRUE(update.Count(updateFile, JAMSPELL_TEST_DATA "alphabet_en.txt", 3));
+    ASSERT_TRUE(update.Dump(countsFiles[1]));
+
+    TTrainOptions options;
+    options.NgramStore = NS_TRIE;
+    {
+        TLangModel model;
+        ASSERT_TRUE(model.Train(base, options));
+        ASSERT_TRUE(model.Dump(modelFile));
+    }
+    TSpellCorrector corrector;
+    ASSERT_TRUE(corrector.LoadLangModel(modelFile));
+    std::wstring newWord;
+    for (size_t i = 0; i < update.Words.size() && newWord.empty(); ++i) {
+        if (update.WordCounts[i] > 1 && !corrector.WordIsKnown(update.Words[i])) {
+            newWord = update.Words[i];
+        }
+    }
+    ASSERT_FALSE(newWord.empty());
+
+    TNgramCounts merged;
+    std::string mergedFile = files.Path("merged.counts");
+    ASSERT_TRUE(TNgramCounts::Merge(countsFiles, mergedFile));
+    ASSERT_TRUE(merged.Load(mergedFile));
+    TLangModel rebuilt;
+    ASSERT_TRUE(rebuilt.Train(merged, options));
+    std::wstring sample = UTF8ToWide(text.substr(split, 20000));
+    ToLower(sample);
+    TSentences sentences = rebuilt.Tokenize(sample);
+
+    ASSERT_TRUE(corrector.UpdateLangModel(countsFiles[1]));
+    ASSERT_TRUE(corrector.WordIsKnown(newWord));
+    ASSERT_GT(corrector.GetLangModel().GetDeltaSize(), 0);
+    // base and delta counts are summed after unpacking, so only roughly
+    for (auto&& sentence: sentences) {
+        double expected = rebuilt.Score(sentence);
+        ASSERT_NEAR(expected, corrector.GetLangModel().Score(sentence), 1e-2 * std::abs(expected));
+    }
+
+    ASSERT_TRUE(corrector.StartCompaction(countsFiles, options));
+    ASSERT_TRUE(corrector.FinishCompaction());
+    const TLangModel& compacted = corrector.GetLangModel();
+    ASSERT_EQ(compacted.GetDeltaSize(), 0);
+    ASSERT_TRUE(corrector.WordIsKnown(newWord));
+    for (auto&& sentence: sentences) {
+        ASSERT_EQ(rebuilt.Score(sentence), compacted.Score(sentence));
+    }
+}
+
+TEST(LangModelDeltaTest, compactionKeepsLaterUpdates) {
+    std::string text = LoadFile(JAMSPELL_TEST_DATA "sherlockholmes.txt");
+    size_t first = text.find(". ", text.size() / 2) + 2;
+    size_t second = text.find(". ", text.size() * 3 / 4) + 2;
+    TTempFiles files;
+    std::vector<std::string> parts = {text.substr(0, first), text.substr(first, second - first), text.substr(second)};
+    std::vector<TNgramCounts> counts(parts.size());
+    std::vector<std::string> countsFiles;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        std::string textFile = files.Path("part" + std::to_string(i) + ".txt");
+        countsFiles.push_back(files.Path("part" + std::to_string(i) + ".counts"));
+        SaveFile(textFile, parts[i]);
+        ASSERT_TRUE(counts[i].Count(textFile, JAMSPELL_TEST_DATA "alphabet_en.txt", 3));
+        ASSERT_TRUE(counts[i].Dump(countsFiles[i]));
+    }
+
+    TTrainOptions options;
+    options.NgramStore = NS_TRIE;
+    options.MinWordFreq = 2;
+    std::string modelFile = files.Path("model.bin");
+    files.Path("model.bin.spell");
+    {
+        TLangModel model;
+        ASSERT_TRUE(model.Train(counts[0], options));
+        ASSERT_TRUE(model.Dump(modelFile));
+    }
+    TSpellCorrector corrector;
+    ASSERT_TRUE(corrector.LoadLangModel(modelFile));
+    ASSERT_EQ(corrector.GetLangModel().GetMinWordFreq(), 2);
+    std::wstring rareWord;
+    std::wstring lateWord;
+    const TNgramCounts& late = counts[2];
+    for (size_t i = 0; i < late.Words.size(); ++i) {
+        const std::wstring& word = late.Words[i];
+        if (word.empty() || corrector.WordIsKnown(word) || std::count(counts[1].Words.begin(), counts[1].Words.end(), word)) {
+            continue;
+        }
+        if (late.WordCounts[i] == 1 && rareWord.empty()) {
+            rareWord = word;
+        } else if (late.WordCounts[i] > 1 && lateWord.empty()) {
+            lateWord = word;
+        }
+    }
+    ASSERT_FALSE(rareWord.empty());
+    ASSERT_FALSE(lateWord.empty());
+
+    ASSERT_TRUE(corrector.UpdateLangModel(countsFiles[1]));
+    ASSERT_TRUE(corrector.StartCompaction({countsFiles[0], countsFiles[1]}, options));
+    ASSERT_TRUE(corrector.UpdateLangModel(countsFiles[2]));
+    // below the minimal frequency, as a rebuild with the counts would drop it
+    ASSERT_FALSE(corrector.WordIsKnown(rareWord));
+    ASSERT_TRUE(corrector.WordIsKnown(lateWord));
+    ASSERT_TRUE(corrector.FinishCompaction());
+
+    const TLangModel& compacted = corrector.GetLangModel();
+    ASSERT_GT(compacted.GetDeltaSize(), 0);
+    ASSERT_FALSE(corrector.WordIsKnown(rareWord));
+    ASSERT_TRUE(corrector.WordIsKnown(lateWord));
+    TWordId wid = compacted.GetWordIdNoCreate(TWord(lateWord));
+    ASSERT_EQ(compacted.GetWordCount(wid), late.WordCounts[std::find(late.Words.begin(), late.Words.end(), lateWord) - late.Words.begin()]);
+}
+
+TEST(LangModelCompactTest, compactionKeepsScoresOfRemainingWords) {
+    TTrainOptions options;
+    options.NgramStore = NS_TRIE;
+    options.BigramBlockWords = 100;
+    TLangModel model;
+    ASSERT_TRUE(model.Train(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt", options));
+    std::string vocab = LoadFile(JAMSPELL_TEST_DATA "sherlockholmes.txt").substr(0, 30000);
+    TTempFiles files;
+    std::string vocabFile = files.Path("vocab.txt");
+    std::string finetunedFile = files.Path("finetuned.bin");
+    std::string compactedFile = files.Path("compacted.bin");
+    SaveFile(vocabFile, vocab);
+    ASSERT_TRUE(model.FinetuneVocab(vocabFile, JAMSPELL_TEST_DATA "alphabet_en.txt"));
+    ASSERT_TRUE(model.Dump(finetunedFile));
+
+    TLangModel compacted;
+    ASSERT_TRUE(compacted.Load(finetunedFile));
+    TTrainOptions compactOptions;
+    compacted.GetStoreOptions(compactOptions);
+    ASSERT_EQ(compactOptions.NgramStore, NS_TRIE);
+    ASSERT_TRUE(compacted.Compact(compactOptions));
+    ASSERT_TRUE(compacted.Dump(compactedFile));
+    ASSERT_LT(LoadFile(compactedFile).size(), LoadFile(finetunedFile).size() / 2);
+
+    // every word of the vocabulary text is left, with all n-grams between them
+    std::wstring text = UTF8ToWide(vocab);
+    ToLower(text);
+    for (auto&& sentence: model.Tokenize(text)) {
+        ASSERT_EQ(model.Score(sentence), compacted.Score(sentence));
+    }
+}
+
+TEST(LangModelCompactTest, compactionFromCountsKeepsThresholds) {
+    TTempFiles files;
+    std::string countsFile = files.Path("model.counts");
+    std::string modelFile = files.Path("model.bin");
+    std::string compactedFile = files.Path("compacted.bin");
+    TNgramCounts counts;
+    ASSERT_TRUE(counts.Count(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt", 3));
+    TTrainOptions options;
+    options.MinWordFreq = 2;
+    {
+        TLangModel model;
+        ASSERT_TRUE(model.Train(counts, options));
+        ASSERT_TRUE(model.Dump(modelFile));
+    }
+    TLangModel model;
+    ASSERT_TRUE(model.Load(modelFile));
+    TTrainOptions storeOptions;
+    model.GetStoreOptions(storeOptions);
+    ASSERT_EQ(2, storeOptions.MinWordFreq);
+    ASSERT_TRUE(model.Compact(storeOptions, &counts));
+    ASSERT_TRUE(model.Dump(compactedFile));
+    ASSERT_LE(LoadFile(compactedFile).size(), LoadFile(modelFile).size());
+}
+
+TEST(SpellCorrectorTest, fixDoesNotDependOnVocabLayout) {
+    TTempFiles files;
+    std::string modelFile = files.Path("model.bin");
+    files.Path("model.bin.spell");
+    TSpellCorrector trained;
+    ASSERT_TRUE(trained.TrainLangModel(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt",
+                                       modelFile));
+    // the loaded model keeps its frozen vocabulary, the trained one its hash map
+    TLangModel model;
+    ASSERT_TRUE(model.Load(modelFile));
+    TSpellCorrector loaded;
+    loaded.SwapLangModel(model);
+
+    std::wstring text = UTF8ToWide(LoadFile(JAMSPELL_TEST_DATA "sherlockholmes.txt").substr(100000, 20000));
+    size_t words = 0;
+    for (size_t i = 1; i < text.size(); ++i) {
+        if (text[i - 1] == L' ' && std::iswalpha(text[i]) && ++words % 5 == 0) {
+            text.erase(i, 1);
+        }
+    }
+    ASSERT_EQ(trained.FixFragment(text), loaded.FixFragment(text));
+    ToLower(text);
+    for (auto&& sentence: trained.GetLangModel().Tokenize(text)) {
+        std::vector<std::wstring> words;
+        for (auto&& word: sentence) {
+            words.push_back(std::wstring(word.Ptr, word.Len));
+        }
+        for (size_t i = 0; i < words.size(); ++i) {
+            ASSERT_EQ(trained.GetCandidates(words, i), loaded.GetCandidates(words, i));
+        }
+    }
+}
+
+TEST(UserDictionaryTest, overlayWordsAreKnownOnlyWithIt) {
+    TTempFiles files;
+    std::string dictionaryFile = files.Path("dictionary.txt");
+    TSpellCorrector corrector;
+    ASSERT_TRUE(corrector.TrainLangModel(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt",
+                                         files.Path("model.bin")));
+    SaveFile(dictionaryFile, "Kubernetes 50\nthe kubernetes 20\n");
+    TUserDictionary dictionary(corrector.GetLangModel());
+    ASSERT_TRUE(dictionary.Load(dictionaryFile));
+    ASSERT_EQ(1, dictionary.Size());
+
+    std::wstring text = L"I saw the kubernetis there";
+    std::wstring fixed = corrector.FixFragment(text);
+    ASSERT_FALSE(corrector.WordIsKnown(L"kubernetes"));
+    ASSERT_TRUE(corrector.WordIsKnown(L"kubernetes", &dictionary));
+    ASSERT_EQ(L"I saw the kubernetes there", corrector.FixFragment(text, &dictionary));
+    ASSERT_EQ(fixed, corrector.FixFragment(text));
+
+    // words of the model score the same with the overlay
+    TWords sentence = corrector.GetLangModel().Tokenize(L"i have seen the old man")[0];
+    TSentenceScorer scorer(corrector.GetLangModel(), sentence);
+    TSentenceScorer overlaid(corrector.GetLangModel(), sentence, &dictionary);
+    ASSERT_EQ(scorer.Score(3, {sentence[3]}), overlaid.Score(3, {sentence[3]}));
+
+    SaveFile(dictionaryFile, "kubernetes 99999999999999999999999\n");
+    TUserDictionary broken(corrector.GetLangModel());
+    ASSERT_FALSE(broken.Load(dictionaryFile));
+}
+
+TEST(ModelContainerTest, embeddedCacheLoadsWithoutRebuild) {
+    TTempFiles files;
+    std::string modelFile = files.Path("model.bin");
+    std::string cacheFile = files.Path("model.bin.spell");
+    TSpellCorrector trained;
+    ASSERT_TRUE(trained.TrainLangModel(JAMSPELL_TEST_DATA "sherlockholmes.txt", JAMSPELL_TEST_DATA "alphabet_en.txt",
+                                       modelFile));
+    TModelContainer container;
+    ASSERT_TRUE(container.Open(modelFile, LANG_MODEL_MAGIC_BYTE, LANG_MODEL_VERSION));
+    ASSERT_TRUE(container.HasSection("ngrams"));
+    ASSERT_TRUE(container.HasSection("deletes"));
+
+    TSpellCorrector loaded;
+    ASSERT_TRUE(loaded.LoadLangModel(modelFile));
+    ASSERT_FALSE(std::ifstream(cacheFile).is_open());
+    std::wstring text = L"I have seen the old man in the strete yesterdey";
+    ASSERT_EQ(trained.FixFragment(text), loaded.FixFragment(text));
+
+    std::string plainFile = files.Path("plain.bin");
+    std::string plainCacheFile = files.Path("plain.bin.spell");
+    ASSERT_TRUE(trained.GetLangModel().Dump(plainFile));
+    TSpellCorrector plain;
+    ASSERT_TRUE(plain.LoadLangModel(plainFile, false));
+    ASSERT_FALSE(std::ifstream(plainCacheFile).is_open());
+    ASSERT_EQ(trained.FixFragment(text), plain.FixFragment(text));
+
+    std::string data = LoadFile(modelFile);
+    for (auto&& section: container.GetSections()) {
+        if (section.Name == "unigrams") {
+            data[section.Offset + section.Length / 2] ^= 1;
+        }
+    }
+    SaveFile(modelFile, data);
+    TLangModel broken;
+    ASSERT_FALSE(broken.Load(modelFile));
+}
@@ -0,0 +1,132 @@
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <jamspell/ngram_store.hpp>
+#include <jamspell/ngram_counts.hpp>
+#include <jamspell/checkpoint.hpp>
+
+#include "test_utils.hpp"
+
+using namespace NJamSpell;
+
+TEST(NgramStoreTest, trieIsExact) {
+    const TWordId vocabSize = 3000;
+    std::unordered_map<TGramKey, TCount, TGramKeyHash> counts;
+    for (TWordId i = 0; i < 20000; ++i) {
+        TWordId w1 = (i * 7) % 97;
+        TWordId w2 = (i * 7919) % vocabSize;
+        TWordId w3 = (i * 104729) % vocabSize;
+        counts[TGramKey(w1, w2)] = i + 1;
+        counts[TGramKey(w1, w2, w3)] = i + 2;
+    }
+    // n-grams without a stored prefix
+    counts[TGramKey(500, 1, 2)] = 10;
+    for (TWordId i = 0; i < 1000; ++i) {
+        TWordId words[] = {i % 50, (i * 31) % vocabSize, (i * 17) % 7, i % 3, (i * 101) % vocabSize};
+        counts[TGramKey(words, 4)] = i + 3;
+        counts[TGramKey(words, 5)] = i + 4;
+    }
+    TGramCountList grams(counts.begin(), counts.end());
+
+    TTrieStore trie;
+    ASSERT_TRUE(trie.Build(grams, vocabSize));
+    TPerfectHashStore hash;
+    ASSERT_TRUE(hash.Build(grams, BL_16_16, TPerfectHashOptions()));
+
+    std::vector<TGramKey> keys;
+    for (auto&& it: grams) {
+        const TGramKey& key = it.first;
+        ASSERT_EQ(PackInt32(it.second), trie.Find(key.Words, key.Size));
+        ASSERT_EQ(PackInt32(it.second), hash.Find(key.Words, key.Size));
+        if (key.Size == 2) {
+            keys.push_back(key);
+        }
+    }
+    std::vector<TPackedCount> codes(keys.size());
+    trie.FindBatch(&keys[0], keys.size(), &codes[0]);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_EQ(PackInt32(counts[keys[i]]), codes[i]);
+    }
+
+    for (TWordId w1 = 0; w1 < 200; ++w1) {
+        for (TWordId w2 = 0; w2 < vocabSize; w2 += 13) {
+            TWordId words[] = {w1, w2, w2, w1, w2};
+            for (size_t size = 2; size <= MAX_GRAM_ORDER; ++size) {
+                if (!counts.count(TGramKey(words, size))) {
+                    ASSERT_EQ(0, trie.Find(words, size));
+                }
+            }
+        }
+    }
+
+    // store types of newer or corrupted files are not taken for a perfect hash
+    std::istringstream unknownType(std::string(1, '\x07') + std::string(64, '\0'));
+    TNgramStorage storage;
+    storage.Load(unknownType);
+    ASSERT_TRUE(unknownType.fail());
+    ASSERT_TRUE(storage.Empty());
+}
+
+TEST(NgramCountsTest, mergedShardsMatchWholeCorpus) {
+    std::string text = LoadFile(JAMSPELL_TEST_DATA "sherlockholmes.txt").substr(0, 300000);
+    // shards end at a sentence boundary, so no n-gram spans two of them
+    size_t split = text.find(". ", text.size() / 2) + 2;
+    TTempFiles files;
+    std::string wholeFile = files.Path("whole.txt");
+    std::vector<std::string> shardFiles = {files.Path("shard1.txt"), files.Path("shard2.txt")};
+    std::vector<std::string> shardCountsFiles = {files.Path("shard1.counts"), files.Path("shard2.counts")};
+    std::string mergedFile = files.Path("merged.counts");
+    SaveFile(wholeFile, text);
+    SaveFile(shardFiles[0], text.substr(0, split));
+    SaveFile(shardFiles[1], text.substr(split));
+
+    TNgramCounts whole;
+    ASSERT_TRUE(whole.Count(wholeFile, JAMSPELL_TEST_DATA "alphabet_en.txt", 4));
+    for (size_t i = 0; i < shardFiles.size(); ++i) {
+        TNgramCounts shard;
+        ASSERT_TRUE(shard.Count(shardFiles[i], JAMSPELL_TEST_DATA "alphabet_en.txt", 4));
+        ASSERT_TRUE(shard.Dump(shardCountsFiles[i]));
+    }
+    ASSERT_TRUE(TNgramCounts::Merge(shardCountsFiles, mergedFile));
+    TNgramCounts merged;
+    ASSERT_TRUE(merged.Load(mergedFile));
+
+    ASSERT_EQ(whole.Order, merged.Order);
+    ASSERT_EQ(whole.TotalWords, merged.TotalWords);
+    ASSERT_EQ(whole.Words, merged.Words);
+    ASSERT_EQ(whole.WordCounts, merged.WordCounts);
+    ASSERT_EQ(whole.Tables.size(), merged.Tables.size());
+    for (size_t i = 0; i < whole.Tables.size(); ++i) {
+        ASSERT_EQ(whole.Tables[i].Words, merged.Tables[i].Words);
+        ASSERT_EQ(whole.Tables[i].Counts, merged.Tables[i].Counts);
+    }
+}
+
+TEST(CheckpointsTest, onlyCompleteCheckpointsOfTheRunAreLoaded) {
+    TTempFiles files;
+    std::string prefix = files.Path("checkpoint");
+    std::string phaseFile = files.Path("checkpoint.phase");
+    std::vector<uint32_t> saved = {1, 2, 3, 5, 8};
+    TCheckpoints checkpoints(prefix, 42, true);
+    ASSERT_TRUE(checkpoints.Save("phase", [&saved](std::ostream& out) {
+        NHandyPack::Dump(out, saved);
+    }));
+
+    std::vector<uint32_t> loaded;
+    auto load = [&loaded](std::istream& in) {
+        NHandyPack::Load(in, loaded);
+    };
+    ASSERT_TRUE(checkpoints.Load("phase", load));
+    ASSERT_EQ(saved, loaded);
+    ASSERT_FALSE(checkpoints.Load("other_phase", load));
+    ASSERT_FALSE(TCheckpoints(prefix, 43, true).Load("phase", load));
+    ASSERT_FALSE(TCheckpoints(prefix, 42, false).Load("phase", load));
+
+    std::string data = LoadFile(phaseFile);
+    SaveFile(phaseFile, data.substr(0, data.size() - 3));
+    ASSERT_FALSE(checkpoints.Load("phase", load));
+
+    checkpoints.Remove("phase");
+    ASSERT_FALSE(checkpoints.Load("phase", load));
+}
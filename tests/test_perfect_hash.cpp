@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <jamspell/perfect_hash.hpp>
+#include <jamspell/buckets.hpp>
 #include <contrib/handypack/handypack.hpp>
 
 TEST(PerfetHashTest, basicFlow) {
@@ -44,3 +45,110 @@ TEST(PerfetHashTest, basicFlow) {
     }
     ASSERT_EQ(keys.size(), bucketsUsed.size());
 }
+
+TEST(PerfetHashTest, batchMatchesSingle) {
+    NJamSpell::TPerfectHash ph;
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        uint32_t key[] = {i, i * 7 + 1};
+        keys.push_back(std::string((const char*)key, sizeof(key)));
+    }
+    ASSERT_TRUE(ph.Init(keys));
+
+    std::string data;
+    for (auto&& k: keys) {
+        data += k;
+    }
+    std::vector<uint32_t> buckets(keys.size());
+    std::vector<uint32_t> fingerprints(keys.size());
+    ph.HashBatch(&data[0], 8, keys.size(), &buckets[0], &fingerprints[0]);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        uint32_t fingerprint = 0;
+        ASSERT_EQ(ph.Hash(keys[i].data(), keys[i].size(), fingerprint), buckets[i]);
+        ASSERT_EQ(fingerprint, fingerprints[i]);
+    }
+}
+
+TEST(PerfetHashTest, partitionedBackends) {
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < 5000; ++i) {
+        uint32_t key[] = {i * 13, i, i + 5};
+        keys.push_back(std::string((const char*)key, sizeof(key)));
+    }
+    NJamSpell::EPerfectHashBackend backends[] = {NJamSpell::PHB_PHF, NJamSpell::PHB_COMPACT};
+    for (auto backend: backends) {
+        NJamSpell::TPerfectHashOptions options;
+        options.Backend = backend;
+        options.PartitionKeys = 700;
+        options.Threads = 3;
+        NJamSpell::TPerfectHash ph;
+        ASSERT_TRUE(ph.Init(keys, options));
+        ASSERT_EQ(8, ph.PartitionsNumber());
+        if (backend == NJamSpell::PHB_COMPACT) {
+            ASSERT_EQ(keys.size(), ph.BucketsNumber());
+        }
+
+        std::string serialized;
+        {
+            std::stringbuf buf;
+            std::ostream out(&buf);
+            ph.Dump(out);
+            serialized = buf.str();
+        }
+        NJamSpell::TPerfectHash ph2;
+        {
+            NHandyPack::imemstream in(&serialized[0], serialized.size());
+            ph2.Load(in);
+        }
+        ASSERT_EQ(backend, ph2.GetBackend());
+
+        std::string data;
+        for (auto&& k: keys) {
+            data += k;
+        }
+        std::vector<uint32_t> buckets(keys.size());
+        ph2.HashBatch(&data[0], 12, keys.size(), &buckets[0]);
+        std::set<uint32_t> bucketsUsed;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            ASSERT_EQ(ph.Hash(keys[i]), buckets[i]);
+            ASSERT_LT(buckets[i], ph.BucketsNumber());
+            bucketsUsed.insert(buckets[i]);
+        }
+        ASSERT_EQ(keys.size(), bucketsUsed.size());
+    }
+}
+
+TEST(PerfetHashTest, zeroPartitionKeys) {
+    std::vector<std::string> keys = {"a", "bb", "ccc", "dddd"};
+    NJamSpell::TPerfectHashOptions options;
+    options.PartitionKeys = 0;
+    NJamSpell::TPerfectHash ph;
+    ASSERT_TRUE(ph.Init(keys, options));
+    ASSERT_EQ(keys.size(), ph.PartitionsNumber());
+    std::set<uint32_t> bucketsUsed;
+    for (auto&& k: keys) {
+        ASSERT_LT(ph.Hash(k), ph.BucketsNumber());
+        bucketsUsed.insert(ph.Hash(k));
+    }
+    ASSERT_EQ(keys.size(), bucketsUsed.size());
+}
+
+TEST(BucketsTest, layoutsRoundTrip) {
+    NJamSpell::EBucketLayout layouts[] = {NJamSpell::BL_16_16, NJamSpell::BL_8_8,
+                                          NJamSpell::BL_20_12, NJamSpell::BL_24_8};
+    for (auto layout: layouts) {
+        const NJamSpell::TBucketLayoutInfo& info = NJamSpell::GetBucketLayoutInfo(layout);
+        uint32_t shift = 16 - info.CountBits;
+        NJamSpell::TBuckets buckets;
+        buckets.Init(layout, 1000);
+        for (uint32_t i = 0; i < 1000; i += 2) {
+            buckets.Set(i, i * 2654435761u, NJamSpell::TPackedCount(i * 37 + 1));
+        }
+        for (uint32_t i = 0; i < 1000; i += 2) {
+            NJamSpell::TPackedCount expected = NJamSpell::TPackedCount(i * 37 + 1) >> shift << shift;
+            ASSERT_EQ(expected, buckets.Find(i, i * 2654435761u));
+            ASSERT_EQ(0, buckets.Find(i, i * 2654435761u + 1));
+            ASSERT_EQ(0, buckets.Find(i + 1, 0));
+        }
+    }
+}
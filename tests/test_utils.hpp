@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include <gtest/gtest.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Scratch files of a test, in the gtest temporary directory and named after
+// the test and the process, so parallel and out of tree runs do not collide.
+// They are removed when the test ends, whether it passed or not.
+class TTempFiles {
+public:
+    ~TTempFiles() {
+        for (auto&& path: Paths) {
+            std::remove(path.c_str());
+        }
+    }
+
+    std::string Path(const std::string& name) {
+        const ::testing::TestInfo* test = ::testing::UnitTest::GetInstance()->current_test_info();
+        std::string path = ::testing::TempDir() + "jamspell_" + std::to_string(GetProcessId()) + "_" +
+                           test->test_case_name() + "_" + test->name() + "_" + name;
+        Paths.push_back(path);
+        return path;
+    }
+
+private:
+    static long GetProcessId() {
+#ifndef _WIN32
+        return getpid();
+#else
+        return 0;
+#endif
+    }
+
+private:
+    std::vector<std::string> Paths;
+};
@@ -2,9 +2,25 @@
 #include "contrib/httplib/httplib.h"
 #include "contrib/nlohmann/json.hpp"
 #include <cwctype>
+#include <map>
+#include <sstream>
+
+using TDictionaries = std::map<std::string, std::unique_ptr<NJamSpell::TUserDictionary>>;
+
+// User dictionary of the tenant given by the "dict" parameter, if any
+const NJamSpell::TUserDictionary* GetDictionary(const TDictionaries& dictionaries,
+                                                const httplib::Request& req)
+{
+    auto it = dictionaries.find(req.get_param_value("dict"));
+    if (it == dictionaries.end()) {
+        return nullptr;
+    }
+    return it->second.get();
+}
 
 std::string GetCandidates(const NJamSpell::TSpellCorrector& corrector,
-                          const std::string& text)
+                          const std::string& text,
+                          const NJamSpell::TUserDictionary* dictionary)
 {
     std::wstring input = NJamSpell::UTF8ToWide(text);
     std::transform(input.begin(), input.end(), input.begin(), std::towlower);
@@ -18,7 +34,7 @@ std::string GetCandidates(const NJamSpell::TSpellCorrector& corrector,
         for (size_t j = 0; j < sentence.size(); ++j) {
             NJamSpell::TWord currWord = sentence[j];
             std::wstring wCurrWord(currWord.Ptr, currWord.Len);
-            NJamSpell::TWords candidates = corrector.GetCandidatesRaw(sentence, j);
+            NJamSpell::TWords candidates = corrector.GetCandidatesRaw(sentence, j, dictionary);
             if (candidates.empty()) {
                 continue;
             }
@@ -46,15 +62,39 @@ std::string GetCandidates(const NJamSpell::TSpellCorrector& corrector,
 }
 
 std::string FixText(const NJamSpell::TSpellCorrector& corrector,
-                    const std::string& text)
+                    const std::string& text,
+                    const NJamSpell::TUserDictionary* dictionary)
 {
     std::wstring input = NJamSpell::UTF8ToWide(text);
-    return NJamSpell::WideToUTF8(corrector.FixFragment(input));
+    return NJamSpell::WideToUTF8(corrector.FixFragment(input, dictionary));
+}
+
+// Memory of the model and candidate cache by structure, and of the whole
+// process, in the Prometheus text format
+std::string GetMetrics(const NJamSpell::TSpellCorrector& corrector) {
+    std::ostringstream out;
+    NJamSpell::TMemoryUsage usage = corrector.MemoryUsage();
+    out << "# HELP jamspell_memory_bytes Memory taken by the model and candidate cache structures\n";
+    out << "# TYPE jamspell_memory_bytes gauge\n";
+    for (auto&& part: usage.Parts) {
+        out << "jamspell_memory_bytes{structure=\"" << part.first << "\"} " << part.second << "\n";
+    }
+    out << "jamspell_memory_bytes{structure=\"total\"} " << usage.Total() << "\n";
+    uint64_t rss = 0;
+    uint64_t peak = 0;
+    NJamSpell::GetProcessMemory(rss, peak);
+    out << "# HELP jamspell_process_resident_bytes Resident memory of the process\n";
+    out << "# TYPE jamspell_process_resident_bytes gauge\n";
+    out << "jamspell_process_resident_bytes " << rss << "\n";
+    out << "# HELP jamspell_process_peak_resident_bytes Peak resident memory of the process\n";
+    out << "# TYPE jamspell_process_peak_resident_bytes gauge\n";
+    out << "jamspell_process_peak_resident_bytes " << peak << "\n";
+    return out.str();
 }
 
 int main(int argc, const char** argv) {
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " model.bin localhost 8080\n";
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " model.bin localhost 8080 [--huge-pages] [--prefault] [--mlock] [tenant=dictionary.txt ...]\n";
         return 42;
     }
 
@@ -62,28 +102,63 @@ int main(int argc, const char** argv) {
     std::string hostname = argv[2];
     int port = std::stoi(argv[3]);
 
+    NJamSpell::TMemoryOptions memoryOptions;
+    std::vector<std::string> dictionaryArgs;
+    for (int i = 4; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--huge-pages") {
+            memoryOptions.HugePages = true;
+        } else if (arg == "--prefault") {
+            memoryOptions.Prefault = true;
+        } else if (arg == "--mlock") {
+            memoryOptions.Lock = true;
+        } else {
+            dictionaryArgs.push_back(arg);
+        }
+    }
+
     NJamSpell::TSpellCorrector corrector;
+    corrector.SetMemoryOptions(memoryOptions);
     std::cerr << "[info] loading model" << std::endl;
     if (!corrector.LoadLangModel(modelFile)) {
         std::cerr << "[error] failed to load model" << std::endl;
         return 42;
     }
 
+    TDictionaries dictionaries;
+    for (auto&& arg: dictionaryArgs) {
+        size_t sep = arg.find('=');
+        if (sep == std::string::npos || sep == 0) {
+            std::cerr << "[error] user dictionary should be given as tenant=file" << std::endl;
+            return 42;
+        }
+        std::unique_ptr<NJamSpell::TUserDictionary> dictionary(new NJamSpell::TUserDictionary(corrector.GetLangModel()));
+        if (!dictionary->Load(arg.substr(sep + 1))) {
+            std::cerr << "[error] failed to load user dictionary" << std::endl;
+            return 42;
+        }
+        dictionaries[arg.substr(0, sep)] = std::move(dictionary);
+    }
+
     httplib::Server srv;
-    srv.Get("/fix", [&corrector](const httplib::Request& req, httplib::Response& resp) {
-        resp.set_content(FixText(corrector, req.get_param_value("text")) + "\n", "text/plain");
+    srv.Get("/fix", [&corrector, &dictionaries](const httplib::Request& req, httplib::Response& resp) {
+        resp.set_content(FixText(corrector, req.get_param_value("text"), GetDictionary(dictionaries, req)) + "\n", "text/plain");
+    });
+
+    srv.Post("/fix", [&corrector, &dictionaries](const httplib::Request& req, httplib::Response& resp) {
+        resp.set_content(FixText(corrector, req.body, GetDictionary(dictionaries, req)) + "\n", "text/plain");
     });
 
-    srv.Post("/fix", [&corrector](const httplib::Request& req, httplib::Response& resp) {
-        resp.set_content(FixText(corrector, req.body) + "\n", "text/plain");
+    srv.Get("/candidates", [&corrector, &dictionaries](const httplib::Request& req, httplib::Response& resp) {
+        resp.set_content(GetCandidates(corrector, req.get_param_value("text"), GetDictionary(dictionaries, req)) + "\n", "text/plain");
     });
 
-    srv.Get("/candidates", [&corrector](const httplib::Request& req, httplib::Response& resp) {
-        resp.set_content(GetCandidates(corrector, req.get_param_value("text")) + "\n", "text/plain");
+    srv.Post("/candidates", [&corrector, &dictionaries](const httplib::Request& req, httplib::Response& resp) {
+        resp.set_content(GetCandidates(corrector, req.body, GetDictionary(dictionaries, req)) + "\n", "text/plain");
     });
 
-    srv.Post("/candidates", [&corrector](const httplib::Request& req, httplib::Response& resp) {
-        resp.set_content(GetCandidates(corrector, req.body) + "\n", "text/plain");
+    srv.Get("/metrics", [&corrector](const httplib::Request&, httplib::Response& resp) {
+        resp.set_content(GetMetrics(corrector), "text/plain; version=0.0.4");
     });
 
     std::cerr << "[info] starting web server at " << hostname << ":" << port << std::endl;